@@ -0,0 +1,740 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+#include <Kore/System.h>
+
+#include "Settings.h"
+#include "EndEffector.h"
+#include "BatchSolver.h"
+#include "Skinning.h"
+#include "FixedSVD.h"
+#include "SimdMath.h"
+#include "Replay.h"
+
+#include <algorithm> // std::copy
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Solver microbenchmark: replays a take twice per IK mode and counts the heap allocations of the second,
+// steady-state pass. Fails if the solve loop allocates.
+//
+// Usage: BodyTrackingReplay --bench [--ik <mode>] [--wholebody] [--warmstart] [file.csv]
+//        BodyTrackingReplay --bench --svd
+//        BodyTrackingReplay --bench --dls
+//        BodyTrackingReplay --bench --simd
+//        BodyTrackingReplay --bench --batch <avatars> [--threads <n>] [--ik <mode>] [file.csv]
+//        BodyTrackingReplay --bench --skin [--threads <n>] [file.csv]
+//        BodyTrackingReplay --bench --ddl [file.ogex]
+//        BodyTrackingReplay --bench --recording [--threads <n>] [file.csv]	(see RecordingCheck.cpp)
+//        BodyTrackingReplay --bench --recorder							(see RecorderCheck.cpp)
+//        BodyTrackingReplay --bench --clock [file.csv]					(see ClockCheck.cpp)
+//   --ik <mode>	benchmark only this IK mode, default all modes
+//   --wholebody	solve all end-effectors together in one stacked Jacobian
+//   --warmstart	benchmark every mode a second time with warm start (see Settings.h warmStartIK) and report the saved iterations
+//   --svd			benchmark the SVD of Jacobian::calcSVD (FixedSVD) against MatrixRmn::ComputeSVD on random 6 x N Jacobians
+//   --dls			check Jacobian::solveDLS against the explicit damped pseudo-inverse on random 6 x N Jacobians, fails
+//					if they differ
+//   --simd			check the SimdMath kernels against the Kore operations they replace on random input, fails if they
+//					differ by more than a few ulp
+//   --batch <n>	solve the take on n avatars at once with BatchSolver, on one thread and on all threads
+//   --skin			skin the solved poses of the take with Skinning and with the old per-vertex loop of Avatar::animate,
+//					fails if the positions differ by more than the 16 bit weights and the dropped influences explain
+//   --threads <n>	threads of --batch and --skin, default number of cores
+//   --ddl			check the float literals of the OpenDDL parser against strtof and strtod on random literals, fails if
+//					a single one rounds differently, and time the parser on the .ogex file, default the male avatar
+//   file.csv		take to replay, default is the first file from Settings.h
+
+extern thread_local int ikMode;
+extern thread_local float lambda[];
+extern thread_local float errorMaxPos[];
+extern thread_local float errorMaxRot[];
+extern thread_local float maxIterations[];
+
+namespace {
+	std::atomic<bool> countAllocations(false);
+	std::atomic<long> allocations(0);
+}
+
+// Replaces the global allocation functions of the replay tool. The array and sized versions are replaced as well, the
+// library versions are only required to forward to these since C++14 and not every library does.
+void* operator new(std::size_t size) {
+	if (countAllocations) ++allocations;
+	void* ptr = std::malloc(size > 0 ? size : 1);
+	if (ptr == nullptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+
+using namespace Kore;
+
+namespace {
+	typedef std::chrono::high_resolution_clock Clock;
+	
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	
+	struct Frame {
+		EndEffectorIndices indices[numOfEndEffectors];
+		Kore::vec3 desPosition[numOfEndEffectors];
+		Kore::Quaternion desRotation[numOfEndEffectors];
+		float scale;
+	};
+	
+	void setFrame(BodyTracker* bodyTracker, const Frame& frame) {
+		for (int i = 0; i < numOfEndEffectors; ++i) {
+			EndEffectorIndices index = frame.indices[i];
+			if (index == unknown) continue;
+			bodyTracker->endEffector[index]->setDesPosition(frame.desPosition[i]);
+			bodyTracker->endEffector[index]->setDesRotation(frame.desRotation[i]);
+		}
+	}
+	
+	// Solves all frames and returns the solver time [ms]
+	double solveFrames(BodyTracker* bodyTracker, const std::vector<Frame>& frames) {
+		Clock::time_point start = Clock::now();
+		for (const Frame& frame : frames) {
+			setFrame(bodyTracker, frame);
+			for (int i = 0; i < numOfEndEffectors; ++i) bodyTracker->executeMovement(i);
+			bodyTracker->finishMovement();
+		}
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	
+	// Calibrates on the first frame, warms up and solves the take a second time. Returns the solver time [ms] of the
+	// second pass, its heap allocations and the mean iterations per solve.
+	double benchmarkPass(Avatar* avatar, BodyTracker* bodyTracker, const std::vector<Frame>& frames, long& passAllocations, float& meanIterations) {
+		setFrame(bodyTracker, frames[0]);
+		avatar->resetPositionAndRotation();
+		avatar->setScale(frames[0].scale);
+		bodyTracker->calibrate();
+		bodyTracker->calibratedAvatar = true;
+		
+		// Warm up: sizes all lazily allocated work buffers
+		avatar->resetVariables();
+		bodyTracker->resetEvalVariables();
+		solveFrames(bodyTracker, frames);
+		
+		avatar->resetVariables();
+		bodyTracker->resetEvalVariables();
+		allocations = 0;
+		countAllocations = true;
+		double time = solveFrames(bodyTracker, frames);
+		countAllocations = false;
+		
+		passAllocations = allocations;
+		meanIterations = avatar->getMeanIterations();
+		return time;
+	}
+	
+	// Solves the take on all avatars of the solver at once, every avatar at another position in the take after the
+	// calibration on the first frame. Returns the solver time [ms].
+	double solveBatch(BatchSolver* solver, const std::vector<BodyTracker*>& bodyTrackers, const std::vector<Frame>& frames) {
+		int count = solver->getAvatarCount();
+		for (int a = 0; a < count; ++a) {
+			solver->getAvatar(a)->resetVariables();
+			bodyTrackers[a]->calibratedAvatar = false;
+		}
+		
+		Clock::time_point start = Clock::now();
+		for (size_t f = 0; f < frames.size(); ++f) {
+			for (int a = 0; a < count; ++a) {
+				const Frame& frame = frames[f == 0 ? 0 : (f + a * frames.size() / count) % frames.size()];
+				solver->setScale(a, frame.scale);
+				for (int i = 0; i < numOfEndEffectors; ++i)
+					if (frame.indices[i] != unknown) solver->setTarget(a, frame.indices[i], frame.desPosition[i], frame.desRotation[i]);
+			}
+			solver->solve();
+		}
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	
+	void benchmarkBatch(const std::vector<Frame>& frames, int avatarCount, int threadCount, IKMode mode) {
+		std::vector<Avatar*> avatars;
+		std::vector<Logger*> loggers;
+		std::vector<BodyTracker*> bodyTrackers;
+		BatchSolver* serial = new BatchSolver(1);
+		BatchSolver* parallel = new BatchSolver(threadCount);
+		for (int a = 0; a < avatarCount; ++a) {
+			avatars.push_back(new Avatar("avatar/avatar_male.ogex"));
+			loggers.push_back(new Logger());
+			bodyTrackers.push_back(new BodyTracker(avatars[a], loggers[a], mode));
+			serial->addAvatar(avatars[a], bodyTrackers[a]);
+			parallel->addAvatar(avatars[a], bodyTrackers[a]);
+		}
+		
+		double serialTime = solveBatch(serial, bodyTrackers, frames);
+		double parallelTime = solveBatch(parallel, bodyTrackers, frames);
+		log(Info, "Batch IK: %i \t avatars: %i \t 1 thread: %f ms per frame \t %i threads: %f ms per frame \t speedup: %f \t %f avatar frames/s", mode, avatarCount, serialTime / frames.size(), threadCount, parallelTime / frames.size(), serialTime / parallelTime, avatarCount * frames.size() / (parallelTime / 1000.0));
+		
+		delete parallel;
+		delete serial;
+		for (int a = 0; a < avatarCount; ++a) {
+			delete bodyTrackers[a];
+			delete loggers[a];
+			delete avatars[a];
+		}
+	}
+	
+	// Decomposes count random 6 x N matrices, once independent ones and once a sequence of slowly changing ones like
+	// the Jacobians of consecutive IK iterations. FixedSVD starts from its last result, MatrixRmn always from scratch.
+	template<int N> void benchmarkSVD(int count, std::mt19937& random) {
+		std::uniform_real_distribution<double> value(-1.0, 1.0);
+		std::vector<double> matrices(count * 6 * N);
+		
+		MatrixRmn J(6, N);
+		MatrixRmn U(6, 6);
+		MatrixRmn V(N, N);
+		VectorRn d(Min(6, N));
+		FixedSVD<6, N> svd;
+		
+		for (int sequence = 0; sequence < 2; ++sequence) {
+			for (int k = 0; k < count * 6 * N; ++k) {
+				if (sequence && k >= 6 * N) matrices[k] = matrices[k - 6 * N] + 0.01 * value(random);
+				else matrices[k] = value(random);
+			}
+			
+			Clock::time_point start = Clock::now();
+			for (int k = 0; k < count; ++k) {
+				for (int m = 0; m < 6; ++m)
+					for (int n = 0; n < N; ++n)
+						J.Set(m, n, matrices[(k * 6 + m) * N + n]);
+				J.ComputeSVD(U, d, V);
+			}
+			double timeRmn = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+			
+			double A[6][N];
+			start = Clock::now();
+			for (int k = 0; k < count; ++k) {
+				for (int m = 0; m < 6; ++m)
+					for (int n = 0; n < N; ++n)
+						A[m][n] = matrices[(k * 6 + m) * N + n];
+				svd.compute(A);
+			}
+			double timeFixed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+			
+			// Reconstruction error of the last matrix
+			double maxError = 0.0;
+			for (int m = 0; m < 6; ++m) {
+				for (int n = 0; n < N; ++n) {
+					double sum = 0.0;
+					for (int i = 0; i < svd.size; ++i) sum += svd.U[m][i] * svd.d[i] * svd.V[n][i];
+					maxError = Max(maxError, fabs(sum - A[m][n]));
+				}
+			}
+			
+			log(Info, "SVD 6 x %i %s \t MatrixRmn: %f us \t FixedSVD: %f us \t max error: %g", N, sequence ? "sequence" : "random  ", timeRmn / count, timeFixed / count, maxError);
+		}
+	}
+	
+	// Compares the LDL^T solve of the DLS step with the damped pseudo-inverse (J^T * J + l^2 * I)^-1 * J^T that
+	// Jacobian used before, returns the largest difference relative to the step length
+	template<int N> float checkDLS(int count, float l, std::mt19937& random) {
+		typedef Jacobian<N> JacobianN;
+		std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+		
+		float maxDifference = 0.0f;
+		double timeInverse = 0.0, timeLDLT = 0.0;
+		for (int k = 0; k < count; ++k) {
+			typename JacobianN::mat_mxn jacobian;
+			typename JacobianN::vec_m deltaP;
+			for (int m = 0; m < 6; ++m) {
+				for (int n = 0; n < N; ++n) jacobian.Set(m, n, value(random));
+				deltaP[m] = 0.1f * value(random);
+			}
+			
+			Clock::time_point start = Clock::now();
+			typename JacobianN::mat_nxm transpose = jacobian.Transpose();
+			typename JacobianN::mat_nxn damping = JacobianN::mat_nxn::Identity() * (l * l);
+			Kore::Vector<float, N> reference = (transpose * jacobian + damping).Invert() * transpose * deltaP;
+			Clock::time_point middle = Clock::now();
+			Kore::Vector<float, N> theta = JacobianN::solveDLS(jacobian, deltaP, l);
+			Clock::time_point end = Clock::now();
+			
+			timeInverse += std::chrono::duration<double, std::micro>(middle - start).count();
+			timeLDLT += std::chrono::duration<double, std::micro>(end - middle).count();
+			
+			float difference = (theta - reference).getLength() / Kore::max(reference.getLength(), nearNull);
+			maxDifference = Kore::max(maxDifference, difference);
+		}
+		
+		log(Info, "DLS 6 x %i \t inverse: %f us \t LDL^T: %f us \t max relative difference: %g", N, timeInverse / count, timeLDLT / count, maxDifference);
+		return maxDifference;
+	}
+	
+	// Largest difference of two float arrays relative to the largest magnitude of the reference
+	float maxDifference(const float* values, const float* reference, int count) {
+		float difference = 0.0f, magnitude = 0.0f;
+		for (int i = 0; i < count; ++i) {
+			difference = Kore::max(difference, fabsf(values[i] - reference[i]));
+			magnitude = Kore::max(magnitude, fabsf(reference[i]));
+		}
+		return difference / Kore::max(magnitude, FLT_MIN);
+	}
+	
+	// Compares every kernel of SimdMath with the Kore operations on count random inputs, returns the largest relative
+	// difference. Each kernel runs over all inputs in one timed loop.
+	float checkSimd(int count, std::mt19937& random) {
+		std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+		std::vector<Kore::mat4> matrices(count + 1);
+		std::vector<Kore::Quaternion> rotations(count + 1);
+		std::vector<Kore::vec3> levers(count);
+		for (int k = 0; k <= count; ++k) {
+			for (int i = 0; i < 4; ++i)
+				for (int j = 0; j < 4; ++j)
+					matrices[k].Set(i, j, value(random));
+			rotations[k] = Kore::Quaternion(value(random), value(random), value(random), value(random));
+			rotations[k].normalize();
+			if (k < count) levers[k] = Kore::vec3(value(random), value(random), value(random));
+		}
+		
+		std::vector<Kore::mat4> referenceMatrices(count), resultMatrices(count);
+		std::vector<Kore::Quaternion> referenceRotations(count), resultRotations(count);
+		std::vector<float> referenceColumns(count * 6), resultColumns(count * 6);
+		double timeKore[4], timeSimd[4];
+		
+		Clock::time_point start = Clock::now();
+		for (int k = 0; k < count; ++k) referenceMatrices[k] = matrices[k] * matrices[k + 1];
+		timeKore[0] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) Kore::SimdMath::multiply(matrices[k], matrices[k + 1], resultMatrices[k]);
+		timeSimd[0] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		float differences[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int k = 0; k < count; ++k)
+			differences[0] = Kore::max(differences[0], maxDifference(&resultMatrices[k].matrix[0][0], &referenceMatrices[k].matrix[0][0], 16));
+		
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) {
+			referenceRotations[k] = rotations[k].rotated(rotations[k + 1]);
+			referenceRotations[k].normalize();
+		}
+		timeKore[1] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) {
+			resultRotations[k] = Kore::SimdMath::multiply(rotations[k], rotations[k + 1]);
+			Kore::SimdMath::normalize(resultRotations[k]);
+		}
+		timeSimd[1] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		for (int k = 0; k < count; ++k) {
+			const float reference[4] = { referenceRotations[k].x, referenceRotations[k].y, referenceRotations[k].z, referenceRotations[k].w };
+			const float result[4] = { resultRotations[k].x, resultRotations[k].y, resultRotations[k].z, resultRotations[k].w };
+			differences[1] = Kore::max(differences[1], maxDifference(result, reference, 4));
+		}
+		
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) referenceMatrices[k] = matrices[k] * rotations[k].matrix().Transpose();
+		timeKore[2] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) Kore::SimdMath::localMatrix(matrices[k], rotations[k], resultMatrices[k]);
+		timeSimd[2] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		for (int k = 0; k < count; ++k)
+			differences[2] = Kore::max(differences[2], maxDifference(&resultMatrices[k].matrix[0][0], &referenceMatrices[k].matrix[0][0], 16));
+		
+		// The column of the old Jacobian::calcJacobianColumn
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) {
+			Kore::vec4 rotAxis(0, 0, 0, 0);
+			rotAxis[k % 3] = 1;
+			Kore::vec4 v = matrices[k] * rotAxis;
+			Kore::vec3 v_j(v.x(), v.y(), v.z());
+			Kore::vec3 pTheta = v_j.cross(levers[k]);
+			for (int i = 0; i < 3; ++i) {
+				referenceColumns[6 * k + i] = pTheta[i];
+				referenceColumns[6 * k + 3 + i] = v_j[i];
+			}
+		}
+		timeKore[3] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		start = Clock::now();
+		for (int k = 0; k < count; ++k) Kore::SimdMath::jacobianColumn(matrices[k], k % 3, levers[k], &resultColumns[6 * k]);
+		timeSimd[3] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		for (int k = 0; k < count; ++k)
+			differences[3] = Kore::max(differences[3], maxDifference(&resultColumns[6 * k], &referenceColumns[6 * k], 6));
+		
+		const char* const kernels[4] = { "mat4 * mat4", "quaternion multiply + normalize", "transform * rotation matrix", "Jacobian column" };
+		float difference = 0.0f;
+		for (int i = 0; i < 4; ++i) {
+			log(Info, "%s \t Kore: %f ns \t SimdMath: %f ns \t max relative difference: %g", kernels[i], 1000.0 * timeKore[i] / count, 1000.0 * timeSimd[i] / count, differences[i]);
+			difference = Kore::max(difference, differences[i]);
+		}
+		
+		return difference;
+	}
+	
+	// The old Avatar::animate: one mat4 * vec4 per influence for the position and for the normal (there with w = 1,
+	// the translation went into the normal). Here with w = 0 for the normal to compare with the fixed skinning.
+	void skinReference(const std::vector<Mesh*>& meshes, const Kore::mat4* finalTransform, float scale, float* const* vertices) {
+		for (int j = 0; j < (int)meshes.size(); ++j) {
+			const Mesh* mesh = meshes[j];
+			int currentBoneIndex = 0;
+			for (int i = 0; i < mesh->numVertices; ++i) {
+				vec4 startPos(0, 0, 0, 1);
+				vec4 startNormal(0, 0, 0, 0);
+				for (int b = 0; b < mesh->boneCountArray[i]; ++b) {
+					vec4 posVec(mesh->vertices[i * 3 + 0], mesh->vertices[i * 3 + 1], mesh->vertices[i * 3 + 2], 1);
+					vec4 norVec(mesh->normals[i * 3 + 0], mesh->normals[i * 3 + 1], mesh->normals[i * 3 + 2], 0);
+					const Kore::mat4& boneTransform = finalTransform[mesh->boneIndices[currentBoneIndex] + 1];
+					float boneWeight = mesh->boneWeight[currentBoneIndex];
+					startPos += (boneTransform * posVec) * boneWeight;
+					startNormal += (boneTransform * norVec) * boneWeight;
+					++currentBoneIndex;
+				}
+				float* vertex = &vertices[j][i * 8];
+				vertex[0] = startPos.x() * scale;
+				vertex[1] = startPos.y() * scale;
+				vertex[2] = startPos.z() * scale;
+				vertex[3] = mesh->texcoord[i * 2 + 0];
+				vertex[4] = 1.0f - mesh->texcoord[i * 2 + 1];
+				vertex[5] = startNormal.x();
+				vertex[6] = startNormal.y();
+				vertex[7] = startNormal.z();
+			}
+		}
+	}
+	
+	// Solves the take, then skins every solved pose with the reference loop, with Skinning on one thread and on
+	// threadCount threads. Returns the largest relative difference of the positions to the reference.
+	float checkSkinning(const std::vector<Frame>& frames, int threadCount) {
+		Avatar* avatar = new Avatar("avatar/avatar_male.ogex");
+		Logger* logger = new Logger();
+		BodyTracker* bodyTracker = new BodyTracker(avatar, logger, DLS);
+		
+		setFrame(bodyTracker, frames[0]);
+		avatar->setScale(frames[0].scale);
+		bodyTracker->calibrate();
+		bodyTracker->calibratedAvatar = true;
+		
+		int boneCount = avatar->pose.boneCount + 1;
+		std::vector<Kore::mat4> poses(frames.size() * boneCount);
+		for (int f = 0; f < (int)frames.size(); ++f) {
+			setFrame(bodyTracker, frames[f]);
+			for (int i = 0; i < numOfEndEffectors; ++i) bodyTracker->executeMovement(i);
+			bodyTracker->finishMovement();
+			avatar->updateBones();
+			std::copy(avatar->pose.finalTransform, avatar->pose.finalTransform + boneCount, poses.begin() + f * boneCount);
+		}
+		
+		const std::vector<Mesh*>& meshes = avatar->meshes;
+		std::vector<std::vector<float>> referenceVertices(meshes.size()), resultVertices(meshes.size());
+		std::vector<float*> reference(meshes.size()), result(meshes.size());
+		int vertexCount = 0;
+		float maxWeightError = 0.0f;
+		for (int j = 0; j < (int)meshes.size(); ++j) {
+			maxWeightError = Kore::max(maxWeightError, meshes[j]->maxWeightError);
+			referenceVertices[j].resize(meshes[j]->numVertices * 8);
+			resultVertices[j].resize(meshes[j]->numVertices * 8);
+			reference[j] = referenceVertices[j].data();
+			result[j] = resultVertices[j].data();
+			vertexCount += meshes[j]->numVertices;
+		}
+		
+		Skinning* serial = new Skinning(meshes, 1);
+		Skinning* parallel = new Skinning(meshes, threadCount);
+		double time[3] = { 0.0, 0.0, 0.0 };
+		float difference = 0.0f;
+		for (int f = 0; f < (int)frames.size(); ++f) {
+			const Kore::mat4* finalTransform = &poses[f * boneCount];
+			
+			Clock::time_point start = Clock::now();
+			skinReference(meshes, finalTransform, avatar->scale, reference.data());
+			time[0] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			
+			start = Clock::now();
+			serial->skin(finalTransform, avatar->scale, result.data());
+			time[1] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			
+			start = Clock::now();
+			parallel->skin(finalTransform, avatar->scale, result.data());
+			time[2] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			
+			for (int j = 0; j < (int)meshes.size(); ++j) {
+				for (int i = 0; i < meshes[j]->numVertices; ++i)
+					difference = Kore::max(difference, maxDifference(&result[j][i * 8], &reference[j][i * 8], 3));
+			}
+		}
+		log(Info, "Skinning \t vertices: %i \t per vertex loop: %f ms \t Skinning 1 thread: %f ms \t %i threads: %f ms \t max relative difference: %g \t max weight error: %g", vertexCount, time[0] / frames.size(), time[1] / frames.size(), threadCount, time[2] / frames.size(), difference, maxWeightError);
+		
+		delete parallel;
+		delete serial;
+		delete bodyTracker;
+		delete logger;
+		delete avatar;
+		
+		return difference;
+	}
+	
+	// The decimal path of the old Data::ReadFloatMagnitude(float): sums the digits in float and scales by
+	// exp(exponent * ln 10), which is off by a few ulp for long literals
+	float readFloatReference(const char* text) {
+		float v = 0.0f;
+		for (; (*text >= '0' && *text <= '9') || *text == '_'; ++text) {
+			if (*text != '_') v = v * 10.0f + (float)(*text - '0');
+		}
+		if (*text == '.') {
+			float decimal = 10.0f;
+			for (++text; (*text >= '0' && *text <= '9') || *text == '_'; ++text) {
+				if (*text == '_') continue;
+				v += (float)(*text - '0') / decimal;
+				decimal *= 10.0f;
+			}
+		}
+		if (*text == 'e' || *text == 'E') {
+			bool negative = *++text == '-';
+			if (*text == '-' || *text == '+') ++text;
+			int exponent = 0;
+			for (; *text >= '0' && *text <= '9'; ++text) exponent = Kore::min(exponent * 10 + (*text - '0'), 65535);
+			if (exponent != 0) v *= (float)exp((float)(negative ? -exponent : exponent) * 2.3025850929940456840179914546844f);
+		}
+		return v;
+	}
+	
+	int ulpDistance(float a, float b) {
+		int32_t bitsA, bitsB;
+		std::memcpy(&bitsA, &a, 4);
+		std::memcpy(&bitsB, &b, 4);
+		return std::abs(bitsA - bitsB);
+	}
+	
+	// Random positive literals in the formats exporters write: shortest float (%.9g), float as double (%.17g, the
+	// OpenGEX exporter), fixed point, double, digit separators and more than 19 digits. Returns the number of literals
+	// Data::ReadFloatMagnitude rounds differently than strtof or strtod.
+	int checkFloatLiterals(int count, std::mt19937& random) {
+		std::uniform_int_distribution<uint32_t> bits(0, 0x7F7FFFFF);
+		std::uniform_real_distribution<double> uniform(0.0, 1000.0);
+		std::uniform_int_distribution<int> digit(0, 9);
+		std::vector<std::string> literals;
+		std::vector<float> printed;
+		char text[128];
+		for (int i = 0; i < count; ++i) {
+			uint32_t b = bits(random);
+			float value;
+			std::memcpy(&value, &b, 4);
+			switch (i % 6) {
+				case 0: snprintf(text, sizeof(text), "%.9g", value); break;
+				case 1: snprintf(text, sizeof(text), "%.17g", (double)value); break;
+				case 2: snprintf(text, sizeof(text), "%.*f", 1 + i % 8, uniform(random)); break;
+				case 3: snprintf(text, sizeof(text), "%.17g", uniform(random) * std::pow(10.0, digit(random) * 8 - 40)); break;
+				case 4: snprintf(text, sizeof(text), "%d_%03d.%d_%d", digit(random), (int)uniform(random), digit(random), digit(random)); break;
+				default: {
+					int length = snprintf(text, sizeof(text), "%d.", digit(random));
+					for (int k = 0; k < 40; ++k) text[length++] = (char)('0' + digit(random));
+					snprintf(&text[length], sizeof(text) - length, "e%d", digit(random) * 9 - 40);
+				}
+			}
+			literals.push_back(text);
+			printed.push_back(i % 6 < 2 ? value : -1.0f);
+		}
+		
+		int floatMismatches = 0, doubleMismatches = 0, roundTripFailures = 0, oldMismatches = 0, oldRoundTripFailures = 0, oldMaxUlp = 0;
+		for (int i = 0; i < count; ++i) {
+			const char* literal = literals[i].c_str();
+			std::string digits(literal);
+			digits.erase(std::remove(digits.begin(), digits.end(), '_'), digits.end());
+			
+			int32 length;
+			float f;
+			double d;
+			bool parsed = Data::ReadFloatMagnitude(literal, &length, &f) == kDataOkay && length == (int)literals[i].size();
+			parsed = parsed && Data::ReadFloatMagnitude(literal, &length, &d) == kDataOkay;
+			
+			// strtof and strtod round correctly, the literals use the C locale
+			float expectedFloat = strtof(digits.c_str(), nullptr);
+			double expectedDouble = strtod(digits.c_str(), nullptr);
+			if (!parsed || std::memcmp(&f, &expectedFloat, 4) != 0) {
+				if (floatMismatches++ < 10) log(Error, "Float literal %s: %.9g, expected %.9g", literal, f, expectedFloat);
+			}
+			if (!parsed || std::memcmp(&d, &expectedDouble, 8) != 0) {
+				if (doubleMismatches++ < 10) log(Error, "Double literal %s: %.17g, expected %.17g", literal, d, expectedDouble);
+			}
+			
+			float old = readFloatReference(literal);
+			if (old != expectedFloat) ++oldMismatches;
+			if (std::isfinite(old) && std::isfinite(expectedFloat)) oldMaxUlp = Kore::max(oldMaxUlp, ulpDistance(old, expectedFloat));
+			if (printed[i] >= 0.0f) {
+				if (f != printed[i]) ++roundTripFailures;
+				if (old != printed[i]) ++oldRoundTripFailures;
+			}
+		}
+		
+		// Only the float path, the part of the old parser that is kept in readFloatReference
+		float sum = 0.0f;
+		Clock::time_point start = Clock::now();
+		for (const std::string& literal : literals) sum += readFloatReference(literal.c_str());
+		double oldTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		start = Clock::now();
+		for (const std::string& literal : literals) {
+			int32 length;
+			float f;
+			Data::ReadFloatMagnitude(literal.c_str(), &length, &f);
+			sum += f;
+		}
+		double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		
+		log(Info, "Float literals \t count: %i \t float mismatches: %i \t double mismatches: %i \t round trip failures: %i \t old parser: %i mismatches, max %i ulp, %i round trip failures \t %f ns per literal, old %f ns (%g)", count, floatMismatches, doubleMismatches, roundTripFailures, oldMismatches, oldMaxUlp, oldRoundTripFailures, time * 1e6 / count, oldTime * 1e6 / count, sum);
+		return floatMismatches + doubleMismatches + roundTripFailures;
+	}
+	
+	// Whole OpenDDL parse of an .ogex file as MeshObject::ConvertObj does it, without the conversion into meshes
+	void benchmarkOpenDDL(const char* filename, int passes) {
+		std::ifstream file(filename, std::ios::binary);
+		std::stringstream text;
+		text << file.rdbuf();
+		std::string buffer = text.str();
+		
+		double best = DBL_MAX;
+		for (int pass = 0; pass < passes; ++pass) {
+			Clock::time_point start = Clock::now();
+			OGEX::OpenGexDataDescription description;
+			DataResult result = description.ProcessText(buffer.c_str());
+			best = Kore::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+			if (result != kDataOkay) {
+				log(Error, "Could not parse %s", filename);
+				return;
+			}
+		}
+		log(Info, "OpenDDL \t %s \t %i KB \t ProcessText: %f ms", filename, (int)(buffer.size() / 1024), best);
+	}
+}
+
+int runBenchmark(int argc, char** argv) {
+	if (argc > 1 && std::strcmp(argv[1], "--recording") == 0) return runRecordingCheck(argc - 1, argv + 1);
+	if (argc > 1 && std::strcmp(argv[1], "--recorder") == 0) return runRecorderCheck();
+	if (argc > 1 && std::strcmp(argv[1], "--clock") == 0) return runClockCheck(argc - 1, argv + 1);
+	
+	int minIk = JT, maxIk = ANALYTIC;
+	const char* filename = files[0];
+	bool wholeBodyIK = ::wholeBodyIK;
+	bool warmStart = false;
+	int batchAvatars = 0;
+	bool skin = false;
+	int batchThreads = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--ik") == 0 && i + 1 < argc) minIk = maxIk = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--wholebody") == 0) wholeBodyIK = true;
+		else if (std::strcmp(argv[i], "--warmstart") == 0) warmStart = true;
+		else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batchAvatars = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) batchThreads = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--skin") == 0) skin = true;
+		else if (std::strcmp(argv[i], "--svd") == 0) {
+			// The chain sizes of InverseKinematics: foot and forearm, head, hand with simple IK
+			std::mt19937 random(0);
+			benchmarkSVD<4>(100000, random);
+			benchmarkSVD<5>(100000, random);
+			benchmarkSVD<7>(100000, random);
+			return 0;
+		}
+		else if (std::strcmp(argv[i], "--dls") == 0) {
+			// Single precision: the old path inverted in float, so 1e-3 is a relative difference well above its rounding
+			std::mt19937 random(0);
+			float difference = checkDLS<4>(100000, optimalLambda[DLS], random);
+			difference = Kore::max(difference, checkDLS<5>(100000, optimalLambda[DLS], random));
+			difference = Kore::max(difference, checkDLS<7>(100000, optimalLambda[DLS], random));
+			return difference < 1e-3f ? 0 : 1;
+		}
+		else if (std::strcmp(argv[i], "--ddl") == 0) {
+			const char* ogexFile = i + 1 < argc ? argv[i + 1] : "avatar/avatar_male.ogex";
+			std::mt19937 random(0);
+			int mismatches = checkFloatLiterals(120000, random);
+			if (std::ifstream(ogexFile)) benchmarkOpenDDL(ogexFile, 5);
+			return mismatches == 0 ? 0 : 1;
+		}
+		else if (std::strcmp(argv[i], "--simd") == 0) {
+			// The kernels sum in a different order than Kore, that is a few rounding steps of the largest element
+			std::mt19937 random(0);
+			float difference = checkSimd(100000, random);
+			return difference < 8.0f * FLT_EPSILON ? 0 : 1;
+		}
+		else filename = argv[i];
+	}
+	
+	if (!std::ifstream(filename)) {
+		log(Error, "Could not find file %s", filename);
+		return 1;
+	}
+	
+	// Read the whole take up front, the file IO is not part of the benchmark
+	Logger* logger = new Logger();
+	std::vector<Frame> frames;
+	Frame frame;
+	while (logger->readData(numOfEndEffectors, filename, frame.desPosition, frame.desRotation, frame.indices, frame.scale)) frames.push_back(frame);
+	if (frames.empty()) return 1;
+	
+	std::copy(optimalLambda, optimalLambda + 7, lambda);
+	std::copy(optimalErrorMaxPos, optimalErrorMaxPos + 7, errorMaxPos);
+	std::copy(optimalErrorMaxRot, optimalErrorMaxRot + 7, errorMaxRot);
+	std::copy(optimalMaxIterations, optimalMaxIterations + 7, maxIterations);
+	
+	if (skin) {
+		// The loader quantises the weights and drops influences below 1/256 of a vertex (Mesh::maxWeightError), a
+		// dropped influence of a neighbouring bone moves the vertex by far less than its weight
+		float difference = checkSkinning(frames, batchThreads);
+		delete logger;
+		return difference < 1e-3f ? 0 : 1;
+	}
+	
+	if (batchAvatars > 0) {
+		ikMode = minIk == maxIk ? minIk : DLS;
+		benchmarkBatch(frames, batchAvatars, batchThreads, (IKMode)ikMode);
+		delete logger;
+		return 0;
+	}
+	
+	Avatar* avatar = new Avatar("avatar/avatar_male.ogex");
+	BodyTracker* bodyTracker = new BodyTracker(avatar, logger, (IKMode)minIk);
+	bodyTracker->wholeBodyIK = wholeBodyIK;
+	
+	bool allocationFree = true;
+	for (ikMode = minIk; ikMode <= maxIk; ++ikMode) {
+		bodyTracker->setIKMode((IKMode)ikMode);
+		
+		long passAllocations;
+		float iterations;
+		avatar->setWarmStart(false);
+		double time = benchmarkPass(avatar, bodyTracker, frames, passAllocations, iterations);
+		log(Info, "IK: %i \t frames: %i \t mean: %f ms \t iterations: %f \t heap allocations: %li", ikMode, (int)frames.size(), time / frames.size(), iterations, passAllocations);
+		if (passAllocations > 0) allocationFree = false;
+		
+		if (warmStart) {
+			float warmIterations;
+			avatar->setWarmStart(true);
+			double warmTime = benchmarkPass(avatar, bodyTracker, frames, passAllocations, warmIterations);
+			avatar->setWarmStart(false);
+			log(Info, "IK: %i warm start \t mean: %f ms \t iterations: %f \t saved iterations per solve: %f \t heap allocations: %li", ikMode, warmTime / frames.size(), warmIterations, iterations - warmIterations, passAllocations);
+			if (passAllocations > 0) allocationFree = false;
+		}
+	}
+	
+	delete bodyTracker;
+	delete avatar;
+	delete logger;
+	
+	return allocationFree ? 0 : 1;
+}
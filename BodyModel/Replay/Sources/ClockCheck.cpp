@@ -0,0 +1,88 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+
+#include "Settings.h"
+#include "Recording.h"
+#include "ReplayClock.h"
+#include "Replay.h"
+
+#include <cmath>
+#include <fstream>
+
+// Check of the replay pacing: plays the take with ReplayClock on a simulated clock in real time, at 2x, with a solver
+// slower than the take, unthrottled and stepped, fails if a frame is skipped or played out of order or if a paced
+// take does not end on time.
+//
+// Usage: BodyTrackingReplay --bench --clock [file.csv]
+//   file.csv		take to play, default is the first file from Settings.h
+
+using namespace Kore;
+
+namespace {
+	// Plays the whole take on a simulated clock: the caller asks for a frame every pollInterval and a played frame costs
+	// solveTime [s]. Returns the simulated time the take ended at, -1 if a frame was skipped or played out of order.
+	double playTake(const Recording* recording, ReplayClock& clock, double pollInterval, double solveTime, bool step) {
+		double now = 0.0;
+		int expected = 0;
+		clock.start(recording, now);
+		while (true) {
+			if (step) clock.step();
+			int f = clock.nextFrame(now);
+			if (f >= recording->getFrameCount()) break;
+			if (f >= 0 && f != expected++) return -1.0;
+			now += f >= 0 ? solveTime : pollInterval;
+		}
+		return expected == recording->getFrameCount() ? now : -1.0;
+	}
+	
+	bool checkReplayClock(const char* filename) {
+		Recording* recording = Recording::load(filename);
+		if (recording == nullptr) return false;
+		double duration = recording->getDuration() - recording->getFrame(0).time;
+		const double poll = 1.0 / 60.0;
+		bool ok = true;
+		
+		// Polled at 60 Hz by a free solver: on time within one poll, the frames of the take are at 90 Hz
+		ReplayClock realTime(1.0);
+		double end = playTake(recording, realTime, poll, 0.0, false);
+		ok = ok && end >= duration && end <= duration + poll && realTime.getMaxDrift() <= poll * 1000.0;
+		log(Info, "Clock \t real time \t take: %f s \t played in: %f s \t drift: mean %f ms, max %f ms", duration, end, realTime.getMeanDrift(), realTime.getMaxDrift());
+		
+		ReplayClock doubleSpeed(2.0);
+		end = playTake(recording, doubleSpeed, poll, 0.0, false);
+		ok = ok && end >= duration / 2.0 && end <= duration / 2.0 + poll;
+		log(Info, "Clock \t 2x \t\t take: %f s \t played in: %f s \t drift: mean %f ms, max %f ms", duration, end, doubleSpeed.getMeanDrift(), doubleSpeed.getMaxDrift());
+		
+		// A solver at 20 ms per frame falls behind, every frame is still played and the drift grows to the difference
+		ReplayClock slowSolver(1.0);
+		end = playTake(recording, slowSolver, poll, 0.02, false);
+		double expectedDrift = ((recording->getFrameCount() - 1) * 0.02 - duration) * 1000.0;
+		ok = ok && end >= 0.0 && std::abs(slowSolver.getLastDrift() - expectedDrift) < 20.0;
+		log(Info, "Clock \t slow solver \t take: %f s \t played in: %f s \t drift: mean %f ms, max %f ms, at the end %f ms", duration, end, slowSolver.getMeanDrift(), slowSolver.getMaxDrift(), slowSolver.getLastDrift());
+		
+		ReplayClock unthrottled(0.0);
+		end = playTake(recording, unthrottled, poll, 0.0, false);
+		ok = ok && end == 0.0;
+		
+		// Without a step nothing is played, with one step per poll every frame
+		ReplayClock stepped(1.0, true);
+		stepped.start(recording, 0.0);
+		ok = ok && stepped.nextFrame(1000.0) == -1;
+		end = playTake(recording, stepped, poll, 0.0, true);
+		ok = ok && end == 0.0;
+		
+		log(ok ? Info : Error, "Clock \t %s \t frames: %i \t %s", filename, recording->getFrameCount(), ok ? "passed" : "failed");
+		delete recording;
+		return ok;
+	}
+}
+
+int runClockCheck(int argc, char** argv) {
+	const char* filename = argc > 1 ? argv[1] : files[0];
+	if (!std::ifstream(filename)) {
+		log(Error, "Could not find file %s", filename);
+		return 1;
+	}
+	return checkReplayClock(filename) ? 0 : 1;
+}
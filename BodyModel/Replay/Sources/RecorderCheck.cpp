@@ -0,0 +1,59 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+#include <Kore/System.h>
+
+#include "EndEffector.h"
+#include "Replay.h"
+
+#include <chrono>
+#include <thread>
+
+// Check of the raw data recorder: times Logger::saveData for 10 s of raw data at 90 Hz and unpaced, writes
+// benchRecorder_<time>.csv, fails if the paced recording drops samples.
+//
+// Usage: BodyTrackingReplay --bench --recorder
+
+using namespace Kore;
+
+namespace {
+	typedef std::chrono::high_resolution_clock Clock;
+	
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	
+	// Records frames of all end-effectors through Logger::saveData like BodyTracker::executeMovement does, paced at 90 Hz
+	// or as fast as possible, and reports the time saveData takes per frame and what the writer thread reports
+	bool benchmarkRecorder(int frames, bool paced) {
+		Logger* logger = new Logger();
+		logger->startLogger("benchRecorder");
+		
+		double totalTime = 0.0, maxTime = 0.0;
+		Clock::time_point next = Clock::now();
+		for (int f = 0; f < frames; ++f) {
+			if (paced) {
+				next += std::chrono::microseconds(11111);
+				std::this_thread::sleep_until(next);
+			}
+			
+			Clock::time_point start = Clock::now();
+			for (int i = 0; i < numOfEndEffectors; ++i) {
+				logger->saveData(endEffectorTags[i], System::time(), vec3(0.1f * f, 1.5f, -0.01f * i), Kore::Quaternion(0, 0, 0, 1), 1.0f);
+			}
+			double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			totalTime += time;
+			maxTime = Kore::max(maxTime, time);
+		}
+		
+		int dropped = logger->getDroppedSamples();
+		logger->endLogger();
+		log(Info, "Recorder \t frames: %i%s \t saveData per frame: mean %f us, max %f us \t dropped: %i \t writer lag: max %f ms", frames, paced ? " at 90 Hz" : "", totalTime * 1000.0 / frames, maxTime * 1000.0, dropped, logger->getMaxWriterLag());
+		delete logger;
+		return paced ? dropped == 0 : true;
+	}
+}
+
+int runRecorderCheck() {
+	// A flood of a whole buffer per millisecond has to drop samples, the paced recording must not drop any
+	benchmarkRecorder(2000, false);
+	return benchmarkRecorder(900, true) ? 0 : 1;
+}
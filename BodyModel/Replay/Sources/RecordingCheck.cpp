@@ -0,0 +1,209 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+
+#include "Settings.h"
+#include "EndEffector.h"
+#include "Recording.h"
+#include "TakeReader.h"
+#include "Replay.h"
+
+#include <algorithm> // std::fill
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Check of the binary recordings: converts the take into a recording (see Recording.h), fails if a sample of the .csv
+// is not in its frame or TakeReader parses a number differently than strtof or strtod, and times reading the take as
+// text, opening, seeking and a chunked scan of the recording.
+//
+// Usage: BodyTrackingReplay --bench --recording [--threads <n>] [file.csv]
+//   --threads <n>	threads of the chunked scan, default number of cores
+//   file.csv		take to convert, default is the first file from Settings.h
+
+using namespace Kore;
+
+namespace {
+	typedef std::chrono::high_resolution_clock Clock;
+	
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	
+	// Random numbers as the Logger writes them (6 significant digits, the time column with 6 decimals) and longer ones,
+	// negative and with exponents. Returns the number of them TakeReader parses differently than strtof or strtod.
+	int checkTakeNumbers(int count, std::mt19937& random) {
+		std::uniform_int_distribution<uint32_t> bits(0, 0x7F7FFFFF);
+		std::uniform_real_distribution<double> uniform(-10.0, 10.0);
+		std::uniform_int_distribution<int> exponent(-12, 12);
+		char text[64];
+		int mismatches = 0;
+		for (int i = 0; i < count; ++i) {
+			uint32_t b = bits(random);
+			float value;
+			std::memcpy(&value, &b, 4);
+			switch (i % 5) {
+				case 0: snprintf(text, sizeof(text), "%g", uniform(random)); break;
+				case 1: snprintf(text, sizeof(text), "%g", uniform(random) * std::pow(10.0, exponent(random))); break;
+				case 2: snprintf(text, sizeof(text), "%.6f", std::abs(uniform(random)) * 1000.0); break;
+				case 3: snprintf(text, sizeof(text), "%.9g", i % 2 == 0 ? value : -value); break;
+				default: snprintf(text, sizeof(text), "%.17g", uniform(random) * std::pow(10.0, exponent(random))); break;
+			}
+			
+			const char* end = text + std::strlen(text);
+			float f;
+			double d;
+			bool parsed = TakeReader::parseFloat(text, end, f) == end && TakeReader::parseDouble(text, end, d) == end;
+			float expectedFloat = strtof(text, nullptr);
+			double expectedDouble = strtod(text, nullptr);
+			if (!parsed || std::memcmp(&f, &expectedFloat, 4) != 0 || std::memcmp(&d, &expectedDouble, 8) != 0) {
+				if (mismatches++ < 10) log(Error, "Number %s: %.9g, %.17g, expected %.9g, %.17g", text, f, d, expectedFloat, expectedDouble);
+			}
+		}
+		return mismatches;
+	}
+	
+	// Converts the take into a binary recording and checks it against the samples of the .csv, then times opening the
+	// take as text and as recording, random seeks and a scan of all frames in chunks on several threads
+	bool benchmarkRecording(const char* filename, int threadCount) {
+		// The text path of the replay, TakeReader through Logger::readData
+		Clock::time_point start = Clock::now();
+		Logger* logger = new Logger();
+		Kore::vec3 desPosition[numOfEndEffectors];
+		Kore::Quaternion desRotation[numOfEndEffectors];
+		EndEffectorIndices indices[numOfEndEffectors];
+		float scale;
+		int textFrames = 0;
+		while (logger->readData(numOfEndEffectors, filename, desPosition, desRotation, indices, scale)) ++textFrames;
+		double textTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		delete logger;
+		
+		// Touching every byte of the mapping is the floor of any reader of the take
+		MappedFile mapping;
+		mapping.map(filename);
+		start = Clock::now();
+		unsigned int lines = 0;
+		for (size_t i = 0; i < mapping.size(); ++i) lines += mapping.data()[i] == '\n';
+		double scanTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		
+		start = Clock::now();
+		if (!Recording::convert(filename)) return false;
+		double convertTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		
+		start = Clock::now();
+		Recording* recording = Recording::load(filename);
+		double openTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (recording == nullptr) return false;
+		int frameCount = recording->getFrameCount();
+		
+		// Every sample of the .csv is in the frame the tags before it put it in, read with the stream operators
+		start = Clock::now();
+		std::ifstream reader(filename);
+		std::string tag;
+		std::getline(reader, tag);
+		bool hasTime = tag.find(" time ") != std::string::npos;
+		int f = -1;
+		unsigned devices = ~0u;
+		int samples = 0, mismatches = 0;
+		double time;
+		float value[8];
+		while (reader >> tag && (!hasTime || reader >> time) && reader >> value[0] >> value[1] >> value[2] >> value[3] >> value[4] >> value[5] >> value[6] >> value[7]) {
+			int device = -1;
+			for (int i = 0; i < RecordedFrame::deviceCount; ++i) {
+				if (std::strcmp(tag.c_str(), endEffectorTags[i]) == 0) device = i;
+			}
+			if (device < 0) continue;
+			if (devices & (1u << device)) {
+				++f;
+				devices = 0;
+			}
+			devices |= 1u << device;
+			++samples;
+			
+			const RecordedFrame* recorded = f < frameCount ? &recording->getFrame(f) : nullptr;
+			if (recorded == nullptr || !recorded->hasDevice(device) || recorded->scale != value[7] ||
+				std::memcmp(recorded->position[device], &value[0], 3 * sizeof(float)) != 0 || std::memcmp(recorded->rotation[device], &value[3], 4 * sizeof(float)) != 0) {
+				if (mismatches++ < 10) log(Error, "Sample %i (%s) of %s differs in frame %i of the recording", samples, tag.c_str(), filename, f);
+			}
+		}
+		double streamTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (f + 1 != frameCount || textFrames != frameCount) {
+			log(Error, "%s has %i frames, the recording %i, Logger::readData read %i", filename, f + 1, frameCount, textFrames);
+			++mismatches;
+		}
+		
+		std::mt19937 random(0);
+		int numberMismatches = checkTakeNumbers(100000, random);
+		
+		// Random seeks by time
+		std::uniform_real_distribution<double> times(0.0, recording->getDuration());
+		const int seeks = 100000;
+		float sum = 0.0f;
+		start = Clock::now();
+		for (int i = 0; i < seeks; ++i) sum += recording->getFrame(recording->findFrame(times(random))).scale;
+		double seekTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		
+		// Mean head height over all frames, once on this thread and once in chunks; the per chunk sums are added in
+		// the same order, so both have to match exactly
+		const int chunkSize = 256;
+		int chunkCount = (frameCount + chunkSize - 1) / chunkSize;
+		std::vector<double> chunkSums(chunkCount);
+		auto sumChunk = [&](int chunk) {
+			double chunkSum = 0.0;
+			for (int i = chunk * chunkSize; i < Kore::min((chunk + 1) * chunkSize, frameCount); ++i) chunkSum += recording->getFrame(i).position[head][1];
+			chunkSums[chunk] = chunkSum;
+		};
+		
+		start = Clock::now();
+		for (int chunk = 0; chunk < chunkCount; ++chunk) sumChunk(chunk);
+		double serialSum = 0.0;
+		for (double chunkSum : chunkSums) serialSum += chunkSum;
+		double serialTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		
+		start = Clock::now();
+		std::fill(chunkSums.begin(), chunkSums.end(), 0.0);
+		std::atomic<int> nextChunk(0);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < Kore::max(threadCount, 1); ++t) {
+			workers.push_back(std::thread([&]() {
+				for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) sumChunk(chunk);
+			}));
+		}
+		for (std::thread& worker : workers) worker.join();
+		double parallelSum = 0.0;
+		for (double chunkSum : chunkSums) parallelSum += chunkSum;
+		double parallelTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (parallelSum != serialSum) {
+			log(Error, "Chunked scan of %s: %f, serial %f", filename, parallelSum, serialSum);
+			++mismatches;
+		}
+		
+		log(Info, "Recording \t %s \t frames: %i (text reader: %i reads) \t samples: %i \t mismatches: %i \t number mismatches: %i", filename, frameCount, textFrames, samples, mismatches, numberMismatches);
+		log(Info, "Recording \t %i KB \t text read: %f ms (%f MB/s) \t stream operators: %f ms \t byte scan: %f ms (%u lines)", (int)(mapping.size() / 1024), textTime, mapping.size() / (textTime * 1000.0), streamTime, scanTime, lines);
+		log(Info, "Recording \t convert: %f ms \t open: %f ms \t seek: %f ns \t scan: %f ms, %i threads: %f ms (%f, %g)", convertTime, openTime, seekTime * 1e6 / seeks, serialTime, Kore::max(threadCount, 1), parallelTime, frameCount > 0 ? serialSum / frameCount : 0.0, sum);
+		
+		delete recording;
+		return mismatches == 0 && numberMismatches == 0;
+	}
+}
+
+int runRecordingCheck(int argc, char** argv) {
+	const char* filename = files[0];
+	int threadCount = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threadCount = std::atoi(argv[++i]);
+		else filename = argv[i];
+	}
+	
+	if (!std::ifstream(filename)) {
+		log(Error, "Could not find file %s", filename);
+		return 1;
+	}
+	return benchmarkRecording(filename, threadCount) ? 0 : 1;
+}
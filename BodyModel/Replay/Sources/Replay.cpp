@@ -0,0 +1,252 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+#include <Kore/System.h>
+
+#include "Settings.h"
+#include "EndEffector.h"
+#include "CookedFile.h"
+#include "Recording.h"
+#include "ReplayClock.h"
+#include "Replay.h"
+
+#include <algorithm> // std::copy
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Headless batch replay: feeds the recorded .csv takes through the IK solver as fast as possible,
+// without a window, rendering or the real time pacing of Main.cpp.
+//
+// Usage: BodyTrackingReplay [--ik <mode>] [--wholebody] [--warmstart] [--poses] [--speed <x>] [file.csv ...]
+//        BodyTrackingReplay --sweep [options] [file.csv ...]	(see Sweep.cpp)
+//        BodyTrackingReplay --bench [options] [file.csv]		(see Bench.cpp)
+//        BodyTrackingReplay --cook [file.ogex|file.csv ...]
+//   --ik <mode>	IK mode (JT = 0, JPI = 1, DLS = 2, SVD = 3, SVD_DLS = 4, SDLS = 5, ANALYTIC = 6), default 2
+//   --wholebody	solve all end-effectors together in one stacked Jacobian (see Settings.h wholeBodyIK)
+//   --warmstart	start every solve from the extrapolated previous solutions (see Settings.h warmStartIK)
+//   --poses		write the solved skeleton of every frame to poses_IK_<mode>_<file>
+//   --speed <x>	play the frames at x times real time by their recorded times like Main.cpp and report the drift,
+//					default is as fast as possible
+//   file.csv		takes to replay, default are the files from Settings.h
+//   --cook			convert the .ogex files and write their cooked caches (see CookedFile.h) and the .csv takes into binary
+//					recordings (see Recording.h) instead of waiting for the first use to do it, default are the avatars
+//					and the scenes of Main.cpp and the files from Settings.h
+
+using namespace Kore;
+
+// IK parameters, normally defined in Main.cpp
+bool eval = false;
+thread_local int ikMode = 2;
+thread_local float lambda[7];
+thread_local float errorMaxPos[7];
+thread_local float errorMaxRot[7];
+thread_local float maxIterations[7];
+
+namespace {
+	typedef std::chrono::high_resolution_clock Clock;
+	
+	double elapsedMs(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	
+	const char* const cookFiles[] = { "avatar/avatar_male.ogex", "avatar/avatar_female.ogex", "sherlock_living_room/sherlock_living_room.ogex",
+		"vivemodels/vivetracker.ogex", "vivemodels/vivecontroller.ogex", "vivemodels/axis.ogex" };
+	
+	int runCook(int argc, char** argv) {
+		std::vector<const char*> sourceFiles(argv + 1, argv + argc);
+		if (sourceFiles.empty()) {
+			sourceFiles.assign(cookFiles, cookFiles + sizeof(cookFiles) / sizeof(cookFiles[0]));
+			sourceFiles.insert(sourceFiles.end(), files, files + numFiles);
+		}
+		
+		int failed = 0;
+		for (const char* filename : sourceFiles) {
+			if (!std::ifstream(filename)) {
+				log(Info, "Skipping missing file %s", filename);
+				continue;
+			}
+			
+			size_t length = std::strlen(filename);
+			if (length > 4 && std::strcmp(filename + length - 4, ".csv") == 0) {
+				Clock::time_point start = Clock::now();
+				bool converted = Recording::convert(filename);
+				double convertTime = elapsedMs(start);
+				
+				start = Clock::now();
+				Recording* recording = converted ? Recording::load(filename) : nullptr;
+				double openTime = elapsedMs(start);
+				
+				if (recording == nullptr) {
+					log(Error, "Converting %s failed", filename);
+					++failed;
+				} else {
+					log(Info, "%s \t convert: %f ms \t open: %f ms \t frames: %i", filename, convertTime, openTime, recording->getFrameCount());
+				}
+				
+				delete recording;
+				continue;
+			}
+			
+			// Without the old cache the constructor converts the file and writes a new one, the second load checks it
+			std::remove(CookedFile::getFileName(filename).c_str());
+			Clock::time_point start = Clock::now();
+			MeshObject* converted = new MeshObject(filename);
+			double convertTime = elapsedMs(start);
+			
+			start = Clock::now();
+			MeshObject* cooked = new MeshObject(filename);
+			double cookedTime = elapsedMs(start);
+			
+			bool same = converted->meshesCount == cooked->meshesCount && converted->bones.size() == cooked->bones.size() && converted->geometries.size() == cooked->geometries.size() && converted->materials.size() == cooked->materials.size();
+			if (!std::ifstream(CookedFile::getFileName(filename).c_str()) || !same) {
+				log(Error, "Cooking %s failed", filename);
+				++failed;
+			} else {
+				log(Info, "%s \t convert: %f ms \t cooked: %f ms", filename, convertTime, cookedTime);
+			}
+			
+			delete cooked;
+			delete converted;
+		}
+		
+		return failed == 0 ? 0 : 1;
+	}
+}
+
+ReplayStats replayFile(Avatar* avatar, Logger* logger, BodyTracker* bodyTracker, const char* filename, const char* poseFile, double speed) {
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	EndEffector** endEffector = bodyTracker->endEffector;
+	ReplayStats stats = { 0, 0.0, 0.0, 0.0, 0.0 };
+	
+	Recording* recording = Recording::load(filename);
+	if (recording == nullptr) return stats;
+	
+	if (poseFile != nullptr) logger->startPoseLogger(poseFile);
+	
+	bodyTracker->calibratedAvatar = false;
+	
+	ReplayClock clock(speed);
+	clock.start(recording, System::time());
+	while (true) {
+		int f = clock.nextFrame(System::time());
+		if (f < 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(250));
+			continue;
+		}
+		if (f >= recording->getFrameCount()) break;
+		
+		const RecordedFrame& frame = recording->getFrame(f);
+		for (int i = 0; i < numOfEndEffectors; ++i) {
+			if (!frame.hasDevice(i)) continue;
+			endEffector[i]->setDesPosition(frame.getPosition(i));
+			endEffector[i]->setDesRotation(frame.getRotation(i));
+			endEffector[i]->setDesTime(clock.getFrameTime());
+		}
+		
+		Clock::time_point start = Clock::now();
+		
+		if (!bodyTracker->calibratedAvatar) {
+			avatar->resetPositionAndRotation();
+			avatar->setScale(frame.scale);
+			bodyTracker->calibrate();
+			bodyTracker->calibratedAvatar = true;
+			
+			if (eval) {
+				avatar->resetVariables();
+				bodyTracker->resetEvalVariables();
+			}
+		}
+		
+		for (int i = 0; i < numOfEndEffectors; ++i) {
+			bodyTracker->executeMovement(i);
+		}
+		bodyTracker->finishMovement();
+		
+		double frameTime = elapsedMs(start);
+		stats.totalTime += frameTime;
+		if (frameTime > stats.maxTime) stats.maxTime = frameTime;
+		
+		if (poseFile != nullptr) logger->savePoseData(stats.frames, (float)frameTime, avatar->bones);
+		++stats.frames;
+	}
+	
+	if (poseFile != nullptr) logger->endPoseLogger();
+	
+	stats.meanDrift = clock.getMeanDrift();
+	stats.maxDrift = clock.getMaxDrift();
+	
+	delete recording;
+	return stats;
+}
+
+int kickstart(int argc, char** argv) {
+	if (argc > 1 && std::strcmp(argv[1], "--sweep") == 0) return runSweep(argc - 1, argv + 1);
+	if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) return runBenchmark(argc - 1, argv + 1);
+	if (argc > 1 && std::strcmp(argv[1], "--cook") == 0) return runCook(argc - 1, argv + 1);
+	
+	bool logPoses = false;
+	bool wholeBodyIK = ::wholeBodyIK;
+	bool warmStart = ::warmStartIK;
+	double speed = 0.0;
+	std::vector<const char*> replayFiles;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--ik") == 0 && i + 1 < argc) ikMode = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--poses") == 0) logPoses = true;
+		else if (std::strcmp(argv[i], "--wholebody") == 0) wholeBodyIK = true;
+		else if (std::strcmp(argv[i], "--warmstart") == 0) warmStart = true;
+		else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) speed = std::atof(argv[++i]);
+		else replayFiles.push_back(argv[i]);
+	}
+	if (replayFiles.empty()) replayFiles.assign(files, files + numFiles);
+	
+	if (ikMode < JT || ikMode > ANALYTIC) {
+		log(Error, "Unknown IK mode %i", ikMode);
+		return 1;
+	}
+	
+	std::copy(optimalLambda, optimalLambda + 7, lambda);
+	std::copy(optimalErrorMaxPos, optimalErrorMaxPos + 7, errorMaxPos);
+	std::copy(optimalErrorMaxRot, optimalErrorMaxRot + 7, errorMaxRot);
+	std::copy(optimalMaxIterations, optimalMaxIterations + 7, maxIterations);
+	
+	Avatar* avatar = new Avatar("avatar/avatar_male.ogex");
+	Logger* logger = new Logger();
+	BodyTracker* bodyTracker = new BodyTracker(avatar, logger, (IKMode)ikMode);
+	bodyTracker->wholeBodyIK = wholeBodyIK;
+	avatar->setWarmStart(warmStart);
+	
+	int overallFrames = 0;
+	double overallTime = 0.0;
+	Clock::time_point overallStart = Clock::now();
+	
+	for (const char* filename : replayFiles) {
+		// The poses are written to the working directory, named after the take without its directories
+		std::string poseFileName;
+		if (logPoses) {
+			std::string take(filename);
+			poseFileName = "poses_IK_" + std::to_string(ikMode) + "_" + take.substr(take.find_last_of("/\\") + 1);
+		}
+		
+		ReplayStats stats = replayFile(avatar, logger, bodyTracker, filename, logPoses ? poseFileName.c_str() : nullptr, speed);
+		if (stats.frames == 0) continue;
+		
+		log(Info, "%s \t IK: %i \t frames: %i \t total: %f ms \t mean: %f ms \t max: %f ms", filename, ikMode, stats.frames, stats.totalTime, stats.totalTime / stats.frames, stats.maxTime);
+		if (speed > 0.0) log(Info, "%s \t drift at %fx: mean %f ms \t max %f ms", filename, speed, stats.meanDrift, stats.maxDrift);
+		overallFrames += stats.frames;
+		overallTime += stats.totalTime;
+	}
+	
+	double wallTime = elapsedMs(overallStart);
+	if (overallFrames > 0) log(Info, "Replayed %i frames in %f ms (solver %f ms, %f ms per frame, %f frames/s)", overallFrames, wallTime, overallTime, overallTime / overallFrames, overallFrames / (wallTime / 1000.0));
+	
+	delete bodyTracker;
+	delete logger;
+	delete avatar;
+	
+	return 0;
+}
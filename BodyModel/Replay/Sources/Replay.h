@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Avatar.h"
+#include "Logger.h"
+#include "BodyTracker.h"
+
+struct ReplayStats {
+	int frames;
+	double totalTime;	// Solver time over all frames [ms]
+	double maxTime;		// Slowest frame [ms]
+	double meanDrift;	// How late the frames were solved after they were due, 0 unless paced [ms]
+	double maxDrift;
+};
+
+// Feeds one recorded take through the IK solver, as fast as possible or paced at speed times real time (see
+// ReplayClock.h). The solved skeleton of every frame is written to poseFile unless it is nullptr.
+ReplayStats replayFile(Avatar* avatar, Logger* logger, BodyTracker* bodyTracker, const char* filename, const char* poseFile, double speed = 0.0);
+
+// Parallel parameter sweep over IK mode x lambda x thresholds x file, see Sweep.cpp
+int runSweep(int argc, char** argv);
+
+// Solver timing and heap allocation benchmark, see Bench.cpp
+int runBenchmark(int argc, char** argv);
+
+// Checks of the recording subsystems, run by runBenchmark: the binary recordings and TakeReader (see RecordingCheck.cpp),
+// the raw data recorder of Logger (see RecorderCheck.cpp) and the replay pacing of ReplayClock (see ClockCheck.cpp)
+int runRecordingCheck(int argc, char** argv);
+int runRecorderCheck();
+int runClockCheck(int argc, char** argv);
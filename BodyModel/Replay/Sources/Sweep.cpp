@@ -0,0 +1,242 @@
+#include "pch.h"
+
+#include <Kore/Log.h>
+
+#include "Settings.h"
+#include "EndEffector.h"
+#include "Recording.h"
+#include "Replay.h"
+
+#include <algorithm> // std::copy, std::min
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Parameter sweep for the IK evaluation. Every configuration (IK mode x lambda x errorMaxPos x errorMaxRot x maxIterations x file)
+// is replayed from a reset skeleton, the configurations are distributed over all cores and the results are written in
+// the same format as the eval mode of Main.cpp (eval/evaluationData_IK_<mode>_<file>). A configuration does not see
+// what ran before it on the same worker, so the results do not depend on --threads or on the scheduling.
+//
+// Usage: BodyTrackingReplay --sweep [options] [file.csv ...]
+//   --ik <min> <max>						IK modes, default evalMinIk to evalMaxIk
+//   --lambda <min> <max> <step>			parameter ranges, a parameter without range uses the optimal value of each IK mode
+//   --errorMaxPos <min> <max> <step>
+//   --errorMaxRot <min> <max> <step>
+//   --maxIterations <min> <max> <step>
+//   --random <n>							draw n random configurations from the ranges per IK mode and file instead of the grid
+//   --seed <n>								seed for --random, default 0
+//   --threads <n>							worker threads, default number of cores
+
+extern thread_local int ikMode;
+extern thread_local float lambda[];
+extern thread_local float errorMaxPos[];
+extern thread_local float errorMaxRot[];
+extern thread_local float maxIterations[];
+
+using namespace Kore;
+
+namespace {
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	
+	struct Range {
+		bool set = false;
+		float min, max, step;
+	};
+	
+	struct SweepConfig {
+		int ikMode;
+		const char* file;
+		float lambda;
+		float errorMaxPos;
+		float errorMaxRot;
+		float maxIterations;
+	};
+	
+	struct SweepResult {
+		int frames;
+		float iterations[4];
+		float time[4];
+		float timeIteration[4];
+		float reached, stucked;
+		float meanErrorPos, stdErrorPos;
+		float meanErrorRot, stdErrorRot;
+		float error[numOfEndEffectors][4];	// Avg and std of the pos and rot error for every end-effector
+	};
+	
+	bool parseRange(int argc, char** argv, int& i, Range& range) {
+		if (i + 3 >= argc) return false;
+		range.min = (float)std::atof(argv[++i]);
+		range.max = (float)std::atof(argv[++i]);
+		range.step = (float)std::atof(argv[++i]);
+		range.set = true;
+		return true;
+	}
+	
+	// All grid values of a range, or the optimal value if no range is set
+	std::vector<float> gridValues(const Range& range, float optimal) {
+		std::vector<float> values;
+		if (!range.set) {
+			values.push_back(optimal);
+		} else if (range.step <= 0.0f) {
+			values.push_back(range.min);
+		} else {
+			int steps = (int)((range.max - range.min) / range.step + 0.5f);
+			for (int i = 0; i <= steps; ++i) values.push_back(range.min + i * range.step);
+		}
+		return values;
+	}
+	
+	float randomValue(const Range& range, float optimal, std::mt19937& random) {
+		if (!range.set) return optimal;
+		return std::uniform_real_distribution<float>(range.min, range.max)(random);
+	}
+	
+	// The returned arrays of the eval getters are allocated with new[]
+	void take(float* dst, float* src) {
+		std::copy(src, src + 4, dst);
+		delete[] src;
+	}
+	
+	// The worker's avatar is reset by replayFile on the first frame (pose, warm start and SVD, see
+	// Avatar::resetPositionAndRotation), the end-effectors and the IK parameters start fresh for every configuration
+	void solve(Avatar* avatar, const SweepConfig& config, SweepResult& result) {
+		// IK parameters are thread_local, so every worker owns its set
+		std::copy(optimalLambda, optimalLambda + 7, lambda);
+		std::copy(optimalErrorMaxPos, optimalErrorMaxPos + 7, errorMaxPos);
+		std::copy(optimalErrorMaxRot, optimalErrorMaxRot + 7, errorMaxRot);
+		std::copy(optimalMaxIterations, optimalMaxIterations + 7, maxIterations);
+		ikMode = config.ikMode;
+		lambda[ikMode] = config.lambda;
+		errorMaxPos[ikMode] = config.errorMaxPos;
+		errorMaxRot[ikMode] = config.errorMaxRot;
+		maxIterations[ikMode] = config.maxIterations;
+		Logger* logger = new Logger();
+		BodyTracker* bodyTracker = new BodyTracker(avatar, logger, (IKMode)ikMode);
+		
+		ReplayStats stats = replayFile(avatar, logger, bodyTracker, config.file, nullptr);
+		result.frames = stats.frames;
+		if (stats.frames == 0) {
+			delete bodyTracker;
+			delete logger;
+			return;
+		}
+		
+		take(result.iterations, avatar->getIterations());
+		take(result.time, avatar->getTime());
+		take(result.timeIteration, avatar->getTimeIteration());
+		result.reached = avatar->getReached();
+		result.stucked = avatar->getStucked();
+		
+		bodyTracker->getOverallError(result.meanErrorPos, result.stdErrorPos, result.meanErrorRot, result.stdErrorRot);
+		for (int i = 0; i < numOfEndEffectors; ++i) take(result.error[i], bodyTracker->endEffector[i]->getAvdStdPosRot());
+		
+		delete bodyTracker;
+		delete logger;
+	}
+}
+
+int runSweep(int argc, char** argv) {
+	int minIk = evalMinIk, maxIk = evalMaxIk;
+	Range lambdaRange, errorMaxPosRange, errorMaxRotRange, maxIterationsRange;
+	int randomSamples = 0;
+	unsigned seed = 0;
+	int numThreads = (int)std::thread::hardware_concurrency();
+	std::vector<const char*> sweepFiles;
+	
+	for (int i = 1; i < argc; ++i) {
+		bool valid = true;
+		if (std::strcmp(argv[i], "--ik") == 0 && i + 2 < argc) {
+			minIk = std::atoi(argv[++i]);
+			maxIk = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--lambda") == 0) valid = parseRange(argc, argv, i, lambdaRange);
+		else if (std::strcmp(argv[i], "--errorMaxPos") == 0) valid = parseRange(argc, argv, i, errorMaxPosRange);
+		else if (std::strcmp(argv[i], "--errorMaxRot") == 0) valid = parseRange(argc, argv, i, errorMaxRotRange);
+		else if (std::strcmp(argv[i], "--maxIterations") == 0) valid = parseRange(argc, argv, i, maxIterationsRange);
+		else if (std::strcmp(argv[i], "--random") == 0 && i + 1 < argc) randomSamples = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = (unsigned)std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) numThreads = std::atoi(argv[++i]);
+		else if (std::strncmp(argv[i], "--", 2) == 0) valid = false;
+		else sweepFiles.push_back(argv[i]);
+		
+		if (!valid) {
+			log(Error, "Invalid sweep argument %s", argv[i]);
+			return 1;
+		}
+	}
+	if (sweepFiles.empty()) sweepFiles.assign(files, files + numFiles);
+	if (minIk < JT || maxIk > ANALYTIC || minIk > maxIk) {
+		log(Error, "Invalid IK mode range %i - %i", minIk, maxIk);
+		return 1;
+	}
+	
+	// Configurations are grouped by IK mode and file, which is the order the results are written in
+	std::vector<SweepConfig> configs;
+	std::mt19937 random(seed);
+	for (int mode = minIk; mode <= maxIk; ++mode) {
+		for (const char* file : sweepFiles) {
+			if (randomSamples > 0) {
+				for (int n = 0; n < randomSamples; ++n) {
+					SweepConfig config = { mode, file,
+						randomValue(lambdaRange, optimalLambda[mode], random),
+						randomValue(errorMaxPosRange, optimalErrorMaxPos[mode], random),
+						randomValue(errorMaxRotRange, optimalErrorMaxRot[mode], random),
+						(float)(int)randomValue(maxIterationsRange, optimalMaxIterations[mode], random) };
+					configs.push_back(config);
+				}
+				continue;
+			}
+			
+			for (float l : gridValues(lambdaRange, optimalLambda[mode]))
+				for (float pos : gridValues(errorMaxPosRange, optimalErrorMaxPos[mode]))
+					for (float rot : gridValues(errorMaxRotRange, optimalErrorMaxRot[mode]))
+						for (float it : gridValues(maxIterationsRange, optimalMaxIterations[mode])) {
+							SweepConfig config = { mode, file, l, pos, rot, it };
+							configs.push_back(config);
+						}
+		}
+	}
+	
+	numThreads = std::max(1, std::min(numThreads, (int)configs.size()));
+	eval = true;
+	log(Info, "Sweep over %i configurations on %i threads", (int)configs.size(), numThreads);
+	
+	// Convert missing or stale recordings on this thread, otherwise every worker that starts on a take converts it
+	for (const char* file : sweepFiles) delete Recording::load(file);
+	
+	// Every worker owns a skeleton, the .ogex files are loaded up front on this thread
+	std::vector<Avatar*> avatars;
+	for (int t = 0; t < numThreads; ++t) avatars.push_back(new Avatar("avatar/avatar_male.ogex"));
+	
+	std::vector<SweepResult> results(configs.size());
+	std::atomic<int> nextConfig(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < numThreads; ++t) {
+		workers.push_back(std::thread([&, t]() {
+			for (int c = nextConfig++; c < (int)configs.size(); c = nextConfig++)
+				solve(avatars[t], configs[c], results[c]);
+		}));
+	}
+	for (std::thread& worker : workers) worker.join();
+	
+	// Aggregate into one evaluation file per IK mode and file
+	Logger* logger = new Logger();
+	for (size_t c = 0; c < configs.size(); ++c) {
+		const SweepConfig& config = configs[c];
+		const SweepResult& result = results[c];
+		if (result.frames > 0) {
+			logger->saveEvaluationData(config.file, config.ikMode, config.lambda, config.errorMaxPos, config.errorMaxRot, config.maxIterations, result.iterations, result.meanErrorPos, result.stdErrorPos, result.meanErrorRot, result.stdErrorRot, result.time, result.timeIteration, result.reached, result.stucked, result.error[head], result.error[hip], result.error[leftHand], result.error[leftForeArm], result.error[rightHand], result.error[rightForeArm], result.error[leftFoot], result.error[rightFoot], result.error[leftKnee], result.error[rightKnee]);
+		}
+		
+		bool lastOfGroup = c + 1 == configs.size() || configs[c + 1].ikMode != config.ikMode || configs[c + 1].file != config.file;
+		if (lastOfGroup) logger->endEvaluationLogger();
+	}
+	
+	delete logger;
+	for (Avatar* avatar : avatars) delete avatar;
+	
+	return 0;
+}
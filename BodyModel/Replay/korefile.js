@@ -0,0 +1,10 @@
+var project = new Project('BodyTrackingReplay', __dirname);
+
+project.addFile('Sources/**');
+project.addFile('../Sources/**');
+project.addExclude('../Sources/Main.cpp');
+project.addExclude('../Sources/*.glsl');
+project.addIncludeDir('../Sources');
+project.setDebugDir('../Deployment');
+
+resolve(project);
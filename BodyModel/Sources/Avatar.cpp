@@ -5,11 +5,24 @@
 using namespace Kore;
 using namespace Kore::Graphics4;
 
-Avatar::Avatar(const char* meshFile, const char* textureFile, const Kore::Graphics4::VertexStructure& structure, float scale) : MeshObject(meshFile, textureFile, structure, scale) {
-	invKin = new InverseKinematics(bones);
+Avatar::Avatar(const char* meshFile, const char* textureFile, const Kore::Graphics4::VertexStructure& structure, float scale) : MeshObject(meshFile, textureFile, structure, scale), skinning(nullptr) {
+	initSkeleton();
+}
+
+Avatar::Avatar(const char* meshFile, float scale) : MeshObject(meshFile, scale), skinning(nullptr) {
+	initSkeleton();
+}
+
+Avatar::~Avatar() {
+	delete skinning;
+	delete invKin;
+}
+
+void Avatar::initSkeleton() {
+	invKin = new InverseKinematics(bones, &pose);
 	
 	// Update bones
-	for (int i = 0; i < bones.size(); ++i) invKin->initializeBone(bones[i]);
+	invKin->initializeBones();
 	
 	// Get the highest position
 	BoneNode* head = getBoneWithIndex(headBoneIndex);
@@ -20,67 +33,39 @@ Avatar::Avatar(const char* meshFile, const char* textureFile, const Kore::Graphi
 
 void Avatar::animate(TextureUnit tex) {
 	// Update bones
-	for (int i = 0; i < bones.size(); ++i) invKin->initializeBone(bones[i]);
+	invKin->initializeBones();
 	
-	for(int j = 0; j < meshesCount; ++j) {
-		int currentBoneIndex = 0;	// Iterate over BoneCountArray
-		
-		Mesh* mesh = meshes[j];
-		
-		// Mesh Vertex Buffer
-		float* vertices = vertexBuffers[j]->lock();
-		for (int i = 0; i < mesh->numVertices; ++i) {
-			vec4 startPos(0, 0, 0, 1);
-			vec4 startNormal(0, 0, 0, 1);
-			
-			// For each vertex belonging to a mesh, the bone count array specifies the number of bones the influence the vertex
-			int numOfBones = mesh->boneCountArray[i];
-			
-			float totalJointsWeight = 0;
-			for (int b = 0; b < numOfBones; ++b) {
-				vec4 posVec(mesh->vertices[i * 3 + 0], mesh->vertices[i * 3 + 1], mesh->vertices[i * 3 + 2], 1);
-				vec4 norVec(mesh->normals[i * 3 + 0], mesh->normals[i * 3 + 1], mesh->normals[i * 3 + 2], 1);
-				
-				int index = mesh->boneIndices[currentBoneIndex] + 2;
-				BoneNode* bone = getBoneWithIndex(index);
-				float boneWeight = mesh->boneWeight[currentBoneIndex];
-				totalJointsWeight += boneWeight;
-				
-				startPos += (bone->finalTransform * posVec) * boneWeight;
-				startNormal += (bone->finalTransform * norVec) * boneWeight;
-				
-				currentBoneIndex ++;
-			}
-			
-			// position
-			vertices[i * 8 + 0] = startPos.x() * scale;
-			vertices[i * 8 + 1] = startPos.y() * scale;
-			vertices[i * 8 + 2] = startPos.z() * scale;
-			// texCoord
-			vertices[i * 8 + 3] = mesh->texcoord[i * 2 + 0];
-			vertices[i * 8 + 4] = 1.0f - mesh->texcoord[i * 2 + 1];
-			// normal
-			vertices[i * 8 + 5] = startNormal.x();
-			vertices[i * 8 + 6] = startNormal.y();
-			vertices[i * 8 + 7] = startNormal.z();
-			
-			//log(Info, "%f %f %f %f %f %f %f %f", vertices[i * 8 + 0], vertices[i * 8 + 1], vertices[i * 8 + 2], vertices[i * 8 + 3], vertices[i * 8 + 4], vertices[i * 8 + 5], vertices[i * 8 + 6], vertices[i * 8 + 7]);
-		}
-		vertexBuffers[j]->unlock();
-		
-		Texture* image = images[j];
-		
-		Graphics4::setTexture(tex, image);
-		Graphics4::setVertexBuffer(*vertexBuffers[j]);
-		Graphics4::setIndexBuffer(*indexBuffers[j]);
-		Graphics4::drawIndexedVertices();
+	skin(pose.finalTransform, scale);
+	render(tex);
+}
+
+void Avatar::updateBones() {
+	invKin->initializeBones();
+}
+
+void Avatar::skin(const mat4* finalTransform, float scale) {
+	if (skinning == nullptr) {
+		skinning = new Skinning(meshes);
+		skinnedVertices.resize(meshesCount);
 	}
+	
+	// Mesh Vertex Buffer
+	for (int j = 0; j < meshesCount; ++j) skinnedVertices[j] = vertexBuffers[j]->lock();
+	skinning->skin(finalTransform, scale, skinnedVertices.data());
+	for (int j = 0; j < meshesCount; ++j) vertexBuffers[j]->unlock();
 }
 
-void Avatar::setDesiredPositionAndOrientation(int boneIndex, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation) {
+void Avatar::setDesiredPositionAndOrientation(int boneIndex, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole) {
 	BoneNode* bone = getBoneWithIndex(boneIndex);
 	
-	invKin->inverseKinematics(bone, ikMode, desPosition, desRotation);
+	invKin->inverseKinematics(bone, ikMode, desPosition, desRotation, pole);
+}
+
+void Avatar::setDesiredPositionsAndOrientations(const int* boneIndices, IKMode ikMode, const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, const float* weights, int count) {
+	BoneNode* targetBones[WholeBodyJacobian::maxEndEffectors];
+	for (int i = 0; i < count; ++i) targetBones[i] = getBoneWithIndex(boneIndices[i]);
+	
+	invKin->inverseKinematics(targetBones, ikMode, desPositions, desRotations, weights, count);
 }
 
 void Avatar::setFixedPositionAndOrientation(int boneIndex, Kore::vec3 desPosition, Kore::Quaternion desRotation) {
@@ -89,7 +74,10 @@ void Avatar::setFixedPositionAndOrientation(int boneIndex, Kore::vec3 desPositio
 	bone->transform = mat4::Translation(desPosition.x(), desPosition.y(), desPosition.z());
 	bone->rotation = desRotation;
 	bone->rotation.normalize();
-	bone->local = bone->transform * bone->rotation.matrix().Transpose();
+	SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
+	
+	// The IK only updates the chains it changes, so propagate the new transformation to the descendants here
+	invKin->updateSubtree(bone);
 }
 
 void Avatar::setFixedOrientation(int boneIndex, Kore::Quaternion desRotation) {
@@ -103,7 +91,9 @@ void Avatar::setFixedOrientation(int boneIndex, Kore::Quaternion desRotation) {
 	//bone->rotation = desRotation;
 	
 	bone->rotation.normalize();
-	bone->local = bone->transform * bone->rotation.matrix().Transpose();
+	SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
+	
+	invKin->updateSubtree(bone);
 }
 
 BoneNode* Avatar::getBoneWithIndex(int boneIndex) const {
@@ -112,14 +102,23 @@ BoneNode* Avatar::getBoneWithIndex(int boneIndex) const {
 }
 
 void Avatar::resetPositionAndRotation() {
-	for (int i = 0; i < bones.size(); ++i) {
-		bones[i]->transform = bones[i]->bind;
-		bones[i]->local = bones[i]->bind;
-		bones[i]->combined = bones[i]->parent->combined * bones[i]->local;
-		bones[i]->combinedInv = bones[i]->combined.Invert();
-		bones[i]->finalTransform = bones[i]->combined * bones[i]->combinedInv;
-		bones[i]->rotation = Kore::Quaternion(0, 0, 0, 1);
+	// Single sweep over the packed pose, parents are always reset before their children
+	for (int i = 0; i < pose.boneCount; ++i) {
+		int parent = pose.parent[i];
+		pose.transform[i] = pose.bind[i];
+		pose.local[i] = pose.bind[i];
+		pose.combined[i] = parent >= 0 ? pose.combined[parent] * pose.local[i] : pose.local[i];
+		pose.combinedInv[i] = pose.combined[i].Invert();
+		pose.finalTransform[i] = pose.combined[i] * pose.combinedInv[i];
+		pose.rotation[i] = Kore::Quaternion(0, 0, 0, 1);
 	}
+	
+	// The previous solutions do not belong to the reset skeleton
+	invKin->resetWarmStart();
+}
+
+void Avatar::setWarmStart(bool warmStart) {
+	invKin->warmStart = warmStart;
 }
 
 void Avatar::resetVariables() {
@@ -154,6 +153,10 @@ float* Avatar::getTimeIteration() const {
 	return invKin->getTimeIteration();
 }
 
+float Avatar::getMeanIterations() const {
+	return invKin->getMeanIterations();
+}
+
 float Avatar::getHeight() const {
 	return currentHeight;
 }
@@ -2,6 +2,7 @@
 
 #include "MeshObject.h"
 #include "InverseKinematics.h"
+#include "Skinning.h"
 
 class Avatar : public MeshObject {
 	
@@ -9,17 +10,30 @@ private:
 	InverseKinematics* invKin;
 	float currentHeight;
 	
+	Skinning* skinning;		// Created by the first skin()
+	std::vector<float*> skinnedVertices;
+	
+	void initSkeleton();
+	
 public:
 	Avatar(const char* meshFile, const char* textureFile, const Kore::Graphics4::VertexStructure& structure, float scale = 1.0f);
+	Avatar(const char* meshFile, float scale = 1.0f); // Headless: skeleton and IK only, animate() must not be called
+	~Avatar();
 	
-	void animate(Kore::Graphics4::TextureUnit tex);
-	void setDesiredPositionAndOrientation(int boneIndex, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation);
+	void animate(Kore::Graphics4::TextureUnit tex); // updateBones(), skin() with the current pose and render()
+	void updateBones(); // Skinning matrices of the current pose
+	// Skins the vertex buffers once per pose, render() then draws them as often as needed. The skinning matrices have the
+	// layout of SkeletonPose::finalTransform, e.g. a copy of a pose solved on another thread.
+	void skin(const Kore::mat4* finalTransform, float scale);
+	void setDesiredPositionAndOrientation(int boneIndex, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole = nullptr);
+	void setDesiredPositionsAndOrientations(const int* boneIndices, IKMode ikMode, const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, const float* weights, int count);
 	void setFixedPositionAndOrientation(int boneIndex, Kore::vec3 desPosition, Kore::Quaternion desRotation);
 	void setFixedOrientation(int boneIndex, Kore::Quaternion desRotation);
 	
 	BoneNode* getBoneWithIndex(int index) const;
 	
 	void resetPositionAndRotation();
+	void setWarmStart(bool warmStart); // See Settings.h warmStartIK
 	
 	void resetVariables();
 	float getReached() const;
@@ -29,6 +43,7 @@ public:
 	float* getErrorRot() const;
 	float* getTime() const;
 	float* getTimeIteration() const;
+	float getMeanIterations() const;
 	
 	float getHeight() const;
 };
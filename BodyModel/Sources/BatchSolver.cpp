@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "BatchSolver.h"
+
+#include <algorithm> // std::copy
+
+// IK parameters are per thread so that independent skeletons can be solved in parallel
+extern thread_local int ikMode;
+extern thread_local float lambda[];
+extern thread_local float errorMaxPos[];
+extern thread_local float errorMaxRot[];
+extern thread_local float maxIterations[];
+
+BatchSolver::BatchSolver(int threadCount) : nextAvatar(0) {
+	if (threadCount <= 0) threadCount = Kore::max((int)std::thread::hardware_concurrency(), 1);
+	for (int t = 1; t < threadCount; ++t) workers.push_back(std::thread(&BatchSolver::workerLoop, this));
+}
+
+BatchSolver::~BatchSolver() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	startCondition.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+int BatchSolver::addAvatar(Avatar* avatar, BodyTracker* bodyTracker) {
+	int count = (int)lanes.size();
+	
+	// Widen every end-effector row by one lane
+	std::vector<Kore::vec3> positions(numOfEndEffectors * (count + 1));
+	std::vector<Kore::Quaternion> rotations(numOfEndEffectors * (count + 1));
+	std::vector<char> targets(numOfEndEffectors * (count + 1), 0);
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		for (int a = 0; a < count; ++a) {
+			positions[i * (count + 1) + a] = desPositions[i * count + a];
+			rotations[i * (count + 1) + a] = desRotations[i * count + a];
+			targets[i * (count + 1) + a] = hasTarget[i * count + a];
+		}
+	}
+	desPositions.swap(positions);
+	desRotations.swap(rotations);
+	hasTarget.swap(targets);
+	scales.push_back(1.0f);
+	
+	Lane lane = { avatar, bodyTracker };
+	lanes.push_back(lane);
+	return count;
+}
+
+int BatchSolver::getAvatarCount() const {
+	return (int)lanes.size();
+}
+
+void BatchSolver::setTarget(int avatar, int endEffectorID, Kore::vec3 desPosition, Kore::Quaternion desRotation) {
+	int index = endEffectorID * (int)lanes.size() + avatar;
+	desPositions[index] = desPosition;
+	desRotations[index] = desRotation;
+	hasTarget[index] = 1;
+}
+
+void BatchSolver::setScale(int avatar, float scale) {
+	scales[avatar] = scale;
+}
+
+void BatchSolver::solve() {
+	parameters.ikMode = ikMode;
+	std::copy(lambda, lambda + 7, parameters.lambda);
+	std::copy(errorMaxPos, errorMaxPos + 7, parameters.errorMaxPos);
+	std::copy(errorMaxRot, errorMaxRot + 7, parameters.errorMaxRot);
+	std::copy(maxIterations, maxIterations + 7, parameters.maxIterations);
+	
+	// About four chunks per thread: small enough to even out the avatars that need more iterations, large enough that
+	// the threads rarely meet at the counter
+	int threadCount = (int)workers.size() + 1;
+	chunkSize = Kore::max(1, (int)lanes.size() / (4 * threadCount));
+	nextAvatar = 0;
+	
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++generation;
+		busyWorkers = (int)workers.size();
+	}
+	startCondition.notify_all();
+	
+	work();
+	
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this]() { return busyWorkers == 0; });
+}
+
+const SkeletonPose& BatchSolver::getPose(int avatar) const {
+	return lanes[avatar].avatar->pose;
+}
+
+Avatar* BatchSolver::getAvatar(int avatar) const {
+	return lanes[avatar].avatar;
+}
+
+void BatchSolver::workerLoop() {
+	int solved = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock, [&]() { return quit || generation != solved; });
+			if (quit) return;
+			solved = generation;
+		}
+		
+		work();
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) doneCondition.notify_one();
+	}
+}
+
+void BatchSolver::work() {
+	ikMode = parameters.ikMode;
+	std::copy(parameters.lambda, parameters.lambda + 7, lambda);
+	std::copy(parameters.errorMaxPos, parameters.errorMaxPos + 7, errorMaxPos);
+	std::copy(parameters.errorMaxRot, parameters.errorMaxRot + 7, errorMaxRot);
+	std::copy(parameters.maxIterations, parameters.maxIterations + 7, maxIterations);
+	
+	int count = (int)lanes.size();
+	for (int begin = nextAvatar.fetch_add(chunkSize); begin < count; begin = nextAvatar.fetch_add(chunkSize)) {
+		int end = Kore::min(begin + chunkSize, count);
+		for (int avatar = begin; avatar < end; ++avatar) solveAvatar(avatar);
+	}
+}
+
+void BatchSolver::solveAvatar(int avatar) {
+	int count = (int)lanes.size();
+	Lane& lane = lanes[avatar];
+	BodyTracker* bodyTracker = lane.bodyTracker;
+	
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		int index = i * count + avatar;
+		if (!hasTarget[index]) continue;
+		bodyTracker->endEffector[i]->setDesPosition(desPositions[index]);
+		bodyTracker->endEffector[i]->setDesRotation(desRotations[index]);
+	}
+	
+	// Same calibration as the replay of a single take
+	if (!bodyTracker->calibratedAvatar) {
+		lane.avatar->resetPositionAndRotation();
+		lane.avatar->setScale(scales[avatar]);
+		bodyTracker->calibrate();
+		bodyTracker->calibratedAvatar = true;
+	}
+	
+	for (int i = 0; i < numOfEndEffectors; ++i) bodyTracker->executeMovement(i);
+	bodyTracker->finishMovement();
+}
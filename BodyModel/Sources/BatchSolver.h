@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Avatar.h"
+#include "BodyTracker.h"
+
+#include <Kore/Math/Quaternion.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Solves the IK of many avatars per frame on a pool of threads, for recordings of many users and scenes with several
+// tracked people. Every avatar keeps its own Avatar and BodyTracker (skeleton, calibration, warm start), the solver
+// holds the targets of all avatars and hands out the avatars to the threads in chunks.
+//
+// The targets are stored per end-effector over all avatars (lanes = avatars), so one tracker stream of a frame is
+// written for all avatars in one contiguous run. The IK parameters (ikMode, lambda, ...) of the thread calling solve()
+// are used by all threads.
+class BatchSolver {
+	
+public:
+	BatchSolver(int threadCount = 0); // 0: one thread per core, the thread calling solve() is one of them
+	~BatchSolver();
+	
+	// Adds an avatar, returns its index. The solver does not own the avatar and the body tracker. Not during solve().
+	int addAvatar(Avatar* avatar, BodyTracker* bodyTracker);
+	int getAvatarCount() const;
+	
+	// Desired position/rotation of an end-effector in the tracker coordinate system, like EndEffector::setDesPosition
+	void setTarget(int avatar, int endEffectorID, Kore::vec3 desPosition, Kore::Quaternion desRotation);
+	// Scale of the recorded user, applied when the avatar is calibrated on its next solve
+	void setScale(int avatar, float scale);
+	
+	// Solves the current targets of all avatars, returns when all are done. Avatars that are not calibrated yet
+	// (BodyTracker::calibratedAvatar) are reset, scaled and calibrated first.
+	void solve();
+	
+	// Solved skeleton of an avatar, valid until the next solve()
+	const SkeletonPose& getPose(int avatar) const;
+	Avatar* getAvatar(int avatar) const;
+	
+private:
+	static const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
+	
+	struct Lane {
+		Avatar* avatar;
+		BodyTracker* bodyTracker;
+	};
+	std::vector<Lane> lanes;
+	
+	// [endEffectorID * avatars + avatar]
+	std::vector<Kore::vec3> desPositions;
+	std::vector<Kore::Quaternion> desRotations;
+	std::vector<char> hasTarget;
+	std::vector<float> scales;
+	
+	// IK parameters of the thread that called solve()
+	struct Parameters {
+		int ikMode;
+		float lambda[7];
+		float errorMaxPos[7];
+		float errorMaxRot[7];
+		float maxIterations[7];
+	};
+	Parameters parameters;
+	
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	int generation = 0;		// Incremented by every solve()
+	int busyWorkers = 0;
+	bool quit = false;
+	
+	std::atomic<int> nextAvatar;
+	int chunkSize = 1;
+	
+	void workerLoop();
+	void work();
+	void solveAvatar(int avatar);
+};
@@ -0,0 +1,202 @@
+#include "pch.h"
+#include "BodyTracker.h"
+
+using namespace Kore;
+
+BodyTracker::BodyTracker(Avatar* avatar, Logger* logger, IKMode ikMode) : logRawData(::logRawData), wholeBodyIK(::wholeBodyIK), avatar(avatar), logger(logger) {
+	endEffector = new EndEffector*[numOfEndEffectors];
+	endEffector[head] = new EndEffector(headBoneIndex, ikMode);
+	endEffector[hip] = new EndEffector(hipBoneIndex, ikMode);
+	endEffector[leftHand] = new EndEffector(leftHandBoneIndex, ikMode);
+	endEffector[leftForeArm] = new EndEffector(leftForeArmBoneIndex, ikMode);
+	endEffector[rightHand] = new EndEffector(rightHandBoneIndex, ikMode);
+	endEffector[rightForeArm] = new EndEffector(rightForeArmBoneIndex, ikMode);
+	endEffector[leftFoot] = new EndEffector(leftFootBoneIndex, ikMode);
+	endEffector[rightFoot] = new EndEffector(rightFootBoneIndex, ikMode);
+	endEffector[leftKnee] = new EndEffector(leftLegBoneIndex, ikMode);
+	endEffector[rightKnee] = new EndEffector(rightLegBoneIndex, ikMode);
+	initTransAndRot();
+}
+
+BodyTracker::~BodyTracker() {
+	for (int i = 0; i < numOfEndEffectors; ++i) delete endEffector[i];
+	delete[] endEffector;
+}
+
+void BodyTracker::initTransAndRot() {
+	initRot = Kore::Quaternion(0, 0, 0, 1);
+	initRot.rotate(Kore::Quaternion(vec3(1, 0, 0), -Kore::pi / 2.0));
+	initRot.rotate(Kore::Quaternion(vec3(0, 0, 1), Kore::pi / 2.0));
+	initRot.normalize();
+	initRotInv = initRot.invert();
+	
+	// Move character in the middle of both feet
+	Kore::vec3 initPos = Kore::vec3(0, 0, 0);
+	Kore::vec3 posLeftFoot = endEffector[leftFoot]->getDesPosition();
+	Kore::vec3 posRightFoot = endEffector[rightFoot]->getDesPosition();
+	//initPos = (posRightFoot + posLeftFoot) / 2.0f;
+	initPos.y() = 0.0f;
+	
+	initTrans = mat4::Translation(initPos.x(), initPos.y(), initPos.z()) * initRot.matrix().Transpose();
+	initTransInv = initTrans.Invert();
+}
+
+void BodyTracker::calibrate() {
+	initTransAndRot();
+	
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		Kore::vec3 desPosition = endEffector[i]->getDesPosition();
+		Kore::Quaternion desRotation = endEffector[i]->getDesRotation();
+		
+		// Transform desired position/rotation to the character local coordinate system
+		desPosition = initTransInv * vec4(desPosition.x(), desPosition.y(), desPosition.z(), 1);
+		desRotation = initRotInv.rotated(desRotation);
+		
+		// Get actual position/rotation of the character skeleton
+		BoneNode* bone = avatar->getBoneWithIndex(endEffector[i]->getBoneIndex());
+		vec3 targetPos = bone->getPosition();
+		Kore::Quaternion targetRot = bone->getOrientation();
+		
+		endEffector[i]->setOffsetPosition((mat4::Translation(desPosition.x(), desPosition.y(), desPosition.z()) * targetRot.matrix().Transpose()).Invert() * mat4::Translation(targetPos.x(), targetPos.y(), targetPos.z()) * vec4(0, 0, 0, 1));
+		endEffector[i]->setOffsetRotation((desRotation.invert()).rotated(targetRot));
+	}
+}
+
+void BodyTracker::executeMovement(int endEffectorID) {
+	Kore::vec3 desPosition = endEffector[endEffectorID]->getDesPosition();
+	Kore::Quaternion desRotation = endEffector[endEffectorID]->getDesRotation();
+	double desTime = endEffector[endEffectorID]->getDesTime();
+	sampleTime = Kore::max(sampleTime, desTime);
+	
+	// Save raw data
+	if (logRawData) logger->saveData(endEffector[endEffectorID]->getName(), desTime, desPosition, desRotation, avatar->scale);
+	
+	if (calibratedAvatar) {
+		vec3 finalPos;
+		Kore::Quaternion finalRot;
+		calcFinalPositionAndRotation(endEffectorID, finalPos, finalRot);
+		
+		endEffector[endEffectorID]->setFinalPosition(finalPos);
+		endEffector[endEffectorID]->setFinalRotation(finalRot);
+		
+		if (endEffectorID == hip) {
+			avatar->setFixedPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), finalPos, finalRot);
+		} else if (wholeBodyIK) {
+			moved[endEffectorID] = true;
+			return;
+		} else if (endEffectorID == head) {
+			avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
+		} else if (endEffectorID == leftForeArm || endEffectorID == rightForeArm) {
+			if (!simpleIK)
+				avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
+		} else if (endEffectorID == leftFoot || endEffectorID == rightFoot) {
+			vec3 pole;
+			bool hasPole = getPole(endEffectorID == leftFoot ? leftKnee : rightKnee, pole);
+			avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot, hasPole ? &pole : nullptr);
+		} else if (endEffectorID == leftHand || endEffectorID == rightHand) {
+			if (simpleIK) {
+				vec3 pole;
+				bool hasPole = getPole(endEffectorID == leftHand ? leftForeArm : rightForeArm, pole);
+				avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot, hasPole ? &pole : nullptr);
+			} else {
+				avatar->setFixedOrientation(endEffector[endEffectorID]->getBoneIndex(), finalRot);
+			}
+		}
+		
+		// Evaluate IK precision
+		if (eval) endEffector[endEffectorID]->getError(avatar->getBoneWithIndex(endEffector[endEffectorID]->getBoneIndex()));
+		
+	}
+}
+
+void BodyTracker::calcFinalPositionAndRotation(int endEffectorID, Kore::vec3& finalPos, Kore::Quaternion& finalRot) const {
+	Kore::vec3 desPosition = endEffector[endEffectorID]->getDesPosition();
+	Kore::Quaternion desRotation = endEffector[endEffectorID]->getDesRotation();
+	
+	// Transform desired position/rotation to the character local coordinate system
+	desPosition = initTransInv * vec4(desPosition.x(), desPosition.y(), desPosition.z(), 1);
+	desRotation = initRotInv.rotated(desRotation);
+	
+	// Add offset
+	Kore::Quaternion offsetRotation = endEffector[endEffectorID]->getOffsetRotation();
+	vec3 offsetPosition = endEffector[endEffectorID]->getOffsetPosition();
+	finalRot = desRotation.rotated(offsetRotation);
+	finalPos = mat4::Translation(desPosition.x(), desPosition.y(), desPosition.z()) * finalRot.matrix().Transpose() * mat4::Translation(offsetPosition.x(), offsetPosition.y(), offsetPosition.z()) * vec4(0, 0, 0, 1);
+}
+
+bool BodyTracker::getPole(int endEffectorID, Kore::vec3& pole) const {
+	// Only the analytic IK uses a pole, a tracker that never sent data stays at the origin
+	if (endEffector[endEffectorID]->getIKMode() != ANALYTIC) return false;
+	if (endEffector[endEffectorID]->getDesPosition().getLength() < nearNull) return false;
+	
+	Kore::Quaternion rot;
+	calcFinalPositionAndRotation(endEffectorID, pole, rot);
+	return true;
+}
+
+void BodyTracker::finishMovement() {
+	if (!wholeBodyIK || !calibratedAvatar) return;
+	
+	int boneIndices[numOfEndEffectors];
+	Kore::vec3 desPositions[numOfEndEffectors];
+	Kore::Quaternion desRotations[numOfEndEffectors];
+	float weights[numOfEndEffectors];
+	int count = 0;
+	IKMode ikMode = endEffector[head]->getIKMode();
+	
+	// Same end-effectors as in executeMovement, the hands without simple IK only get their orientation after the solve
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		if (!moved[i] || wholeBodyWeights[i] <= 0.0f) continue;
+		if ((i == leftHand || i == rightHand) && !simpleIK) continue;
+		if ((i == leftForeArm || i == rightForeArm) && simpleIK) continue;
+		
+		boneIndices[count] = endEffector[i]->getBoneIndex();
+		desPositions[count] = endEffector[i]->getFinalPosition();
+		desRotations[count] = endEffector[i]->getFinalRotation();
+		weights[count] = wholeBodyWeights[i];
+		++count;
+	}
+	if (count > 0) avatar->setDesiredPositionsAndOrientations(boneIndices, ikMode, desPositions, desRotations, weights, count);
+	
+	if (!simpleIK) {
+		if (moved[leftHand]) avatar->setFixedOrientation(endEffector[leftHand]->getBoneIndex(), endEffector[leftHand]->getFinalRotation());
+		if (moved[rightHand]) avatar->setFixedOrientation(endEffector[rightHand]->getBoneIndex(), endEffector[rightHand]->getFinalRotation());
+	}
+	
+	// Evaluate IK precision
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		if (eval && moved[i]) endEffector[i]->getError(avatar->getBoneWithIndex(endEffector[i]->getBoneIndex()));
+		moved[i] = false;
+	}
+}
+
+void BodyTracker::setIKMode(IKMode mode) {
+	for (int i = 0; i < numOfEndEffectors; ++i) endEffector[i]->setIKMode(mode);
+}
+
+void BodyTracker::resetEvalVariables() {
+	for (int i = 0; i < numOfEndEffectors; ++i) endEffector[i]->resetEvalVariables();
+}
+
+void BodyTracker::getOverallError(float& meanPos, float& stdPos, float& meanRot, float& stdRot) const {
+	float* error[numOfEndEffectors];
+	meanPos = 0.0f;
+	meanRot = 0.0f;
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		error[i] = endEffector[i]->getAvdStdPosRot();
+		meanPos += error[i][0];
+		meanRot += error[i][2];
+	}
+	meanPos /= numOfEndEffectors;
+	meanRot /= numOfEndEffectors;
+	
+	stdPos = 0.0f;
+	stdRot = 0.0f;
+	for (int i = 0; i < numOfEndEffectors; ++i) {
+		stdPos += Kore::pow(error[i][0] - meanPos, 2);
+		stdRot += Kore::pow(error[i][3] - meanRot, 2);
+		delete[] error[i];
+	}
+	stdPos = Kore::sqrt(stdPos / numOfEndEffectors);
+	stdRot = Kore::sqrt(stdRot / numOfEndEffectors);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Avatar.h"
+#include "EndEffector.h"
+#include "Logger.h"
+
+#include <Kore/Math/Quaternion.h>
+
+// Drives the avatar from the end-effectors: calibration, raw-data logging and the IK call for every end-effector.
+// Used by the VR/replay app in Main.cpp and by the headless replay tool.
+class BodyTracker {
+	
+public:
+	BodyTracker(Avatar* avatar, Logger* logger, IKMode ikMode);
+	~BodyTracker();
+	
+	static const int numOfEndEffectors = 10;
+	EndEffector** endEffector;
+	
+	// Transformation from the world into the character local coordinate system
+	Kore::mat4 initTrans;
+	Kore::mat4 initTransInv;
+	Kore::Quaternion initRot;
+	Kore::Quaternion initRotInv;
+	
+	bool calibratedAvatar = false;
+	double sampleTime = 0.0;	// Newest EndEffector::getDesTime() that went into the solved pose [s, System::time()]
+	bool logRawData;
+	bool wholeBodyIK;	// Collect the end-effectors in executeMovement and solve them together in finishMovement
+	
+	void initTransAndRot();
+	void calibrate();
+	void executeMovement(int endEffectorID);
+	void finishMovement(); // Call once per frame after executeMovement for all end-effectors
+	
+	void setIKMode(IKMode mode);
+	void resetEvalVariables();
+	// Mean and standard deviation of the position [mm] and rotation [deg] error over all end-effectors
+	void getOverallError(float& meanPos, float& stdPos, float& meanRot, float& stdRot) const;
+	
+private:
+	Avatar* avatar;
+	Logger* logger;
+	
+	bool moved[numOfEndEffectors] = {};
+	
+	// Desired position/rotation of an end-effector in the character local coordinate system, including the calibration offset
+	void calcFinalPositionAndRotation(int endEffectorID, Kore::vec3& finalPos, Kore::Quaternion& finalRot) const;
+	// Position of the forearm/knee tracker that bends the elbow/knee in the analytic IK, false if there is none
+	bool getPole(int endEffectorID, Kore::vec3& pole) const;
+};
@@ -21,7 +21,7 @@
 
 #include "MatrixRmn.h"
 
-MatrixRmn MatrixRmn::WorkMatrix;        // Temporary work matrix
+thread_local MatrixRmn MatrixRmn::WorkMatrix;        // Temporary work matrix
 
 // Fill the diagonal entries with the value d.  The rest of the matrix is unchanged.
 void MatrixRmn::SetDiagonalEntries( double d )
@@ -137,7 +137,7 @@ private:
     double *x;                    // Array of vector entries - stored in column order
     long AllocSize;                // Allocated size of the x array
     
-    static MatrixRmn WorkMatrix;    // Temporary work matrix
+    static thread_local MatrixRmn WorkMatrix;    // Temporary work matrix (per thread, the IK runs on several threads)
     static MatrixRmn& GetWorkMatrix() { return WorkMatrix; }
     static MatrixRmn& GetWorkMatrix(long numRows, long numCols) { WorkMatrix.SetSize( numRows, numCols ); return WorkMatrix; }
     
@@ -21,7 +21,7 @@
 
 #include "VectorRn.h"
 
-VectorRn VectorRn::WorkVector;
+thread_local VectorRn VectorRn::WorkVector;
 
 double VectorRn::MaxAbs () const
 {
@@ -74,7 +74,7 @@ private:
     long AllocLength;            // Allocated length
     double *x;                    // Array of vector entries
     
-    static VectorRn WorkVector;                                // Serves as a temporary vector
+    static thread_local VectorRn WorkVector;                    // Serves as a temporary vector (per thread)
     static VectorRn& GetWorkVector() { return WorkVector; }
     static VectorRn& GetWorkVector( long len ) { WorkVector.SetLength(len); return WorkVector; }
 };
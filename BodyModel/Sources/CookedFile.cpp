@@ -0,0 +1,425 @@
+#include "pch.h"
+#include "CookedFile.h"
+#include "MeshObject.h"
+
+#include <Kore/Log.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace Kore;
+
+namespace {
+	
+	const char magic[4] = { 'B', 'T', 'C', 'K' };
+	const size_t alignment = 16;
+	
+	// All offsets count bytes from the start of the file, offset 0 is no data. Matrices are stored row by row.
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t size;			// Of the whole file
+		uint64_t checksum;		// Of everything after the header
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint32_t meshCount;
+		uint32_t geometryCount;
+		uint32_t materialCount;
+		uint32_t boneCount;
+		uint32_t lightCount;
+		uint32_t padding;
+		uint64_t meshes;
+		uint64_t geometries;
+		uint64_t materials;
+		uint64_t bones;
+		uint64_t lights;
+	};
+	
+	struct MeshRecord {
+		int32_t numFaces;
+		int32_t numVertices;
+		int32_t numUVs;
+		int32_t numNormals;
+		int32_t boneCount;
+		int32_t boneIndexCount;
+		int32_t weightCount;
+		uint32_t meshIndex;
+		float maxWeightError;
+		uint32_t padding;
+		uint64_t vertices;
+		uint64_t indices;
+		uint64_t normals;
+		uint64_t texcoord;
+		uint64_t boneCountArray;
+		uint64_t boneIndices;
+		uint64_t boneWeight;
+		uint64_t influenceBones;
+		uint64_t influenceWeights;
+	};
+	
+	struct GeometryRecord {
+		float transform[16];
+		uint32_t materialIndex;
+		uint32_t geometryIndex;
+		uint64_t name;
+		uint64_t objectRef;
+		uint64_t materialRef;
+	};
+	
+	struct MaterialRecord {
+		uint64_t materialName;
+		uint64_t textureName;
+		uint32_t materialIndex;
+		int32_t texScaleX;
+		int32_t texScaleY;
+		float diffuse[3];
+		float specular[3];
+		float specularPower;
+	};
+	
+	struct BoneRecord {
+		uint64_t boneName;
+		int32_t nodeIndex;
+		int32_t nodeDepth;
+		int32_t parent;			// Index of the parent bone, -1 for the root
+		uint32_t animationCount;
+		float bind[16];
+		uint64_t animation;		// animationCount matrices
+	};
+	
+	struct LightRecord {
+		float position[4];
+		int32_t type;
+		uint32_t padding;
+		uint64_t name;
+	};
+	
+	// FNV-1a over 64 bit words, size is a multiple of 8
+	uint64_t checksum(const char* data, size_t size) {
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		return hash;
+	}
+	
+	void getRows(const mat4& matrix, float* rows) {
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				rows[i * 4 + j] = matrix.get(i, j);
+			}
+		}
+	}
+	
+	mat4 getMatrix(const float* rows) {
+		mat4 matrix = mat4::Identity();
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				matrix.Set(i, j, rows[i * 4 + j]);
+			}
+		}
+		return matrix;
+	}
+	
+	class Writer {
+	
+	public:
+		std::vector<char> data;
+		
+		Writer() : data(sizeof(Header)) {}
+		
+		template<class T> uint64_t append(const T* source, size_t count) {
+			if (source == nullptr || count == 0) return 0;
+			align();
+			uint64_t offset = data.size();
+			const char* bytes = reinterpret_cast<const char*>(source);
+			data.insert(data.end(), bytes, bytes + count * sizeof(T));
+			return offset;
+		}
+		
+		uint64_t append(const char* string) {
+			if (string == nullptr) return 0;
+			return append(string, std::strlen(string) + 1);
+		}
+		
+		void align() {
+			data.resize((data.size() + alignment - 1) / alignment * alignment);
+		}
+	};
+	
+	// Points into the mapped file, nullptr for offset 0 and for arrays that do not fit into the file
+	class Reader {
+	
+	public:
+		char* data;
+		size_t size;
+		
+		template<class T> T* at(uint64_t offset, size_t count) const {
+			if (offset == 0 || offset > size || count > (size - offset) / sizeof(T)) return nullptr;
+			return reinterpret_cast<T*>(data + offset);
+		}
+		
+		char* string(uint64_t offset) const {
+			if (offset == 0 || offset >= size || std::memchr(data + offset, 0, size - offset) == nullptr) return nullptr;
+			return data + offset;
+		}
+	};
+	
+}
+
+CookedFile* CookedFile::load(const char* sourceFile, MeshObject& object) {
+	std::string filename = getFileName(sourceFile);
+	CookedFile* file = new CookedFile();
+	// Copy-on-write, nothing writes through the non-const name pointers of the structs
+	if (!file->mapping.map(filename.c_str())) {
+		delete file;
+		return nullptr;
+	}
+	
+	const char* problem = nullptr;
+	const Header* header = reinterpret_cast<const Header*>(file->mapping.data());
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (file->mapping.size() < sizeof(Header) || std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+		problem = "in an old format";
+	} else if (header->size != file->mapping.size() || checksum(file->mapping.data() + sizeof(Header), file->mapping.size() - sizeof(Header)) != header->checksum) {
+		problem = "damaged";
+	} else if (MappedFile::getFileInfo(sourceFile, sourceSize, sourceTime) && (sourceSize != header->sourceSize || sourceTime != header->sourceTime)) {
+		// Only a cache without its source is used as it is
+		problem = "out of date";
+	}
+	
+	Reader reader = { file->mapping.data(), file->mapping.size() };
+	const MeshRecord* meshRecords = nullptr;
+	const GeometryRecord* geometryRecords = nullptr;
+	const MaterialRecord* materialRecords = nullptr;
+	const BoneRecord* boneRecords = nullptr;
+	const LightRecord* lightRecords = nullptr;
+	if (problem == nullptr) {
+		meshRecords = reader.at<MeshRecord>(header->meshes, header->meshCount);
+		geometryRecords = reader.at<GeometryRecord>(header->geometries, header->geometryCount);
+		materialRecords = reader.at<MaterialRecord>(header->materials, header->materialCount);
+		boneRecords = reader.at<BoneRecord>(header->bones, header->boneCount);
+		lightRecords = reader.at<LightRecord>(header->lights, header->lightCount);
+		if ((header->meshCount > 0 && meshRecords == nullptr) || (header->geometryCount > 0 && geometryRecords == nullptr) ||
+			(header->materialCount > 0 && materialRecords == nullptr) || (header->boneCount > 0 && boneRecords == nullptr) ||
+			(header->lightCount > 0 && lightRecords == nullptr)) problem = "damaged";
+	}
+	
+	if (problem != nullptr) {
+		log(Info, "Cooked file %s is %s, converting %s", filename.c_str(), problem, sourceFile);
+		delete file;
+		return nullptr;
+	}
+	
+	// The meshes point into the mapping
+	for (uint32_t i = 0; i < header->meshCount; ++i) {
+		const MeshRecord& record = meshRecords[i];
+		Mesh* mesh = new Mesh();
+		mesh->numFaces = record.numFaces;
+		mesh->numVertices = record.numVertices;
+		mesh->numUVs = record.numUVs;
+		mesh->numNormals = record.numNormals;
+		mesh->vertices = reader.at<float>(record.vertices, record.numVertices * 3);
+		mesh->indices = reader.at<int>(record.indices, record.numFaces * 3);
+		mesh->normals = reader.at<float>(record.normals, record.numNormals * 3);
+		mesh->texcoord = reader.at<float>(record.texcoord, record.numUVs * 2);
+		
+		mesh->boneCount = record.boneCount;
+		mesh->boneIndexCount = record.boneIndexCount;
+		mesh->weightCount = record.weightCount;
+		mesh->boneCountArray = reader.at<unsigned_int16>(record.boneCountArray, record.boneCount);
+		mesh->boneIndices = reader.at<unsigned_int16>(record.boneIndices, record.boneIndexCount);
+		mesh->boneWeight = reader.at<float>(record.boneWeight, record.weightCount);
+		mesh->influenceBones = reader.at<unsigned_int8>(record.influenceBones, record.numVertices * Mesh::maxInfluences);
+		mesh->influenceWeights = reader.at<unsigned_int16>(record.influenceWeights, record.numVertices * Mesh::maxInfluences);
+		mesh->maxWeightError = record.maxWeightError;
+		
+		mesh->meshIndex = record.meshIndex;
+		object.meshes.push_back(mesh);
+	}
+	
+	for (uint32_t i = 0; i < header->geometryCount; ++i) {
+		const GeometryRecord& record = geometryRecords[i];
+		Geometry* geometry = new Geometry();
+		geometry->transform = getMatrix(record.transform);
+		geometry->name = reader.string(record.name);
+		geometry->objectRef = reader.string(record.objectRef);
+		geometry->materialRef = reader.string(record.materialRef);
+		geometry->materialIndex = record.materialIndex;
+		geometry->geometryIndex = record.geometryIndex;
+		object.geometries.push_back(geometry);
+	}
+	
+	for (uint32_t i = 0; i < header->materialCount; ++i) {
+		const MaterialRecord& record = materialRecords[i];
+		Material* material = new Material();
+		material->materialName = reader.string(record.materialName);
+		material->textureName = reader.string(record.textureName);
+		material->materialIndex = record.materialIndex;
+		material->texScaleX = record.texScaleX;
+		material->texScaleY = record.texScaleY;
+		material->diffuse = vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+		material->specular = vec3(record.specular[0], record.specular[1], record.specular[2]);
+		material->specular_power = record.specularPower;
+		object.materials.push_back(material);
+	}
+	
+	// Parents are stored before their children
+	object.pose.allocate(header->boneCount);
+	BoneNode* root = new BoneNode(object.pose, header->boneCount); // Dummy parent of the root bone
+	for (uint32_t i = 0; i < header->boneCount; ++i) {
+		const BoneRecord& record = boneRecords[i];
+		BoneNode* bone = new BoneNode(object.pose, i);
+		bone->boneName = reader.string(record.boneName);
+		bone->nodeIndex = record.nodeIndex;
+		bone->nodeDepth = record.nodeDepth;
+		bone->bind = getMatrix(record.bind);
+		bone->transform = bone->bind;
+		bone->local = bone->transform;
+		
+		const float* animation = reader.at<float>(record.animation, record.animationCount * 16);
+		if (animation != nullptr) {
+			for (uint32_t k = 0; k < record.animationCount; ++k) bone->aniTransformations.push_back(getMatrix(&animation[k * 16]));
+		}
+		
+		int parent = record.parent >= 0 && record.parent < (int)i ? record.parent : -1;
+		bone->parent = parent >= 0 ? object.bones[parent] : root;
+		object.pose.parent[i] = parent;
+		object.bones.push_back(bone);
+	}
+	
+	for (uint32_t i = 0; i < header->lightCount; ++i) {
+		const LightRecord& record = lightRecords[i];
+		Light* light = new Light();
+		light->position = vec4(record.position[0], record.position[1], record.position[2], record.position[3]);
+		light->name = reader.string(record.name);
+		light->type = record.type;
+		object.lights.push_back(light);
+	}
+	
+	log(Info, "Loaded cooked file %s", filename.c_str());
+	return file;
+}
+
+bool CookedFile::save(const char* sourceFile, const MeshObject& object) {
+	Header header = {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	MappedFile::getFileInfo(sourceFile, header.sourceSize, header.sourceTime);
+	
+	Writer writer;
+	
+	std::vector<MeshRecord> meshRecords;
+	for (const Mesh* mesh : object.meshes) {
+		MeshRecord record = {};
+		record.numFaces = mesh->numFaces;
+		record.numVertices = mesh->numVertices;
+		record.numUVs = mesh->numUVs;
+		record.numNormals = mesh->numNormals;
+		record.vertices = writer.append(mesh->vertices, mesh->numVertices * 3);
+		record.indices = writer.append(mesh->indices, mesh->numFaces * 3);
+		record.normals = writer.append(mesh->normals, mesh->numNormals * 3);
+		record.texcoord = writer.append(mesh->texcoord, mesh->numUVs * 2);
+		
+		record.boneCount = mesh->boneCount;
+		record.boneIndexCount = mesh->boneIndexCount;
+		record.weightCount = mesh->weightCount;
+		record.boneCountArray = writer.append(mesh->boneCountArray, mesh->boneCount);
+		record.boneIndices = writer.append(mesh->boneIndices, mesh->boneIndexCount);
+		record.boneWeight = writer.append(mesh->boneWeight, mesh->weightCount);
+		record.influenceBones = writer.append(mesh->influenceBones, mesh->numVertices * Mesh::maxInfluences);
+		record.influenceWeights = writer.append(mesh->influenceWeights, mesh->numVertices * Mesh::maxInfluences);
+		record.maxWeightError = mesh->maxWeightError;
+		
+		record.meshIndex = mesh->meshIndex;
+		meshRecords.push_back(record);
+	}
+	
+	std::vector<GeometryRecord> geometryRecords;
+	for (const Geometry* geometry : object.geometries) {
+		GeometryRecord record = {};
+		getRows(geometry->transform, record.transform);
+		record.name = writer.append(geometry->name);
+		record.objectRef = writer.append(geometry->objectRef);
+		record.materialRef = writer.append(geometry->materialRef);
+		record.materialIndex = geometry->materialIndex;
+		record.geometryIndex = geometry->geometryIndex;
+		geometryRecords.push_back(record);
+	}
+	
+	std::vector<MaterialRecord> materialRecords;
+	for (const Material* material : object.materials) {
+		MaterialRecord record = {};
+		record.materialName = writer.append(material->materialName);
+		record.textureName = writer.append(material->textureName);
+		record.materialIndex = material->materialIndex;
+		record.texScaleX = material->texScaleX;
+		record.texScaleY = material->texScaleY;
+		for (int k = 0; k < 3; ++k) {
+			record.diffuse[k] = material->diffuse[k];
+			record.specular[k] = material->specular[k];
+		}
+		record.specularPower = material->specular_power;
+		materialRecords.push_back(record);
+	}
+	
+	std::vector<BoneRecord> boneRecords;
+	for (int i = 0; i < (int)object.bones.size(); ++i) {
+		const BoneNode* bone = object.bones[i];
+		BoneRecord record = {};
+		record.boneName = writer.append(bone->boneName);
+		record.nodeIndex = bone->nodeIndex;
+		record.nodeDepth = bone->nodeDepth;
+		record.parent = object.pose.parent[i];
+		getRows(bone->bind, record.bind);
+		
+		std::vector<float> animation(bone->aniTransformations.size() * 16);
+		for (int k = 0; k < (int)bone->aniTransformations.size(); ++k) getRows(bone->aniTransformations[k], &animation[k * 16]);
+		record.animationCount = (uint32_t)bone->aniTransformations.size();
+		record.animation = writer.append(animation.data(), animation.size());
+		boneRecords.push_back(record);
+	}
+	
+	std::vector<LightRecord> lightRecords;
+	for (const Light* light : object.lights) {
+		LightRecord record = {};
+		for (int k = 0; k < 4; ++k) record.position[k] = light->position[k];
+		record.type = light->type;
+		record.name = writer.append(light->name);
+		lightRecords.push_back(record);
+	}
+	
+	header.meshCount = (uint32_t)meshRecords.size();
+	header.meshes = writer.append(meshRecords.data(), meshRecords.size());
+	header.geometryCount = (uint32_t)geometryRecords.size();
+	header.geometries = writer.append(geometryRecords.data(), geometryRecords.size());
+	header.materialCount = (uint32_t)materialRecords.size();
+	header.materials = writer.append(materialRecords.data(), materialRecords.size());
+	header.boneCount = (uint32_t)boneRecords.size();
+	header.bones = writer.append(boneRecords.data(), boneRecords.size());
+	header.lightCount = (uint32_t)lightRecords.size();
+	header.lights = writer.append(lightRecords.data(), lightRecords.size());
+	
+	writer.align();
+	header.size = writer.data.size();
+	header.checksum = checksum(&writer.data[sizeof(Header)], writer.data.size() - sizeof(Header));
+	std::memcpy(&writer.data[0], &header, sizeof(Header));
+	
+	std::string filename = getFileName(sourceFile);
+	if (!MappedFile::replaceFile(filename.c_str(), writer.data.data(), writer.data.size())) {
+		log(Warning, "Could not write cooked file %s", filename.c_str());
+		return false;
+	}
+	
+	log(Info, "Wrote cooked file %s, %i KB", filename.c_str(), (int)(writer.data.size() / 1024));
+	return true;
+}
+
+std::string CookedFile::getFileName(const char* sourceFile) {
+	return std::string(sourceFile) + ".cooked";
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <string>
+
+class MeshObject;
+
+// Binary cache of a converted .ogex file, written next to it as <file>.ogex.cooked. The meshes are stored as the
+// arrays MeshObject uses, 16 byte aligned, so that loading maps the file into memory and points the meshes into the
+// mapping: no parsing and no copies of the vertex data. Bones, geometries, materials and lights are small and rebuilt
+// from fixed size records. The header holds a format version, the size and modification time of the source file and a
+// checksum of the data, a cache that does not match its source, an older format or a damaged file is rebuilt.
+class CookedFile {
+	
+public:
+	static const unsigned int version = 1;
+	
+	// Maps the cache of sourceFile and fills the empty object from it. nullptr if there is no valid cache, the returned
+	// file has to live as long as the meshes of object.
+	static CookedFile* load(const char* sourceFile, MeshObject& object);
+	
+	// Writes the cache of sourceFile from the object just converted from it
+	static bool save(const char* sourceFile, const MeshObject& object);
+	
+	// <sourceFile>.cooked
+	static std::string getFileName(const char* sourceFile);
+	
+private:
+	MappedFile mapping;
+	
+	CookedFile() {}
+};
@@ -1,23 +1,18 @@
 #include "pch.h"
 #include "EndEffector.h"
 
-#include <assert.h>
-
 #include <Kore/Log.h>
 
 #include <string>
 
-EndEffector::EndEffector(int boneIndex, IKMode ikMode) : desPosition(Kore::vec3(0, 0, 0)), desRotation(Kore::Quaternion(0, 0, 0, 1)), offsetPosition(Kore::vec3(0, 0, 0)), offsetRotation(Kore::Quaternion(0, 0, 0, 1)), finalPosition(Kore::vec3(0, 0, 0)), finalRotation(Kore::Quaternion(0, 0, 0, 1)),  boneIndex(boneIndex), deviceID(-1), ikMode(ikMode) {
+EndEffector::EndEffector(int boneIndex, IKMode ikMode) : desPosition(Kore::vec3(0, 0, 0)), desRotation(Kore::Quaternion(0, 0, 0, 1)), desTime(0.0), offsetPosition(Kore::vec3(0, 0, 0)), offsetRotation(Kore::Quaternion(0, 0, 0, 1)), finalPosition(Kore::vec3(0, 0, 0)), finalRotation(Kore::Quaternion(0, 0, 0, 1)),  boneIndex(boneIndex), deviceID(-1), ikMode(ikMode) {
 	name = getNameForIndex(boneIndex);
 	
-	evalErrorPos = new float[frames]();
-	evalErrorRot = new float[frames]();
+	evalErrorPos.reserve(frames);
+	evalErrorRot.reserve(frames);
 }
 
-EndEffector::~EndEffector() {
-	delete[] evalErrorPos;
-	delete[] evalErrorRot;
-}
+EndEffector::~EndEffector() {}
 
 Kore::vec3 EndEffector::getDesPosition() const {
 	return desPosition;
@@ -35,6 +30,14 @@ void EndEffector::setDesRotation(Kore::Quaternion rot) {
 	desRotation = rot;
 }
 
+double EndEffector::getDesTime() const {
+	return desTime;
+}
+
+void EndEffector::setDesTime(double time) {
+	desTime = time;
+}
+
 Kore::vec3 EndEffector::getOffsetPosition() const {
 	return offsetPosition;
 }
@@ -105,20 +108,20 @@ float EndEffector::calcMax(const float* vec) const {
 
 float* EndEffector::getAvdStdPosRot() const {
 	float *error = new float[4];
-	error[0] = calcAvg(evalErrorPos);
-	error[1] = calcStd(evalErrorPos);
-	error[2] = calcAvg(evalErrorRot);
-	error[3] = calcStd(evalErrorRot);
+	error[0] = calcAvg(evalErrorPos.data());
+	error[1] = calcStd(evalErrorPos.data());
+	error[2] = calcAvg(evalErrorRot.data());
+	error[3] = calcStd(evalErrorRot.data());
 	
 	return error;
 }
 
 float EndEffector::getErrorPos() {
-	return calcAvg(evalErrorPos);
+	return calcAvg(evalErrorPos.data());
 }
 
 float EndEffector::getErrorRot() {
-	return calcAvg(evalErrorRot);
+	return calcAvg(evalErrorRot.data());
 }
 
 float EndEffector::getRMSE() {
@@ -130,8 +133,8 @@ float EndEffector::getRMSE() {
 }
 
 void EndEffector::getErrorPosAndRot(float& pos, float& rot) {
-	pos = calcAvg(evalErrorPos);
-	rot = calcAvg(evalErrorRot);
+	pos = calcAvg(evalErrorPos.data());
+	rot = calcAvg(evalErrorRot.data());
 }
 
 int EndEffector::getDeviceIndex() const {
@@ -182,18 +185,14 @@ void EndEffector::getError(BoneNode* targetBone) {
 	//Kore::log(Kore::LogLevel::Info, "Error for %s is posError:%f, rotError:%f", getName(), posError, rotError);
 	
 	// Save
-	evalErrorPos[size] = posError;
-	evalErrorRot[size] = rotError;
+	evalErrorPos.push_back(posError);
+	evalErrorRot.push_back(rotError);
 	size++;
-	
-	assert(size < frames);
 }
 
 void EndEffector::resetEvalVariables() {
-	for (int i = 0; i < frames; i++) {
-		evalErrorPos[i] = 0;
-		evalErrorRot[i] = 0;
-	}
+	evalErrorPos.clear();
+	evalErrorRot.clear();
 	size = 0;
 }
 
@@ -6,6 +6,8 @@
 #include <Kore/Math/Vector.h>
 #include <Kore/Math/Quaternion.h>
 
+#include <vector>
+
 enum EndEffectorIndices {
 	head, hip, leftHand, leftForeArm, rightHand, rightForeArm, leftFoot, rightFoot, leftKnee, rightKnee, unknown
 };
@@ -50,6 +52,12 @@ const char* const rFootTag = "rFoot";
 const char* const lKneeTag = "lKnee";
 const char* const rKneeTag = "rKnee";
 
+// Tags indexed by EndEffectorIndices
+const char* const endEffectorTags[] = { headTag, hipTag, lHandTag, lForeArm, rHandTag, rForeArm, lFootTag, rFootTag, lKneeTag, rKneeTag };
+
+// Weights of the end-effectors in the whole-body IK (indexed by EndEffectorIndices), 0 leaves the end-effector out
+const float wholeBodyWeights[] = { 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f };
+
 class EndEffector {
 public:
 	EndEffector(int boneIndex, IKMode ikMode);
@@ -61,6 +69,10 @@ public:
 	Kore::Quaternion getDesRotation() const;
 	void setDesRotation(Kore::Quaternion rot);
 	
+	// When the tracker sampled the desired position and rotation [s, System::time()]
+	double getDesTime() const;
+	void setDesTime(double time);
+	
 	Kore::vec3 getOffsetPosition() const;
 	void setOffsetPosition(Kore::vec3 offsetPosition);
 	
@@ -94,6 +106,7 @@ public:
 private:
 	Kore::vec3 desPosition;
 	Kore::Quaternion desRotation;
+	double desTime;
 	
 	Kore::vec3 offsetPosition;
 	Kore::Quaternion offsetRotation;
@@ -101,10 +114,11 @@ private:
 	Kore::vec3 finalPosition;
 	Kore::Quaternion finalRotation;
 	
+	// One entry per getError since resetEvalVariables, they grow with the take; frames is only the initial capacity
 	const int frames = 20000;
 	int size = 0;
-	float* evalErrorPos;
-	float* evalErrorRot;
+	std::vector<float> evalErrorPos;
+	std::vector<float> evalErrorRot;
 	
 	float calcAvg(const float* vec) const;
 	float calcStd(const float* vec) const;
@@ -0,0 +1,55 @@
+#pragma once
+
+// Solves A * x = b for a small symmetric positive semi-definite matrix A with compile time size by an LDL^T
+// factorisation, for the damped normal equations of the IK. Cheaper and more accurate than inverting A, and without
+// square roots unlike Cholesky. Pivots that vanish against the largest diagonal entry of A (a singular A, e.g. the
+// undamped normal equations of JPI at a singularity) drop their direction from the solution instead of dividing by
+// zero.
+template<int n> class FixedLDLT {
+	
+public:
+	// Only the lower triangle of A is read
+	void factorize(const double (&A)[n][n]) {
+		double maxDiagonal = 0.0;
+		for (int i = 0; i < n; ++i) maxDiagonal = A[i][i] > maxDiagonal ? A[i][i] : maxDiagonal;
+		
+		for (int j = 0; j < n; ++j) {
+			double pivot = A[j][j];
+			for (int k = 0; k < j; ++k) pivot -= L[j][k] * L[j][k] * D[k];
+			D[j] = pivot;
+			inverseD[j] = pivot > epsilon * maxDiagonal ? 1.0 / pivot : 0.0;
+			
+			for (int i = j + 1; i < n; ++i) {
+				double sum = A[i][j];
+				for (int k = 0; k < j; ++k) sum -= L[i][k] * L[j][k] * D[k];
+				L[i][j] = sum * inverseD[j];
+			}
+		}
+	}
+	
+	void solve(const double (&b)[n], double (&x)[n]) const {
+		// L * y = b
+		for (int i = 0; i < n; ++i) {
+			double sum = b[i];
+			for (int k = 0; k < i; ++k) sum -= L[i][k] * x[k];
+			x[i] = sum;
+		}
+		
+		// D * z = y
+		for (int i = 0; i < n; ++i) x[i] *= inverseD[i];
+		
+		// L^T * x = z
+		for (int i = n - 1; i >= 0; --i) {
+			double sum = x[i];
+			for (int k = i + 1; k < n; ++k) sum -= L[k][i] * x[k];
+			x[i] = sum;
+		}
+	}
+	
+private:
+	static constexpr double epsilon = 1e-12;
+	
+	double L[n][n];		// Unit lower triangle, the diagonal and upper triangle are not used
+	double D[n];
+	double inverseD[n];
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <math.h>
+
+// Singular value decomposition A = U * diag(d) * V^T of a small matrix with compile time size, by one-sided Jacobi
+// rotations (Hestenes): the columns of A (the rows if A is wide) are rotated against each other until they are
+// orthogonal, their lengths are then the singular values. Everything lives on the stack and the loops have constant
+// bounds, so there is no heap and no bidiagonalisation for the 6 x nJointDOFs Jacobians of the IK.
+//
+// Only the Min(rows, cols) singular values and vectors are computed, sorted in decreasing order. Singular vectors of
+// zero singular values are zero.
+template<int rows, int cols> class FixedSVD {
+	
+public:
+	static const int size = rows < cols ? rows : cols;
+	
+	double U[rows][size];
+	double d[size];
+	double V[cols][size];
+	
+	void compute(const double (&A)[rows][cols]) {
+		// The shorter side is rotated: a holds the columns of A, or the rows if A is wide
+		double a[size][length];
+		for (int p = 0; p < size; ++p)
+			for (int m = 0; m < length; ++m)
+				a[p][m] = wide ? A[p][m] : A[m][p];
+		
+		// Start from the rotations of the last decomposition: the Jacobian of the next IK iteration is almost the
+		// same, so x is then already almost orthogonal and one or two sweeps are enough instead of five or six
+		for (int p = 0; p < size; ++p) {
+			for (int m = 0; m < length; ++m) {
+				if (converged) {
+					double sum = 0.0;
+					for (int q = 0; q < size; ++q) sum += Q[p][q] * a[q][m];
+					x[p][m] = sum;
+				} else {
+					x[p][m] = a[p][m];
+				}
+			}
+			if (!converged)
+				for (int q = 0; q < size; ++q) Q[p][q] = p == q ? 1.0 : 0.0;
+			norm[p] = dot(x[p], x[p]);
+		}
+		
+		converged = false;
+		for (int sweep = 0; sweep < maxSweeps && !converged; ++sweep) {
+			bool rotated = false;
+			
+			// Round-robin order: the pairs of one round are disjoint, so their rotations do not wait for each other
+			for (int round = 0; round < players - 1; ++round) {
+				for (int k = 0; k < players / 2; ++k) {
+					int p = player(round, k);
+					int q = player(round, players - 1 - k);
+					if (p >= size || q >= size) continue;
+					double gamma = dot(x[p], x[q]);
+					if (gamma * gamma <= epsilon * epsilon * norm[p] * norm[q] || fabs(gamma) <= tiny) continue;
+					rotated = true;
+					
+					// Rotation that makes x[p] and x[q] orthogonal, the squared lengths follow without a dot product
+					double tau = norm[q] - norm[p];
+					double t = (tau >= 0.0 ? 2.0 * gamma : -2.0 * gamma) / (fabs(tau) + sqrt(tau * tau + 4.0 * gamma * gamma));
+					double c = 1.0 / sqrt(1.0 + t * t);
+					double s = c * t;
+					norm[p] -= t * gamma;
+					norm[q] += t * gamma;
+					
+					rotate(x[p], x[q], length, c, s);
+					rotate(Q[p], Q[q], size, c, s);
+				}
+			}
+			
+			converged = !rotated;
+		}
+		
+		int order[size];
+		for (int p = 0; p < size; ++p) order[p] = p;
+		
+		// Insertion sort, size is at most 6
+		for (int i = 1; i < size; ++i) {
+			int p = order[i];
+			int j = i;
+			for (; j > 0 && norm[order[j - 1]] < norm[p]; --j) order[j] = order[j - 1];
+			order[j] = p;
+		}
+		
+		// x[p] = sigma_p * (left or right singular vector), Q[p] = the other singular vector
+		for (int i = 0; i < size; ++i) {
+			int p = order[i];
+			double sigma = sqrt(dot(x[p], x[p]));
+			double inverse = sigma > tiny ? 1.0 / sigma : 0.0;
+			d[i] = sigma;
+			
+			for (int m = 0; m < rows; ++m) U[m][i] = wide ? Q[p][m] : x[p][m] * inverse;
+			for (int n = 0; n < cols; ++n) V[n][i] = wide ? x[p][n] * inverse : Q[p][n];
+		}
+	}
+	
+	// The next compute starts from A instead of the rotations of the last decomposition, e.g. for a new take
+	void reset() {
+		converged = false;
+	}
+	
+private:
+	static const bool wide = cols > rows;
+	static const int length = wide ? cols : rows;
+	static const int maxSweeps = 30;
+	static constexpr double epsilon = 1e-7;	// Relative orthogonality, the Jacobian is only float
+	static constexpr double tiny = 1e-30;
+	
+	double x[size][length];
+	double Q[size][size];	// Accumulated rotations, stored transposed: Q[p] is a column
+	double norm[size];		// Squared lengths of x
+	bool converged = false;	// Q is orthogonal and can start the next decomposition
+	
+	static const int players = size + size % 2;	// Round-robin with a bye for an odd size
+	
+	static int player(int round, int position) {
+		return position == 0 ? 0 : (position - 1 + round) % (players - 1) + 1;
+	}
+	
+	static double dot(const double* a, const double* b) {
+		double sum = 0.0;
+		for (int m = 0; m < length; ++m) sum += a[m] * b[m];
+		return sum;
+	}
+	
+	static void rotate(double* a, double* b, int n, double c, double s) {
+		for (int m = 0; m < n; ++m) {
+			double am = a[m];
+			double bm = b[m];
+			a[m] = c * am - s * bm;
+			b[m] = s * am + c * bm;
+		}
+	}
+};
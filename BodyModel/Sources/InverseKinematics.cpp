@@ -4,46 +4,79 @@
 
 #include <Kore/System.h>
 
+#include <utility>
+
 using namespace Kore;
 
-extern float errorMaxPos[];
-extern float errorMaxRot[];
-extern float maxIterations[];
+extern thread_local float errorMaxPos[];
+extern thread_local float errorMaxRot[];
+extern thread_local float maxIterations[];
 
-InverseKinematics::InverseKinematics(std::vector<BoneNode*> boneVec) {
+InverseKinematics::InverseKinematics(std::vector<BoneNode*> boneVec, SkeletonPose* skeletonPose) {
 	bones = boneVec;
+	pose = skeletonPose;
+	warmStart = warmStartIK;
+	warmStartStates.resize(bones.size());
 	setJointConstraints();
+	compileJointLimits();
+	
+	// Bones are sorted parent before child, so the subtree of bones[i] is the range [i, subtreeEnd[i])
+	subtreeEnd.resize(bones.size());
+	for (int i = (int)bones.size() - 1; i >= 0; --i) {
+		int end = i + 1;
+		while (end < (int)bones.size() && pose->parent[end] == i) end = subtreeEnd[end];
+		subtreeEnd[i] = end;
+	}
 	
+	evalIterations.reserve(frames);
+	evalTime.reserve(frames);
+	evalTimeIteration.reserve(frames);
+	evalErrorPos.reserve(frames);
+	evalErrorRot.reserve(frames);
 	setEvalVariables();
 }
 
 InverseKinematics::~InverseKinematics() {
-	delete[] evalIterations;
-	delete[] evalTimeIteration;
-	delete[] evalTime;
-	delete[] evalErrorPos;
-	delete[] evalErrorRot;
+	for (int side = 0; side < 2; ++side) {
+		delete jacobianSimpleIKHand[side];
+		delete jacobianHand[side];
+		delete jacobianFoot[side];
+	}
+	delete jacobianHead;
+	delete jacobianWholeBody;
 }
 
-void InverseKinematics::inverseKinematics(BoneNode* targetBone, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation) {
-	std::vector<float> deltaTheta;
+void InverseKinematics::inverseKinematics(BoneNode* targetBone, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole) {
 	float previousPosition;
 	float previousRotation;
 	float errorPos = maxfloat();
 	float errorRot = maxfloat();
+	BoneNode* topBone = nullptr;
 	bool stuckedPos = false;
 	bool stuckedRot = false;
 	
 	double startTime;
 	double startTime_perIteration;
+	float timeIteration = 0.0f;
 	
 	if (eval) {
 		startTime = System::time();
 	}
 	
+	// The closed-form solve of arms and legs does not depend on the start pose, the iterations below only refine it
+	bool analytic = ikMode == ANALYTIC && isTwoBoneTarget(targetBone);
+	
+	int iterations = (int) maxIterations[ikMode];
+	if (warmStart && !analytic) iterations = predictChain(targetBone, desPosition, iterations);
+	
+	if (analytic) solveTwoBone(targetBone, desPosition, desRotation, pole);
+	
+	int index = targetBone->nodeIndex;
+	int side = index == rightHandBoneIndex || index == rightForeArmBoneIndex || index == rightFootBoneIndex ? 1 : 0;
+	
 	int i = 0;
 	// while position not reached and maxStep not reached and not stucked
-	while ((errorPos > errorMaxPos[ikMode] || errorRot > errorMaxRot[ikMode]) && i < (int) maxIterations[ikMode] && !stuckedPos && !stuckedRot) {
+	while ((errorPos > errorMaxPos[ikMode] || errorRot > errorMaxRot[ikMode]) && i < iterations && !stuckedPos && !stuckedRot) {
 		
 		if (eval) {
 			startTime_perIteration = System::time();
@@ -54,19 +87,19 @@ void InverseKinematics::inverseKinematics(BoneNode* targetBone, IKMode ikMode, K
 		
 		// todo: better!
 		if (simpleIK && (targetBone->nodeIndex == leftHandBoneIndex || targetBone->nodeIndex == rightHandBoneIndex)) {
-			deltaTheta = jacobianSimpleIKHand->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode);
-			errorPos = jacobianSimpleIKHand->getPositionError();
-			errorRot = jacobianSimpleIKHand->getRotationError();
+			topBone = applyChanges(jacobianSimpleIKHand[side]->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode), targetBone);
+			errorPos = jacobianSimpleIKHand[side]->getPositionError();
+			errorRot = jacobianSimpleIKHand[side]->getRotationError();
 		} else if (!simpleIK && (targetBone->nodeIndex == leftForeArmBoneIndex || targetBone->nodeIndex == rightForeArmBoneIndex)) {
-			deltaTheta = jacobianHand->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode);
-			errorPos = jacobianHand->getPositionError();
-			errorRot = jacobianHand->getRotationError();
+			topBone = applyChanges(jacobianHand[side]->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode), targetBone);
+			errorPos = jacobianHand[side]->getPositionError();
+			errorRot = jacobianHand[side]->getRotationError();
 		} else if (targetBone->nodeIndex == leftFootBoneIndex|| targetBone->nodeIndex == rightFootBoneIndex) {
-			deltaTheta = jacobianFoot->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode);
-			errorPos = jacobianFoot->getPositionError();
-			errorRot = jacobianFoot->getRotationError();
+			topBone = applyChanges(jacobianFoot[side]->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode), targetBone);
+			errorPos = jacobianFoot[side]->getPositionError();
+			errorRot = jacobianFoot[side]->getRotationError();
 		} else if (targetBone->nodeIndex == headBoneIndex) {
-			deltaTheta = jacobianHead->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode);
+			topBone = applyChanges(jacobianHead->calcDeltaTheta(targetBone, desPosition, desRotation, ikMode), targetBone);
 			errorPos = jacobianHead->getPositionError();
 			errorRot = jacobianHead->getRotationError();
 		}
@@ -77,43 +110,288 @@ void InverseKinematics::inverseKinematics(BoneNode* targetBone, IKMode ikMode, K
 			if (fabs(previousRotation - errorRot) < nearNull) stuckedRot = true;
 		}
 		
-		applyChanges(deltaTheta, targetBone);
-		applyJointConstraints(targetBone);
-		for (int i = 0; i < bones.size(); ++i)
-			updateBone(bones[i]);
+		// Only the chain from the target bone up to topBone has changed
+		if (topBone != nullptr) updateSubtree(topBone);
 		
 		if (eval && i == 0) {
 			// time per iteration
 			float timeEnd = (float)(System::time() - startTime_perIteration) * 1000.0f; // [ms]
-			evalTimeIteration[totalNum] = evalTimeIteration[totalNum] + timeEnd;
+			timeIteration = timeIteration + timeEnd;
 		}
 		
 		i++;
 	}
 	
+	if (warmStart && !analytic) saveChain(targetBone, desPosition);
+	
+	countSolves += 1;
+	countIterations += i;
+	if (eval) saveEvaluation(ikMode, i, errorPos, errorRot, stuckedPos || stuckedRot, startTime, timeIteration);
+}
+
+void InverseKinematics::inverseKinematics(BoneNode** targetBones, IKMode ikMode, const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, const float* weights, int count) {
+	float previousPosition;
+	float previousRotation;
+	float errorPos = maxfloat();
+	float errorRot = maxfloat();
+	bool stuckedPos = false;
+	bool stuckedRot = false;
+	
+	double startTime;
+	double startTime_perIteration;
+	float timeIteration = 0.0f;
+	
 	if (eval) {
-		evalReached += (errorPos < errorMaxPos[ikMode] && errorRot < errorMaxRot[ikMode]) ? 1 : 0;
-		evalStucked += (stuckedPos || stuckedRot);
+		startTime = System::time();
+	}
+	
+	int chainDOFs[WholeBodyJacobian::maxEndEffectors];
+	for (int k = 0; k < count; ++k) chainDOFs[k] = getChainDOFs(targetBones[k]);
+	jacobianWholeBody->setEndEffectors(targetBones, chainDOFs, weights, count);
+	
+	int i = 0;
+	// Same termination as the single end-effector solve, with the largest error of all end-effectors
+	while ((errorPos > errorMaxPos[ikMode] || errorRot > errorMaxRot[ikMode]) && i < (int) maxIterations[ikMode] && !stuckedPos && !stuckedRot) {
 		
-		// iterations
-		evalIterations[totalNum] = (float) i;
+		if (eval) {
+			startTime_perIteration = System::time();
+		}
 		
-		// pos-error
-		errorPos = errorPos * 1000.0f; // [mm]
-		evalErrorPos[totalNum] = errorPos > 0 ? errorPos : 0;
+		previousPosition = errorPos;
+		previousRotation = errorRot;
 		
-		// rot-error
-		errorRot = errorRot * 180.0f / Kore::pi; // [deg]
-		evalErrorRot[totalNum] = errorRot > 0 ? errorRot : 0;
+		jacobianWholeBody->calcDeltaTheta(desPositions, desRotations, ikMode);
+		errorPos = jacobianWholeBody->getPositionError();
+		errorRot = jacobianWholeBody->getRotationError();
+		applyChanges(jacobianWholeBody);
+		
+		if (i) {
+			if (fabs(previousPosition - errorPos) < nearNull) stuckedPos = true;
+			if (fabs(previousRotation - errorRot) < nearNull) stuckedRot = true;
+		}
 		
-		// time
-		evalTimeIteration[totalNum] = evalTimeIteration[totalNum] / i;
-		float timeEnd = (float)(System::time() - startTime) * 1000.0f; // [ms]
-		evalTime[totalNum] = timeEnd;
+		if (eval && i == 0) {
+			float timeEnd = (float)(System::time() - startTime_perIteration) * 1000.0f; // [ms]
+			timeIteration = timeIteration + timeEnd;
+		}
 		
-		totalNum++;
-		assert(totalNum < frames);
+		i++;
+	}
+	
+	countSolves += 1;
+	countIterations += i;
+	if (eval) saveEvaluation(ikMode, i, errorPos, errorRot, stuckedPos || stuckedRot, startTime, timeIteration);
+}
+
+bool InverseKinematics::isTwoBoneTarget(BoneNode* targetBone) const {
+	int index = targetBone->nodeIndex;
+	if (index == leftHandBoneIndex || index == rightHandBoneIndex) return simpleIK;
+	return index == leftFootBoneIndex || index == rightFootBoneIndex;
+}
+
+void InverseKinematics::solveTwoBone(BoneNode* endBone, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole) {
+	// Upper arm -> forearm -> hand or thigh -> calf -> foot, the middle joint is a hinge around its local x axis
+	BoneNode* midBone = endBone->parent;
+	BoneNode* rootBone = midBone->parent;
+	
+	Kore::vec3 root = rootBone->getPosition();
+	Kore::vec3 mid = midBone->getPosition();
+	Kore::vec3 end = endBone->getPosition();
+	
+	float upperLength = (mid - root).getLength();
+	float lowerLength = (end - mid).getLength();
+	if (upperLength < nearNull || lowerLength < nearNull) return;
+	
+	// Bend the middle joint until the chain spans the distance to the target (law of cosines)
+	float distance = (desPosition - root).getLength();
+	distance = Kore::max(Kore::abs(upperLength - lowerLength) + nearNull, Kore::min(distance, upperLength + lowerLength - nearNull));
+	float desDot = (Square(upperLength) + Square(lowerLength) - Square(distance)) / 2.0f; // (root - mid) . (end - mid)
+	
+	// Rotating end - mid by phi around the hinge h: w . u(phi) = w . u_par + cos(phi) * w . u_perp + sin(phi) * w . (h x u_perp)
+	Kore::vec3 hinge = getWorldAxis(midBone, Kore::vec3(1, 0, 0));
+	Kore::vec3 w = root - mid;
+	Kore::vec3 u = end - mid;
+	Kore::vec3 uPar = hinge * hinge.dot(u);
+	Kore::vec3 uPerp = u - uPar;
+	float k = w.dot(uPar);
+	float p = w.dot(uPerp);
+	float q = w.dot(hinge.cross(uPerp));
+	float r = Kore::sqrt(Square(p) + Square(q));
+	
+	if (r > nearNull) {
+		float phi0 = Kore::atan2(q, p);
+		float offset = Kore::acos(Kore::max(-1.0f, Kore::min(1.0f, (desDot - k) / r)));
+		
+		// Of both solutions prefer the one inside the joint limits, then the smaller rotation
+		float candidates[2] = { wrapAngle(phi0 + offset), wrapAngle(phi0 - offset) };
+		if (Kore::abs(candidates[1]) < Kore::abs(candidates[0])) std::swap(candidates[0], candidates[1]);
+		const JointLimits& limits = jointLimits[midBone->nodeIndex - 1];
+		float phi = candidates[0];
+		for (int c = 1; c >= 0; --c) {
+			Kore::Quaternion rotation = midBone->rotation;
+			rotation.rotate(Kore::Quaternion(Kore::vec3(1, 0, 0), candidates[c]));
+			float x, y, z;
+			Kore::RotationUtility::quatToEuler(&rotation, &x, &y, &z);
+			if (!(limits.axes & JointLimits::X) || (x >= limits.min[0] && x <= limits.max[0])) phi = candidates[c];
+		}
+		
+		midBone->rotation.rotate(Kore::Quaternion(Kore::vec3(1, 0, 0), phi));
+		midBone->rotation.normalize();
+		applyJointConstraints(midBone, limits);
+		SimdMath::localMatrix(midBone->transform, midBone->rotation, midBone->local);
+		updateSubtree(midBone);
+	}
+	
+	// Swing the root joint so that the end points at the target
+	Kore::vec3 from = endBone->getPosition() - root;
+	Kore::vec3 to = desPosition - root;
+	Kore::vec3 axis = from.cross(to);
+	if (axis.getLength() > nearNull) rotateWorld(rootBone, axis, Kore::atan2(axis.getLength(), from.dot(to)));
+	
+	// Twist the chain around the root -> target axis so that the middle joint points to the pole
+	if (pole != nullptr && to.getLength() > nearNull) {
+		Kore::vec3 n = to;
+		n.normalize();
+		Kore::vec3 midDir = midBone->getPosition() - root;
+		Kore::vec3 poleDir = *pole - root;
+		midDir = midDir - n * n.dot(midDir);
+		poleDir = poleDir - n * n.dot(poleDir);
+		if (midDir.getLength() > nearNull && poleDir.getLength() > nearNull)
+			rotateWorld(rootBone, n, Kore::atan2(n.dot(midDir.cross(poleDir)), midDir.dot(poleDir)));
+	}
+	
+	applyJointConstraints(rootBone, jointLimits[rootBone->nodeIndex - 1]);
+	SimdMath::localMatrix(rootBone->transform, rootBone->rotation, rootBone->local);
+	updateSubtree(rootBone);
+	
+	// Orientation of the hand, the feet have no joint DOFs
+	const JointLimits& endLimits = jointLimits[endBone->nodeIndex - 1];
+	if (endLimits.axes != 0) {
+		Kore::Quaternion parentRotation;
+		Kore::RotationUtility::getOrientation(&midBone->combined, &parentRotation);
+		endBone->rotation = parentRotation.invert().rotated(desRotation);
+		endBone->rotation.normalize();
+		applyJointConstraints(endBone, endLimits);
+		SimdMath::localMatrix(endBone->transform, endBone->rotation, endBone->local);
+		updateSubtree(endBone);
+	}
+}
+
+Kore::vec3 InverseKinematics::getWorldAxis(BoneNode* bone, Kore::vec3 localAxis) const {
+	Kore::vec4 axis = bone->combined * Kore::vec4(localAxis.x(), localAxis.y(), localAxis.z(), 0);
+	Kore::vec3 result(axis.x(), axis.y(), axis.z());
+	result.normalize();
+	return result;
+}
+
+void InverseKinematics::rotateWorld(BoneNode* bone, Kore::vec3 worldAxis, float angle) {
+	// A rotation of the local rotation around a local axis turns the bone around the world axis combined * axis (see Jacobian)
+	Kore::vec4 axis = bone->combined.Invert() * Kore::vec4(worldAxis.x(), worldAxis.y(), worldAxis.z(), 0);
+	Kore::vec3 localAxis(axis.x(), axis.y(), axis.z());
+	if (localAxis.getLength() < nearNull) return;
+	localAxis.normalize();
+	
+	bone->rotation.rotate(Kore::Quaternion(localAxis, angle));
+	bone->rotation.normalize();
+	SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
+	updateSubtree(bone);
+}
+
+float InverseKinematics::wrapAngle(float angle) {
+	while (angle > Kore::pi) angle -= 2.0f * Kore::pi;
+	while (angle < -Kore::pi) angle += 2.0f * Kore::pi;
+	return angle;
+}
+
+void InverseKinematics::resetWarmStart() {
+	for (WarmStartState& state : warmStartStates) state.solutions = 0;
+	
+	// The SVD warm start does not depend on warmStart, a reset skeleton has to solve like a new one either way
+	for (int side = 0; side < 2; ++side) {
+		jacobianSimpleIKHand[side]->resetSVD();
+		jacobianHand[side]->resetSVD();
+		jacobianFoot[side]->resetSVD();
+	}
+	jacobianHead->resetSVD();
+}
+
+int InverseKinematics::predictChain(BoneNode* targetBone, Kore::vec3 desPosition, int iterations) {
+	WarmStartState& state = warmStartStates[targetBone->nodeIndex - 1];
+	if (state.solutions < 2 || state.chainLength == 0) return iterations;
+	
+	// Constant joint velocity: current * (previous^-1 * current)
+	for (int k = 0; k < state.chainLength; ++k) {
+		BoneNode* bone = state.chain[k];
+		Kore::Quaternion velocity = state.previous[k].invert().rotated(state.current[k]);
+		bone->rotation = SimdMath::multiply(bone->rotation, velocity);
+		SimdMath::normalize(bone->rotation);
+		applyJointConstraints(bone, jointLimits[bone->nodeIndex - 1]);
+		SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
+	}
+	updateSubtree(state.chain[state.chainLength - 1]);
+	
+	// Tracker data moves the target a few millimetres per frame, the prediction is then already close
+	float displacement = (desPosition - state.target).getLength();
+	return Kore::min(iterations, warmStartMinIterations + (int)(displacement / warmStartStepPerIteration));
+}
+
+void InverseKinematics::saveChain(BoneNode* targetBone, Kore::vec3 desPosition) {
+	WarmStartState& state = warmStartStates[targetBone->nodeIndex - 1];
+	
+	if (state.solutions == 0) {
+		// Same joints as applyChanges: the bones with DOFs from the target bone upwards
+		int dofs = 0;
+		state.chainLength = 0;
+		BoneNode* bone = targetBone;
+		while (bone->initialized && dofs < getChainDOFs(targetBone) && state.chainLength < maxChainBones) {
+			int axes = jointLimits[bone->nodeIndex - 1].axes;
+			if (axes != 0) {
+				state.chain[state.chainLength++] = bone;
+				dofs += ((axes & JointLimits::X) != 0) + ((axes & JointLimits::Y) != 0) + ((axes & JointLimits::Z) != 0);
+			}
+			bone = bone->parent;
+		}
+	}
+	
+	for (int k = 0; k < state.chainLength; ++k) {
+		state.previous[k] = state.current[k];
+		state.current[k] = state.chain[k]->rotation;
 	}
+	state.target = desPosition;
+	state.solutions = Kore::min(state.solutions + 1, 2);
+}
+
+int InverseKinematics::getChainDOFs(BoneNode* targetBone) const {
+	int index = targetBone->nodeIndex;
+	if (index == leftHandBoneIndex || index == rightHandBoneIndex) return simpleIK ? handJointSimpleIKDOFs : 0;
+	if (index == leftForeArmBoneIndex || index == rightForeArmBoneIndex) return handJointDOFs;
+	if (index == leftFootBoneIndex || index == rightFootBoneIndex) return footJointDOFs;
+	if (index == leftLegBoneIndex || index == rightLegBoneIndex) return footJointDOFs; // Knee: same joints as the foot
+	if (index == headBoneIndex) return headJointDOFs;
+	return 0;
+}
+
+void InverseKinematics::saveEvaluation(IKMode ikMode, int iterations, float errorPos, float errorRot, bool stucked, double startTime, float timeIteration) {
+	evalReached += (errorPos < errorMaxPos[ikMode] && errorRot < errorMaxRot[ikMode]) ? 1 : 0;
+	evalStucked += stucked;
+	
+	// iterations
+	evalIterations.push_back((float) iterations);
+	
+	// pos-error
+	errorPos = errorPos * 1000.0f; // [mm]
+	evalErrorPos.push_back(errorPos > 0 ? errorPos : 0);
+	
+	// rot-error
+	errorRot = errorRot * 180.0f / Kore::pi; // [deg]
+	evalErrorRot.push_back(errorRot > 0 ? errorRot : 0);
+	
+	// time
+	evalTimeIteration.push_back(timeIteration / iterations);
+	float timeEnd = (float)(System::time() - startTime) * 1000.0f; // [ms]
+	evalTime.push_back(timeEnd);
+	
+	totalNum++;
 }
 
 void InverseKinematics::updateBone(BoneNode* bone) {
@@ -121,6 +399,11 @@ void InverseKinematics::updateBone(BoneNode* bone) {
 		bone->combined = bone->parent->combined * bone->local;
 }
 
+void InverseKinematics::updateSubtree(BoneNode* bone) {
+	int begin = bone->nodeIndex - 1;
+	pose->updateCombined(begin, subtreeEnd[begin]);
+}
+
 void InverseKinematics::initializeBone(BoneNode* bone) {
 	updateBone(bone);
 	
@@ -132,63 +415,116 @@ void InverseKinematics::initializeBone(BoneNode* bone) {
 	bone->finalTransform = bone->combined * bone->combinedInv;
 }
 
-void InverseKinematics::applyChanges(std::vector<float> deltaTheta, BoneNode* targetBone) {
-	unsigned long size = deltaTheta.size();
+void InverseKinematics::initializeBones() {
+	for (int i = 0; i < pose->boneCount; ++i) {
+		pose->updateCombined(i, i + 1);
+		
+		if (!pose->initialized[i]) {
+			pose->initialized[i] = true;
+			pose->combinedInv[i] = pose->combined[i].Invert();
+		}
+		
+		pose->finalTransform[i] = pose->combined[i] * pose->combinedInv[i];
+	}
+}
+
+template<unsigned nJointDOFs> BoneNode* InverseKinematics::applyChanges(Kore::Vector<float, nJointDOFs> deltaTheta, BoneNode* targetBone) {
+	const int size = (int)nJointDOFs;
 	int i = 0;
 	
 	BoneNode* bone = targetBone;
+	BoneNode* topBone = nullptr;
 	while (bone->initialized && i < size) {
-		Kore::vec3 axes = bone->axes;
+		const JointLimits& limits = jointLimits[bone->nodeIndex - 1];
 		
-		if (axes.x() == 1.0 && i < size) bone->rotation.rotate(Kore::Quaternion(Kore::vec3(1, 0, 0), deltaTheta[i++]));
-		if (axes.y() == 1.0 && i < size) bone->rotation.rotate(Kore::Quaternion(Kore::vec3(0, 1, 0), deltaTheta[i++]));
-		if (axes.z() == 1.0 && i < size) bone->rotation.rotate(Kore::Quaternion(Kore::vec3(0, 0, 1), deltaTheta[i++]));
+		if ((limits.axes & JointLimits::X) && i < size) bone->rotation = SimdMath::multiply(bone->rotation, Kore::Quaternion(Kore::vec3(1, 0, 0), deltaTheta[i++]));
+		if ((limits.axes & JointLimits::Y) && i < size) bone->rotation = SimdMath::multiply(bone->rotation, Kore::Quaternion(Kore::vec3(0, 1, 0), deltaTheta[i++]));
+		if ((limits.axes & JointLimits::Z) && i < size) bone->rotation = SimdMath::multiply(bone->rotation, Kore::Quaternion(Kore::vec3(0, 0, 1), deltaTheta[i++]));
 		
-		bone->rotation.normalize();
-		bone->local = bone->transform * bone->rotation.matrix().Transpose();
+		SimdMath::normalize(bone->rotation);
+		applyJointConstraints(bone, limits);
+		SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
 		
+		topBone = bone;
 		bone = bone->parent;
 	}
+	
+	return topBone;
 }
 
-void InverseKinematics::applyJointConstraints(BoneNode* targetBone) {
-	BoneNode* bone = targetBone;
-	while (bone->initialized) {
-		Kore::vec3 axes = bone->axes;
+void InverseKinematics::applyChanges(WholeBodyJacobian* jacobian) {
+	int begin = (int)bones.size();
+	int end = 0;
+	
+	int column = 0;
+	while (column < jacobian->getColumnCount()) {
+		BoneNode* bone = jacobian->getColumnBone(column);
+		for (; column < jacobian->getColumnCount() && jacobian->getColumnBone(column) == bone; ++column) {
+			Kore::vec3 axis(0, 0, 0);
+			axis[jacobian->getColumnAxis(column)] = 1;
+			bone->rotation = SimdMath::multiply(bone->rotation, Kore::Quaternion(axis, jacobian->getDeltaTheta(column)));
+		}
 		
-		Kore::vec3 rot;
-		Kore::RotationUtility::quatToEuler(&bone->rotation, &rot.x(), &rot.y(), &rot.z());
+		SimdMath::normalize(bone->rotation);
+		applyJointConstraints(bone, jointLimits[bone->nodeIndex - 1]);
+		SimdMath::localMatrix(bone->transform, bone->rotation, bone->local);
 		
-		float x = rot.x(), y = rot.y(), z = rot.z();
-		if (axes.x() == 1.0) {
-			clampValue(bone->constrain[xMin], bone->constrain[xMax], x);
-		}
-		if (axes.y() == 1.0) {
-			clampValue(bone->constrain[yMin], bone->constrain[yMax], y);
-		}
-		if (axes.z() == 1.0) {
-			clampValue(bone->constrain[zMin], bone->constrain[zMax], z);
+		int index = bone->nodeIndex - 1;
+		begin = Kore::min(begin, index);
+		end = Kore::max(end, subtreeEnd[index]);
+	}
+	
+	// One forward kinematics sweep over the range covering all changed chains
+	if (begin < end) pose->updateCombined(begin, end);
+}
+
+void InverseKinematics::applyJointConstraints(BoneNode* bone, const JointLimits& limits) {
+	if (limits.axes == 0) return;
+	
+	float euler[3];
+	Kore::RotationUtility::quatToEuler(&bone->rotation, &euler[0], &euler[1], &euler[2]);
+	
+	bool clamped = false;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (!(limits.axes & (1 << axis))) continue;
+		if (euler[axis] < limits.min[axis]) {
+			euler[axis] = limits.min[axis];
+			clamped = true;
+		} else if (euler[axis] > limits.max[axis]) {
+			euler[axis] = limits.max[axis];
+			clamped = true;
 		}
-		Kore::RotationUtility::eulerToQuat(x, y, z, &bone->rotation);
-		
-		// bone->rotation = Kore::Quaternion((double) x, (double) y, (double) z, 1);
+	}
+	
+	// Inside the limits the rotation is kept as it is, no quat -> euler -> quat round trip
+	if (clamped) {
+		Kore::RotationUtility::eulerToQuat(euler[0], euler[1], euler[2], &bone->rotation);
 		bone->rotation.normalize();
-		bone->local = bone->transform * bone->rotation.matrix().Transpose();
-		bone = bone->parent;
 	}
 }
 
-void InverseKinematics::clampValue(float minVal, float maxVal, float& value) {
-	if (minVal > maxVal) {
-		float temp = minVal;
-		minVal = maxVal;
-		maxVal = temp;
+void InverseKinematics::compileJointLimits() {
+	const char* const minKeys[3] = { xMin, yMin, zMin };
+	const char* const maxKeys[3] = { xMax, yMax, zMax };
+	
+	jointLimits.resize(bones.size());
+	for (size_t b = 0; b < bones.size(); ++b) {
+		BoneNode* bone = bones[b];
+		JointLimits& limits = jointLimits[b];
+		float axes[3] = { bone->axes.x(), bone->axes.y(), bone->axes.z() };
+		
+		for (int axis = 0; axis < 3; ++axis) {
+			limits.min[axis] = 0.0f;
+			limits.max[axis] = 0.0f;
+			if (axes[axis] != 1.0f) continue;
+			
+			limits.axes |= 1 << axis;
+			float minVal = bone->constrain[minKeys[axis]];
+			float maxVal = bone->constrain[maxKeys[axis]];
+			limits.min[axis] = Kore::min(minVal, maxVal);
+			limits.max[axis] = Kore::max(minVal, maxVal);
+		}
 	}
-	
-	if (value < minVal)
-		value = minVal;
-	else if (value > maxVal)
-		value = maxVal;
 }
 
 void InverseKinematics::setJointConstraints() {
@@ -323,12 +659,14 @@ void InverseKinematics::setEvalVariables() {
 	totalNum = 0;
 	evalReached = 0;
 	evalStucked = 0;
-	
-	evalIterations = new float[frames]();
-	evalTime = new float[frames]();
-	evalTimeIteration = new float[frames]();
-	evalErrorPos = new float[frames]();
-	evalErrorRot = new float[frames]();
+	countSolves = 0;
+	countIterations = 0;
+	
+	evalIterations.clear();
+	evalTime.clear();
+	evalTimeIteration.clear();
+	evalErrorPos.clear();
+	evalErrorRot.clear();
 }
 
 float InverseKinematics::calcAvg(const float* vec) const {
@@ -388,21 +726,25 @@ float* InverseKinematics::getAvdStdMinMax(const float* vec) const {
 }
 
 float* InverseKinematics::getIterations() {
-	return getAvdStdMinMax(evalIterations);
+	return getAvdStdMinMax(evalIterations.data());
 }
 
 float* InverseKinematics::getErrorPos() {
-	return getAvdStdMinMax(evalErrorPos);
+	return getAvdStdMinMax(evalErrorPos.data());
 }
 
 float* InverseKinematics::getErrorRot() {
-	return getAvdStdMinMax(evalErrorRot);
+	return getAvdStdMinMax(evalErrorRot.data());
 }
 
 float* InverseKinematics::getTime() {
-	return getAvdStdMinMax(evalTime);
+	return getAvdStdMinMax(evalTime.data());
 }
 
 float* InverseKinematics::getTimeIteration() {
-	return getAvdStdMinMax(evalTimeIteration);
+	return getAvdStdMinMax(evalTimeIteration.data());
+}
+
+float InverseKinematics::getMeanIterations() const {
+	return countSolves > 0 ? (float)countIterations / countSolves : 0.0f;
 }
@@ -1,16 +1,27 @@
 #pragma once
 
 #include "Jacobian.h"
+#include "WholeBodyJacobian.h"
 
 #include <Kore/Math/Quaternion.h>
 
+#include <vector>
+
 class InverseKinematics {
 	
 public:
-	InverseKinematics(std::vector<BoneNode*> bones);
+	InverseKinematics(std::vector<BoneNode*> bones, SkeletonPose* pose);
 	~InverseKinematics();
-	void inverseKinematics(BoneNode* targetBone, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation);
+	// pole: optional position the middle joint should point to (elbow or knee), only used by the analytic two-bone IK
+	void inverseKinematics(BoneNode* targetBone, IKMode ikMode, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole = nullptr);
+	// Whole-body IK: solves all target bones at once in one stacked Jacobian, the weights scale the error of each target
+	void inverseKinematics(BoneNode** targetBones, IKMode ikMode, const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, const float* weights, int count);
 	void initializeBone(BoneNode* bone);
+	void initializeBones(); // initializeBone for the whole skeleton in one sweep over the pose
+	void updateSubtree(BoneNode* bone); // Forward kinematics for the bone and all its descendants
+	
+	bool warmStart; // See Settings.h warmStartIK, only used by the single end-effector solve
+	void resetWarmStart(); // Forget the previous solutions and SVDs, e.g. after the skeleton was reset
 	
 	void setEvalVariables();
 	float getReached();
@@ -20,23 +31,53 @@ public:
 	float* getErrorRot();
 	float* getTime();
 	float* getTimeIteration();
+	float getMeanIterations() const; // Also counted when eval is off
 	
 private:
 	std::vector<BoneNode*> bones;
+	SkeletonPose* pose;
+	std::vector<int> subtreeEnd;
 	
+	// One Jacobian per side, the SVD starts from the singular vectors of the last solve of the same chain
 	static const int handJointSimpleIKDOFs = 7;
-	Jacobian<handJointSimpleIKDOFs>* jacobianSimpleIKHand = new Jacobian<handJointSimpleIKDOFs>;
+	Jacobian<handJointSimpleIKDOFs>* jacobianSimpleIKHand[2] = { new Jacobian<handJointSimpleIKDOFs>, new Jacobian<handJointSimpleIKDOFs> };
 	static const int handJointDOFs = 4;
-	Jacobian<handJointDOFs>* jacobianHand = new Jacobian<handJointDOFs>;
+	Jacobian<handJointDOFs>* jacobianHand[2] = { new Jacobian<handJointDOFs>, new Jacobian<handJointDOFs> };
 	
 	static const int footJointDOFs = 4;
-	Jacobian<footJointDOFs>* jacobianFoot = new Jacobian<footJointDOFs>;
+	Jacobian<footJointDOFs>* jacobianFoot[2] = { new Jacobian<footJointDOFs>, new Jacobian<footJointDOFs> };
 	
 	static const int headJointDOFs = 5;
 	Jacobian<headJointDOFs>* jacobianHead = new Jacobian<headJointDOFs>;
 	
+	WholeBodyJacobian* jacobianWholeBody = new WholeBodyJacobian(subtreeEnd);
+	int getChainDOFs(BoneNode* targetBone) const;
+	
 	void updateBone(BoneNode* bone);
 	
+	// Analytic two-bone IK (IKMode ANALYTIC) for the hands and feet
+	bool isTwoBoneTarget(BoneNode* targetBone) const;
+	void solveTwoBone(BoneNode* endBone, Kore::vec3 desPosition, Kore::Quaternion desRotation, const Kore::vec3* pole);
+	Kore::vec3 getWorldAxis(BoneNode* bone, Kore::vec3 localAxis) const;
+	void rotateWorld(BoneNode* bone, Kore::vec3 worldAxis, float angle);
+	static float wrapAngle(float angle);
+	
+	// Warm start: the rotations of the chain of a target bone after its last two solves
+	static const int maxChainBones = 8;
+	struct WarmStartState {
+		int solutions = 0;	// The prediction needs 2
+		int chainLength = 0;
+		BoneNode* chain[maxChainBones];
+		Kore::Quaternion previous[maxChainBones];
+		Kore::Quaternion current[maxChainBones];
+		Kore::vec3 target;
+	};
+	std::vector<WarmStartState> warmStartStates;	// Indexed like bones, only the target bones are used
+	
+	// Moves the chain by the joint velocity of the last frame and returns the iteration cap for the target displacement
+	int predictChain(BoneNode* targetBone, Kore::vec3 desPosition, int iterations);
+	void saveChain(BoneNode* targetBone, Kore::vec3 desPosition);
+	
 	const char* const xMin = "x_min";
 	const char* const xMax = "x_max";
 	const char* const yMin = "y_min";
@@ -44,11 +85,23 @@ private:
 	const char* const zMin = "z_min";
 	const char* const zMax = "z_max";
 	
+	// Joint limits of one bone, compiled from BoneNode::axes and BoneNode::constrain
+	struct JointLimits {
+		enum { X = 1, Y = 2, Z = 4 };
+		int axes = 0;		// Bitmask of the rotation axes
+		float min[3];		// Sorted, min <= max
+		float max[3];
+	};
+	std::vector<JointLimits> jointLimits;	// Indexed like bones
+	
 	void setJointConstraints();
-	void applyChanges(std::vector<float> deltaTheta, BoneNode* targetBone);
-	void applyJointConstraints(BoneNode* targetBone);
-	void clampValue(float minVal, float maxVal, float& value);
+	void compileJointLimits();
+	// Rotates the chain by deltaTheta and clamps every changed bone to its limits, returns the top-most changed bone
+	template<unsigned nJointDOFs> BoneNode* applyChanges(Kore::Vector<float, nJointDOFs> deltaTheta, BoneNode* targetBone);
+	void applyChanges(WholeBodyJacobian* jacobian);
+	void applyJointConstraints(BoneNode* bone, const JointLimits& limits);
 	
+	void saveEvaluation(IKMode ikMode, int iterations, float errorPos, float errorRot, bool stucked, double startTime, float timeIteration);
 	float* getAvdStdMinMax(const float* vec) const;
 	float calcAvg(const float* vec) const;
 	float calcStd(const float* vec) const;
@@ -56,11 +109,13 @@ private:
 	float calcMax(const float* vec) const;
 	
 	int totalNum = 0, evalReached = 0, evalStucked = 0;
+	long countSolves = 0, countIterations = 0;
 	
+	// One entry per solve since setEvalVariables, they grow with the take; frames is only the initial capacity
 	const int frames = 20000;
-	float* evalIterations;
-	float* evalTimeIteration;
-	float* evalTime;
-	float* evalErrorPos;
-	float* evalErrorRot;
+	std::vector<float> evalIterations;
+	std::vector<float> evalTimeIteration;
+	std::vector<float> evalTime;
+	std::vector<float> evalErrorPos;
+	std::vector<float> evalErrorRot;
 };
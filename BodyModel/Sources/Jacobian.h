@@ -1,20 +1,25 @@
 #include "MeshObject.h"
-#include "BussIK/MatrixRmn.h"
+#include "FixedSVD.h"
+#include "FixedLDLT.h"
+#include "SimdMath.h"
+#include "BussIK/MathMisc.h"
 #include "EndEffector.h"
 
 #include <Kore/Log.h>
 
 struct BoneNode;
 
-extern int ikMode;
-extern float lambda[];
+// IK parameters are per thread so that independent skeletons can be solved in parallel
+extern thread_local int ikMode;
+extern thread_local float lambda[];
 
 template<int nJointDOFs = 6> class Jacobian {
 	
 public:
-	std::vector<float> calcDeltaTheta(BoneNode* endEffektor, Kore::vec3 pos_soll, Kore::Quaternion rot_soll, int ikMode) {
+	typedef Kore::Vector<float, nJointDOFs>					vec_n;
+	
+	vec_n calcDeltaTheta(BoneNode* endEffektor, Kore::vec3 pos_soll, Kore::Quaternion rot_soll, int ikMode) {
 		
-		std::vector<float> deltaTheta;
 		vec_n vec;
 		vec_m deltaP = calcDeltaP(endEffektor, pos_soll, rot_soll);
 		mat_mxn jacobian = calcJacobian(endEffektor);
@@ -29,7 +34,8 @@ public:
 				vec = calcDeltaThetaByPseudoInverse(jacobian, deltaP);
 				break;
 			case DLS:
-				vec = calcDeltaThetaByDLS(jacobian, deltaP);
+			case ANALYTIC: // Refinement after the analytic two-bone solve
+				vec = calcDeltaThetaByDLS(jacobian, deltaP, lambda[ikMode]);
 				break;
 			case SVD:
 				vec = calcDeltaThetaBySVD(jacobian, deltaP);
@@ -46,10 +52,7 @@ public:
 				break;
 		}
 		
-		for (int n = 0; n < nJointDOFs; ++n)
-			deltaTheta.push_back(vec[n]);
-		
-		return deltaTheta;
+		return vec;
 	}
 	float getPositionError() {
 		return errorPos;
@@ -58,14 +61,69 @@ public:
 		return errorRot;
 	}
 	
-private:
+	// The next SVD starts cold instead of from the singular vectors of the last solve (see FixedSVD::compute)
+	void resetSVD() {
+		svd.reset();
+	}
+	
 	typedef Kore::Matrix<nJointDOFs, 6, float>				mat_mxn;
 	typedef Kore::Matrix<6, nJointDOFs, float>				mat_nxm;
 	typedef Kore::Matrix<6, 6, float>						mat_mxm;
 	typedef Kore::Matrix<nJointDOFs, nJointDOFs, float>		mat_nxn;
 	typedef Kore::Vector<float, 6>							vec_m;
-	typedef Kore::Vector<float, nJointDOFs>					vec_n;
 	
+	// Damped least squares step, l = 0 is the pseudo-inverse step. Solves the smaller of the two normal equations with
+	// LDL^T instead of inverting it and multiplying by the pseudo-inverse:
+	// m <= n: deltaTheta = J^T * (J * J^T + l^2 * I)^-1 * e, otherwise deltaTheta = (J^T * J + l^2 * I)^-1 * J^T * e
+	static vec_n solveDLS(const mat_mxn& jacobian, const vec_m& deltaP, float l) {
+		const int m = 6;
+		const int n = nJointDOFs;
+		const int size = m <= n ? m : n;
+		
+		double J[m][n];
+		for (int i = 0; i < m; ++i)
+			for (int j = 0; j < n; ++j)
+				J[i][j] = jacobian.get(i, j);
+		
+		// Lower triangle of the normal equations and their right-hand side
+		double A[size][size];
+		double b[size];
+		for (int i = 0; i < size; ++i) {
+			for (int k = 0; k <= i; ++k) {
+				double sum = 0.0;
+				if (m <= n) for (int j = 0; j < n; ++j) sum += J[i][j] * J[k][j];
+				else for (int j = 0; j < m; ++j) sum += J[j][i] * J[j][k];
+				A[i][k] = sum;
+			}
+			A[i][i] += (double)l * l;
+			
+			if (m <= n) b[i] = deltaP[i];
+			else {
+				b[i] = 0.0;
+				for (int j = 0; j < m; ++j) b[i] += J[j][i] * deltaP[j];
+			}
+		}
+		
+		FixedLDLT<size> ldlt;
+		ldlt.factorize(A);
+		double x[size];
+		ldlt.solve(b, x);
+		
+		vec_n theta;
+		for (int j = 0; j < n; ++j) {
+			if (m <= n) {
+				double sum = 0.0;
+				for (int i = 0; i < m; ++i) sum += J[i][j] * x[i];
+				theta[j] = (float)sum;
+			} else {
+				theta[j] = (float)x[j];
+			}
+		}
+		
+		return theta;
+	}
+	
+private:
 	float   errorPos = -1.0f;
 	float	errorRot = -1.0f;
 	int     nDOFs = 6;
@@ -74,29 +132,82 @@ private:
 	mat_nxn V;
 	vec_m   d;
 	
+	// Stack-sized SVD for the 6 x nJointDOFs Jacobian
+	FixedSVD<6, nJointDOFs> svd;
+	
 	vec_n calcDeltaThetaByTranspose(mat_mxn jacobian, vec_m deltaP) {
-		mat_nxm jacobianTranspose = jacobian.Transpose();
-		vec_n theta = jacobianTranspose * deltaP;
+		// theta = J^T * e and b = J * theta are each computed once, the step length is alpha = <e, b> / <b, b>.
+		// The columns are padded to 8 rows so that every column is two SSE registers.
+		alignas(16) float J[nJointDOFs][8];
+		alignas(16) float e[8];
+		for (int n = 0; n < nJointDOFs; ++n) {
+			for (int m = 0; m < 6; ++m) J[n][m] = jacobian.get(m, n);
+			J[n][6] = J[n][7] = 0.0f;
+		}
+		for (int m = 0; m < 6; ++m) e[m] = deltaP[m];
+		e[6] = e[7] = 0.0f;
+		
+		vec_n theta;
+		float a, b;
+#ifdef IK_SSE
+		__m128 eLow = _mm_load_ps(&e[0]);
+		__m128 eHigh = _mm_load_ps(&e[4]);
+		__m128 bLow = _mm_setzero_ps();
+		__m128 bHigh = _mm_setzero_ps();
+		for (int n = 0; n < nJointDOFs; ++n) {
+			__m128 columnLow = _mm_load_ps(&J[n][0]);
+			__m128 columnHigh = _mm_load_ps(&J[n][4]);
+			
+			// theta_n = <J_n, e>, horizontal sum of the 8 products
+			__m128 sum = _mm_add_ps(_mm_mul_ps(columnLow, eLow), _mm_mul_ps(columnHigh, eHigh));
+			sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+			sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+			theta[n] = _mm_cvtss_f32(sum);
+			
+			// b += theta_n * J_n
+			__m128 factor = _mm_shuffle_ps(sum, sum, 0);
+			bLow = _mm_add_ps(bLow, _mm_mul_ps(factor, columnLow));
+			bHigh = _mm_add_ps(bHigh, _mm_mul_ps(factor, columnHigh));
+		}
 		
-		float a = deltaP.dot(jacobian * jacobianTranspose * deltaP);
-		float b = (jacobian * jacobianTranspose * deltaP).dot(jacobian * jacobianTranspose * deltaP);
-		float alpha = a/b;
+		__m128 eb = _mm_add_ps(_mm_mul_ps(eLow, bLow), _mm_mul_ps(eHigh, bHigh));
+		__m128 bb = _mm_add_ps(_mm_mul_ps(bLow, bLow), _mm_mul_ps(bHigh, bHigh));
+		__m128 sums = _mm_add_ps(_mm_unpacklo_ps(eb, bb), _mm_unpackhi_ps(eb, bb));	// eb0+eb2, bb0+bb2, eb1+eb3, bb1+bb3
+		sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+		a = _mm_cvtss_f32(sums);
+		b = _mm_cvtss_f32(_mm_shuffle_ps(sums, sums, 1));
+#else
+		float bVec[6] = { 0, 0, 0, 0, 0, 0 };
+		for (int n = 0; n < nJointDOFs; ++n) {
+			float sum = 0.0f;
+			for (int m = 0; m < 6; ++m) sum += J[n][m] * e[m];
+			theta[n] = sum;
+			for (int m = 0; m < 6; ++m) bVec[m] += sum * J[n][m];
+		}
 		
-		//Kore::log(Kore::LogLevel::Info, "alpha %f", alpha);
+		a = 0.0f;
+		b = 0.0f;
+		for (int m = 0; m < 6; ++m) {
+			a += e[m] * bVec[m];
+			b += bVec[m] * bVec[m];
+		}
+#endif
+		
+		// No error, no step
+		float alpha = b > 0.0f ? a / b : 0.0f;
 		
 		//return lambda[0] * theta;
 		return alpha * theta;
 	}
 	
 	vec_n calcDeltaThetaByPseudoInverse(mat_mxn jacobian, vec_m deltaP) {
-		mat_nxm pseudoInverse = calcPseudoInverse(jacobian);
-		vec_n theta = pseudoInverse * deltaP;
+		vec_n theta = solveDLS(jacobian, deltaP, 0.0f);
 		
 		return lambda[1] * theta;
 	}
 	
-	vec_n calcDeltaThetaByDLS(mat_mxn jacobian, vec_m deltaP) {
-		return calcPseudoInverse(jacobian, lambda[2]) * deltaP;
+	vec_n calcDeltaThetaByDLS(mat_mxn jacobian, vec_m deltaP, float l) {
+		return solveDLS(jacobian, deltaP, l);
 	}
 	
 	vec_n calcDeltaThetaBySVD(mat_mxn jacobian, vec_m deltaP) {
@@ -214,20 +325,14 @@ private:
 		int joint = 0;
 		while (bone->initialized && joint < nJointDOFs) {
 			Kore::vec3 axes = bone->axes;
+			Kore::vec3 lever = pos_current - bone->getPosition();
 			
-			if (axes.x() == 1.0 && joint < nJointDOFs) {
-				vec_m column = calcJacobianColumn(bone, pos_current, Kore::vec3(1, 0, 0));
-				for (int i = 0; i < nDOFs; ++i) jacobianMatrix[i][joint] = column[i];
-				joint += 1;
-			}
-			if (axes.y() == 1.0 && joint < nJointDOFs) {
-				vec_m column = calcJacobianColumn(bone, pos_current, Kore::vec3(0, 1, 0));
-				for (int i = 0; i < nDOFs; ++i) jacobianMatrix[i][joint] = column[i];
-				joint += 1;
-			}
-			if (axes.z() == 1.0 && joint < nJointDOFs) {
-				vec_m column = calcJacobianColumn(bone, pos_current, Kore::vec3(0, 0, 1));
-				for (int i = 0; i < nDOFs; ++i) jacobianMatrix[i][joint] = column[i];
+			for (int axis = 0; axis < 3 && joint < nJointDOFs; ++axis) {
+				if (axes[axis] != 1.0) continue;
+				
+				float column[6];
+				Kore::SimdMath::jacobianColumn(bone->combined, axis, lever, column);
+				for (int i = 0; i < nDOFs; ++i) jacobianMatrix.Set(i, joint, column[i]);
 				joint += 1;
 			}
 			
@@ -237,74 +342,25 @@ private:
 		return jacobianMatrix;
 	}
 	
-	vec_m calcJacobianColumn(BoneNode* bone, Kore::vec3 p_aktuell, Kore::vec3 rotAxis) {
-		vec_m column;
-		
-		// Get rotation and position vector of the current bone
-		Kore::vec3 p_j = bone->getPosition();
-		
-		// get rotation-axis
-		Kore::vec4 v_j = bone->combined * Kore::vec4(rotAxis.x(), rotAxis.y(), rotAxis.z(), 0);
-		
-		// cross-product
-		Kore::vec3 pTheta = Kore::vec3(v_j.x(), v_j.y(), v_j.z()).cross(p_aktuell - p_j);
-		
-		if (nDOFs > 0) column[0] = pTheta.x();
-		if (nDOFs > 1) column[1] = pTheta.y();
-		if (nDOFs > 2) column[2] = pTheta.z();
-		if (nDOFs > 3) column[3] = v_j.x();
-		if (nDOFs > 4) column[4] = v_j.y();
-		if (nDOFs > 5) column[5] = v_j.z();
-		
-		return column;
-	}
-	
-	mat_nxm calcPseudoInverse(mat_mxn jacobian, float l = 0) { // lambda != 0 => DLS!
-		mat_nxm pseudoInverse;
-		mat_nxm transpose = jacobian.Transpose();
-		
-		if (nDOFs <= nJointDOFs) { // m <= n
-			// Left Damped pseudo-inverse
-			Jacobian::mat_nxn id;
-			if (l > nearNull) id = Jacobian::mat_nxn::Identity() * Square(l);
-			
-			pseudoInverse = (transpose * jacobian + id).Invert() * transpose;
-		} else {
-			// Right Damped pseudo-inverse
-			Jacobian::mat_mxm id;
-			if (l > nearNull) id = Jacobian::mat_mxm::Identity() * Square(l);
-			
-			pseudoInverse = transpose * (jacobian * transpose + id).Invert();
-		}
-		
-		return pseudoInverse;
-	}
-	
 	void calcSVD(Jacobian::mat_mxn jacobian) {
-		MatrixRmn J = MatrixRmn(nDOFs, nJointDOFs);
-		MatrixRmn U = MatrixRmn(nDOFs, nDOFs);
-		MatrixRmn V = MatrixRmn(nJointDOFs, nJointDOFs);
-		VectorRn d = VectorRn(Min(nDOFs, nJointDOFs));
+		double J[6][nJointDOFs];
+		for (int m = 0; m < 6; ++m)
+			for (int n = 0; n < nJointDOFs; ++n)
+				J[m][n] = (double) jacobian[m][n];
 		
+		svd.compute(J);
+		
+		// Only the first Min(nDOFs, nJointDOFs) singular values and vectors are used
 		for (int m = 0; m < nDOFs; ++m)
-			for (int n = 0; n < nJointDOFs; ++n)
-				J.Set(m, n, (double) jacobian[m][n]);
+			for (int i = 0; i < svd.size; ++i)
+				U[m][i] = (float) svd.U[m][i];
 		
-		J.ComputeSVD(U, d, V);
-		assert(J.DebugCheckSVD(U, d , V));
+		for (int n = 0; n < nJointDOFs; ++n)
+			for (int i = 0; i < svd.size; ++i)
+				V[n][i] = (float) svd.V[n][i];
 		
-		for (int m = 0; m < Max(nDOFs, nJointDOFs); ++m) {
-			for (int n = 0; n < Max(nDOFs, nJointDOFs); ++n) {
-				if (m < nDOFs && n < nDOFs)
-					Jacobian::U[m][n] = (float) U.Get(m, n);
-				
-				if (m < nJointDOFs && n < nJointDOFs)
-					Jacobian::V[m][n] = (float) V.Get(m, n);
-				
-				if (m == n && m < Min(nDOFs, nJointDOFs))
-					Jacobian::d[m] = (float) d.Get(m);
-			}
-		}
+		for (int i = 0; i < svd.size; ++i)
+			d[i] = (float) svd.d[i];
 	}
 	
 	Kore::vec3 clampMag(Kore::vec3 vec, float gamma_i) {
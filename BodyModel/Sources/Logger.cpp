@@ -2,17 +2,13 @@
 #include "Logger.h"
 
 #include <Kore/Log.h>
+#include <Kore/System.h>
 
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <ctime>
 
-extern int ikMode;
-extern float lambda[];
-extern float errorMaxPos[];
-extern float errorMaxRot[];
-extern float maxIterations[];
-
 namespace {
 	bool initHmmAnalysisData = false;
 }
@@ -21,7 +17,8 @@ Logger::Logger() {
 }
 
 Logger::~Logger() {
-	logDataReader.close();
+	if (rawDataRunning) endLogger();
+	delete logDataReader;
 	logDataWriter.close();
 	hmmWriter.close();
 	hmmAnalysisWriter.close();
@@ -36,22 +33,58 @@ void Logger::startLogger(const char* filename) {
 	logDataWriter.open(logFileName, std::ios::app); // Append to the end
 	
 	// Append header
-	logDataWriter << "tag rawPosX rawPosY rawPosZ rawRotX rawRotY rawRotZ rawRotW scale\n";
+	logDataWriter << "tag time rawPosX rawPosY rawPosZ rawRotX rawRotY rawRotZ rawRotW scale\n";
 	logDataWriter.flush();
 	
+	rawDataStartTime = Kore::System::time();
+	writtenSamples = 0;
+	droppedSamples = 0;
+	maxWriterLag = 0.0f;
+	rawDataRunning = true;
+	rawDataThread = std::thread(&Logger::writeRawData, this);
+	
 	log(Kore::Info, "Start logging");
 }
 
 void Logger::endLogger() {
+	// The writer drains the buffer before it exits
+	rawDataRunning = false;
+	if (rawDataThread.joinable()) rawDataThread.join();
 	logDataWriter.close();
 	
-	log(Kore::Info, "Stop logging");
+	log(Kore::Info, "Stop logging: %i samples written, %i dropped, writer lag up to %f ms", (int)writtenSamples, (int)droppedSamples, (float)maxWriterLag);
 }
 
-void Logger::saveData(const char* tag, Kore::vec3 rawPos, Kore::Quaternion rawRot, float scale) {
-	// Save position and rotation
-	logDataWriter << tag << " " << rawPos.x() << " " << rawPos.y() << " " << rawPos.z() << " " << rawRot.x << " " << rawRot.y << " " << rawRot.z << " " << rawRot.w << " " << scale << "\n";
-	logDataWriter.flush();
+void Logger::saveData(const char* tag, double time, Kore::vec3 rawPos, Kore::Quaternion rawRot, float scale) {
+	RawSample sample = { tag, time, Kore::System::time(), { rawPos.x(), rawPos.y(), rawPos.z() }, { rawRot.x, rawRot.y, rawRot.z, rawRot.w }, scale };
+	if (!rawDataBuffer.push(sample)) ++droppedSamples;
+}
+
+void Logger::writeRawData() {
+	RawSample sample;
+	char time[32];
+	while (true) {
+		// Read before draining, everything queued before endLogger is written
+		bool running = rawDataRunning;
+		
+		// The first sample of a batch waited longest
+		double now = Kore::System::time();
+		int batch = 0;
+		while (rawDataBuffer.pop(sample)) {
+			if (batch++ == 0) maxWriterLag = Kore::max((float)maxWriterLag, (float)(now - sample.queueTime) * 1000.0f);
+			
+			// Microseconds, the stream would round to 6 significant digits
+			snprintf(time, sizeof(time), "%.6f", sample.time - rawDataStartTime);
+			logDataWriter << sample.tag << " " << time << " " << sample.position[0] << " " << sample.position[1] << " " << sample.position[2] << " " << sample.rotation[0] << " " << sample.rotation[1] << " " << sample.rotation[2] << " " << sample.rotation[3] << " " << sample.scale << "\n";
+		}
+		if (batch > 0) {
+			logDataWriter.flush();
+			writtenSamples += batch;
+		}
+		
+		if (!running) return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
 }
 
 void Logger::startHMMLogger(const char* filename, int num) {
@@ -96,7 +129,7 @@ void Logger::analyseHMM(const char* hmmName, double probability, bool newLine) {
 	hmmAnalysisWriter.flush();
 }
 
-void Logger::saveEvaluationData(const char* filename, const float* iterations, float meanErrorPos, float stdErrorPos, float meanErrorRot, float stdErrorRot, const float* time, const float* timeIteration, float reached, float stucked, const float* errorHead, const float* errorHip, const float* errorLeftHand, const float* errorLeftForeArm, const float* errorRightHand, const float* errorRightForeArm, const float* errorLeftFoot, const float* errorRightFoot, const float* errorLeftKnee, const float* errorRightKnee) {
+void Logger::saveEvaluationData(const char* filename, int ikMode, float lambda, float errorMaxPos, float errorMaxRot, float maxIterations, const float* iterations, float meanErrorPos, float stdErrorPos, float meanErrorRot, float stdErrorRot, const float* time, const float* timeIteration, float reached, float stucked, const float* errorHead, const float* errorHip, const float* errorLeftHand, const float* errorLeftForeArm, const float* errorRightHand, const float* errorRightForeArm, const float* errorLeftFoot, const float* errorRightFoot, const float* errorLeftKnee, const float* errorRightKnee) {
 	
 	// Save settings
 	char evaluationDataPath[100];
@@ -126,8 +159,8 @@ void Logger::saveEvaluationData(const char* filename, const float* iterations, f
 	}
 	
 	// Save settings
-	log(Kore::Info, "%s \t IK: %i \t lambda: %f \t errorMaxPos: %f \t errorMaxRot: %f \t maxIterations: %f", filename, ikMode, lambda[ikMode], errorMaxPos[ikMode], errorMaxRot[ikMode], maxIterations[ikMode]);
-	evaluationDataOutputFile << ikMode << ";" << filename << ";" << lambda[ikMode] << ";" << errorMaxPos[ikMode] << ";" << errorMaxRot[ikMode] << ";" << maxIterations[ikMode] << ";";
+	log(Kore::Info, "%s \t IK: %i \t lambda: %f \t errorMaxPos: %f \t errorMaxRot: %f \t maxIterations: %f", filename, ikMode, lambda, errorMaxPos, errorMaxRot, maxIterations);
+	evaluationDataOutputFile << ikMode << ";" << filename << ";" << lambda << ";" << errorMaxPos << ";" << errorMaxRot << ";" << maxIterations << ";";
 
 	// Save mean and std for iterations
 	evaluationDataOutputFile << iterations[0] << ";" << iterations[1] << ";";
@@ -165,49 +198,90 @@ void Logger::endEvaluationLogger() {
 	log(Kore::Info, "Stop eval-logging!");
 }
 
-bool Logger::readData(const int numOfEndEffectors, const char* filename, Kore::vec3* rawPos, Kore::Quaternion* rawRot, EndEffectorIndices indices[], float& scale) {
-	std::string tag;
-	float posX, posY, posZ;
-	float rotX, rotY, rotZ, rotW;
+void Logger::startPoseLogger(const char* filename) {
+	poseWriter.open(filename, std::ios::out);
 	
-	if(!logDataReader.is_open()) {
-		
-		if (std::ifstream(filename)) {
-			logDataReader.open(filename);
-			log(Kore::Info, "Read data from %s", filename);
-			
-			// Skip header
-			logDataReader >> tag >> tag >> tag >> tag >> tag >> tag >> tag >> tag >> tag;
-		} else {
+	// Append header
+	poseWriter << "frame time[ms] bone posX posY posZ rotX rotY rotZ rotW\n";
+	poseWriter.flush();
+	
+	log(Kore::Info, "Start logging poses to %s", filename);
+}
+
+void Logger::endPoseLogger() {
+	poseWriter.flush();
+	poseWriter.close();
+	
+	log(Kore::Info, "Stop logging poses");
+}
+
+void Logger::savePoseData(int frame, float time, const std::vector<BoneNode*>& bones) {
+	// Save global position and orientation of every bone
+	for (BoneNode* bone : bones) {
+		Kore::vec3 pos = bone->getPosition();
+		Kore::Quaternion rot = bone->getOrientation();
+		poseWriter << frame << " " << time << " " << bone->nodeIndex << " " << pos.x() << " " << pos.y() << " " << pos.z() << " " << rot.x << " " << rot.y << " " << rot.z << " " << rot.w << "\n";
+	}
+}
+
+void Logger::startTimingLogger(const char* filename) {
+	time_t t = time(0);   // Get time now
+	
+	char logFileName[50];
+	sprintf(logFileName, "%s_%li.csv", filename, t);
+	
+	timingWriter.open(logFileName, std::ios::out);
+	
+	// Append header
+	timingWriter << "frame trackerTime[s] solve[ms] wait[ms] latency[ms]\n";
+	timingWriter.flush();
+	
+	log(Kore::Info, "Start logging frame timing to %s", logFileName);
+}
+
+void Logger::endTimingLogger() {
+	timingWriter.flush();
+	timingWriter.close();
+	
+	log(Kore::Info, "Stop logging frame timing");
+}
+
+void Logger::saveTimingData(int frame, double trackerTime, double publishTime, double consumeTime) {
+	// Not flushed, this runs on the render thread
+	timingWriter << frame << " " << trackerTime << " " << (publishTime - trackerTime) * 1000.0 << " " << (consumeTime - publishTime) * 1000.0 << " " << (consumeTime - trackerTime) * 1000.0 << "\n";
+}
+
+bool Logger::readData(const int numOfEndEffectors, const char* filename, Kore::vec3* rawPos, Kore::Quaternion* rawRot, EndEffectorIndices indices[], float& scale) {
+	if (logDataReader == nullptr) {
+		logDataReader = TakeReader::open(filename);
+		if (logDataReader == nullptr) {
 			log(Kore::Info, "Could not find file %s", filename);
+			return false;
 		}
+		log(Kore::Info, "Read data from %s", filename);
 	}
 	
-	// Read lines
-	for (int i = 0; i < numOfEndEffectors; ++i) {
-		logDataReader >> tag >> posX >> posY >> posZ >> rotX >> rotY >> rotZ >> rotW >> scale;
-		
-		EndEffectorIndices endEffectorIndex = unknown;
-		if(std::strcmp(tag.c_str(), headTag) == 0)			endEffectorIndex = head;
-		else if(std::strcmp(tag.c_str(), hipTag) == 0)		endEffectorIndex = hip;
-		else if(std::strcmp(tag.c_str(), lHandTag) == 0)	endEffectorIndex = leftHand;
-		else if(std::strcmp(tag.c_str(), rHandTag) == 0)	endEffectorIndex = rightHand;
-		else if (std::strcmp(tag.c_str(), lForeArm) == 0)	endEffectorIndex = leftForeArm;
-		else if (std::strcmp(tag.c_str(), rForeArm) == 0)	endEffectorIndex = rightForeArm;
-		else if (std::strcmp(tag.c_str(), lFootTag) == 0)	endEffectorIndex = leftFoot;
-		else if (std::strcmp(tag.c_str(), rFootTag) == 0)	endEffectorIndex = rightFoot;
-		else if (std::strcmp(tag.c_str(), lKneeTag) == 0)	endEffectorIndex = leftKnee;
-		else if (std::strcmp(tag.c_str(), rKneeTag) == 0)	endEffectorIndex = rightKnee;
-		
-		rawPos[i] = Kore::vec3(posX, posY, posZ);
-		rawRot[i] = Kore::Quaternion(rotX, rotY, rotZ, rotW);
-		indices[i] = endEffectorIndex;
-		
-		if (logDataReader.eof()) {
-			logDataReader.close();
-			return false;
+	// The samples up to the next repeated tag, the rest of the arrays is unknown
+	RecordedFrame frame;
+	if (!logDataReader->readFrame(frame)) {
+		if (logDataReader->getSkippedLines() > 0 || logDataReader->getIncompleteFrames() > 0) {
+			log(Kore::Warning, "%s: skipped %i lines that are not samples, %i of %i frames are incomplete", filename, logDataReader->getSkippedLines(), logDataReader->getIncompleteFrames(), logDataReader->getFrames());
 		}
+		delete logDataReader;
+		logDataReader = nullptr;
+		return false;
+	}
+	
+	int i = 0;
+	for (int device = 0; device < RecordedFrame::deviceCount && i < numOfEndEffectors; ++device) {
+		if (!frame.hasDevice(device)) continue;
+		rawPos[i] = frame.getPosition(device);
+		rawRot[i] = frame.getRotation(device);
+		indices[i] = (EndEffectorIndices)device;
+		++i;
 	}
+	for (; i < numOfEndEffectors; ++i) indices[i] = unknown;
+	scale = frame.scale;
 	
 	return true;
 }
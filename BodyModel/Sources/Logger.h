@@ -1,18 +1,41 @@
 #pragma once
 
 #include "EndEffector.h"
+#include "RingBuffer.h"
+#include "TakeReader.h"
 
 #include <Kore/Math/Quaternion.h>
 
+#include <atomic>
 #include <fstream>
+#include <thread>
 
 class Logger {
 	
 private:
 	// Input and output file to for raw data
-	std::fstream logDataReader;
+	TakeReader* logDataReader = nullptr;
 	std::ofstream logDataWriter;
 	
+	// saveData only queues the samples, rawDataThread formats and writes them in batches
+	struct RawSample {
+		const char* tag;
+		double time;		// Of the tracker sample
+		double queueTime;	// System::time() of saveData
+		float position[3];
+		float rotation[4];
+		float scale;
+	};
+	RingBuffer<RawSample, 4096> rawDataBuffer;	// 4.5 s of 10 end-effectors at 90 Hz
+	std::thread rawDataThread;
+	std::atomic<bool> rawDataRunning{ false };
+	double rawDataStartTime = 0.0;	// The time column counts from here
+	std::atomic<int> writtenSamples{ 0 };
+	std::atomic<int> droppedSamples{ 0 };
+	std::atomic<float> maxWriterLag{ 0.0f };	// [ms]
+	
+	void writeRawData();
+	
 	// Output file to save data for hmm
 	std::ofstream hmmWriter;
 	std::ofstream hmmAnalysisWriter;
@@ -20,22 +43,45 @@ private:
 	// Output file to save data for evaluation
 	std::fstream evaluationDataOutputFile;
 	
+	// Output file to save the solved skeleton pose for every frame
+	std::ofstream poseWriter;
+	
+	// Output file to save the latency of every pose from the tracker to the renderer
+	std::ofstream timingWriter;
+	
 public:
 	Logger();
 	~Logger();
 	
+	// Raw data: saveData is called by one thread and never waits for the file, tag has to outlive the logger (the tags
+	// of EndEffector.h). A sample is dropped if the writer falls behind by the whole buffer. time is when the tracker
+	// sampled the pose [s, System::time()], the file stores it relative to startLogger.
 	void startLogger(const char* filename);
 	void endLogger();
-	void saveData(const char* tag, Kore::vec3 rawPos, Kore::Quaternion rawRot, float scale);
+	void saveData(const char* tag, double time, Kore::vec3 rawPos, Kore::Quaternion rawRot, float scale);
+	int getDroppedSamples() const { return droppedSamples; }
+	float getMaxWriterLag() const { return maxWriterLag; }	// Longest time a sample waited for the writer [ms]
 	
-	void saveEvaluationData(const char* filename, const float* iterations, float meanErrorPos, float stdErrorPos, float meanErrorRot, float stdErrorRot, const float* time, const float* timeIteration, float reached, float stucked, const float* errorHead, const float* errorHip, const float* errorLeftHand, const float* errorLeftForeArm, const float* errorRightHand, const float* errorRightForeArm, const float* errorLeftFoot, const float* errorRightFoot, const float* errorLeftKnee, const float* errorRightKnee);
+	void saveEvaluationData(const char* filename, int ikMode, float lambda, float errorMaxPos, float errorMaxRot, float maxIterations, const float* iterations, float meanErrorPos, float stdErrorPos, float meanErrorRot, float stdErrorRot, const float* time, const float* timeIteration, float reached, float stucked, const float* errorHead, const float* errorHip, const float* errorLeftHand, const float* errorLeftForeArm, const float* errorRightHand, const float* errorRightForeArm, const float* errorLeftFoot, const float* errorRightFoot, const float* errorLeftKnee, const float* errorRightKnee);
 	void endEvaluationLogger();
 	
+	// Pose
+	void startPoseLogger(const char* filename);
+	void endPoseLogger();
+	void savePoseData(int frame, float time, const std::vector<BoneNode*>& bones);
+	
+	// Frame timing: tracker sample -> pose published by the IK -> pose consumed by the renderer [s, System::time()]
+	void startTimingLogger(const char* filename);
+	void endTimingLogger();
+	void saveTimingData(int frame, double trackerTime, double publishTime, double consumeTime);
+	
 	// HMM
 	void startHMMLogger(const char* filename, int num);
 	void endHMMLogger();
 	void saveHMMData(const char* tag, float lastTime, Kore::vec3 pos, Kore::Quaternion rot);
 	void analyseHMM(const char* filename, double probability, bool newLine);
 	
+	// One frame of the take per call (see TakeReader::readFrame), the entries after its samples are unknown. false at
+	// the end of the take.
 	bool readData(const int numOfEndEffectors, const char* filename, Kore::vec3* rawPos, Kore::Quaternion* rawRot, EndEffectorIndices indices[], float& scale);
 };
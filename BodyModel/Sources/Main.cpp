@@ -17,8 +17,15 @@
 #include "Avatar.h"
 #include "LivingRoom.h"
 #include "Logger.h"
+#include "BodyTracker.h"
+#include "TripleBuffer.h"
+#include "Recording.h"
+#include "ReplayClock.h"
 
 #include <algorithm> // std::sort, std::copy
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #ifdef KORE_STEAMVR
 #include <Kore/Vr/VrInterface.h>
@@ -32,34 +39,36 @@
 using namespace Kore;
 using namespace Kore::Graphics4;
 
+bool eval = false;
+
 // Dynamic IK parameters
-int ikMode = 2;
-//							JT = 0			JPI = 1		DLS = 2		SVD = 3		SVD_DLS = 4		SDLS = 5
+thread_local int ikMode = 2;
+//							JT = 0			JPI = 1		DLS = 2		SVD = 3		SVD_DLS = 4		SDLS = 5		ANALYTIC = 6
 // Uncomment this to evaluate lambda
-float lambda[6] 			= { 1.0f,		1.0f,		0.05f,		1.0f,		0.05f,			Kore::pi / 120.0f };
-float evalInitValue[6]		= { 1.0f,		1.0f,		0.05f,		1.0f,		0.05f,			Kore::pi / 120.0f };
-float* evalValue			= lambda;
-const float evalStep[6]		= { 0.0f,		0.0f,		0.05f,		0.0f,		0.05f,			Kore::pi / 120.0f };
-const float evalMaxValue[6] = { 1.0f,		1.0f,		1.5f,		1.0f,		1.5f,			Kore::pi / 4.0f };
-float maxIterations[6]		= { 200.0f,		200.0f,		200.0f,		200.0f,		200.0f,			200.0f };
+thread_local float lambda[7] 			= { 1.0f,		1.0f,		0.05f,		1.0f,		0.05f,			Kore::pi / 120.0f,		0.05f };
+float evalInitValue[7]		= { 1.0f,		1.0f,		0.05f,		1.0f,		0.05f,			Kore::pi / 120.0f,		0.05f };
+thread_local float* evalValue	= lambda;
+const float evalStep[7]		= { 0.0f,		0.0f,		0.05f,		0.0f,		0.05f,			Kore::pi / 120.0f,		0.05f };
+const float evalMaxValue[7] = { 1.0f,		1.0f,		1.5f,		1.0f,		1.5f,			Kore::pi / 4.0f,		1.5f };
+thread_local float maxIterations[7]		= { 200.0f,		200.0f,		200.0f,		200.0f,		200.0f,			200.0f,		200.0f };
 
 // Uncomment this to evaluate iterations
-/*float lambda[6] 			= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi };
-float maxIterations[6] 		= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f };
-float evalInitValue[6]		= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f };
-float* evalValue			= maxIterations;
-const float evalMaxValue[6] = { 100.0f,		100.0f,		100.0f,		100.0f,		100.0f,			100.0f 	};
-const float evalStep[6] 	= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f	};*/
+/*thread_local float lambda[7] 			= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi,		0.25f };
+thread_local float maxIterations[7] 		= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f,		1.0f };
+float evalInitValue[7]		= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f,		1.0f };
+thread_local float* evalValue	= maxIterations;
+const float evalMaxValue[7] = { 100.0f,		100.0f,		100.0f,		100.0f,		100.0f,			100.0f,		100.0f 	};
+const float evalStep[7] 	= { 1.0f,		1.0f,		1.0f,		1.0f,		1.0f,			1.0f,		1.0f	};*/
 
 // Uncomment this to evaluate accuracy
-/*float lambda[6]			= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi };
-float evalInitValue[6]		= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi };
-float* evalValue			= lambda;
-const float evalStep[6]		= { 0.0f,		0.0f,		0.0f,		0.0f,		0.0f,			0.0f };
-const float evalMaxValue[6] = { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi };
-float maxIterations[6]		= { 200.0f,		200.0f,		200.0f,		200.0f,		200.0f,			200.0f };*/
-float errorMaxPos[6] 		= { 0.0001f,	0.0001f,	0.0001f,	0.0001f,	0.0001f,		0.0001f	};
-float errorMaxRot[6] 		= { 0.0001f,	0.0001f,	0.0001f,	0.0001f,	0.0001f,		0.0001f	};
+/*thread_local float lambda[7]			= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi,		0.25f };
+float evalInitValue[7]		= { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi,		0.25f };
+thread_local float* evalValue	= lambda;
+const float evalStep[7]		= { 0.0f,		0.0f,		0.0f,		0.0f,		0.0f,			0.0f,		0.0f };
+const float evalMaxValue[7] = { 1.0f,		1.0f,		0.25f,		1.0f,		0.25f,			1.0f / 12.0f * Kore::pi,		0.25f };
+thread_local float maxIterations[7]		= { 200.0f,		200.0f,		200.0f,		200.0f,		200.0f,			200.0f,		200.0f };*/
+thread_local float errorMaxPos[7] 		= { 0.0001f,	0.0001f,	0.0001f,	0.0001f,	0.0001f,		0.0001f,		0.0001f	};
+thread_local float errorMaxRot[7] 		= { 0.0001f,	0.0001f,	0.0001f,	0.0001f,	0.0001f,		0.0001f,		0.0001f	};
 
 namespace {
 	const int width = 1024;
@@ -69,15 +78,46 @@ namespace {
 	const bool renderTrackerAndController = true;
 	const bool renderAxisForEndEffector = false;
 	
+	BodyTracker* bodyTracker;
 	EndEffector** endEffector;
-	const int numOfEndEffectors = 10;
+	const int numOfEndEffectors = BodyTracker::numOfEndEffectors;
 	
 	Logger* logger;
 	
-	const double fpsLimit = 1.0f / 90.0f;
 	double startTime;
 	double lastTime;
-	double lastFrameTime = 0.0f;
+	
+	// Everything the renderer needs of a solved frame, written by the tracking thread and read by the render thread
+	struct RenderPose {
+		int frame;
+		double trackerTime;		// System::time() of the tracker sample
+		double publishTime;		// System::time() when the IK was solved
+		bool calibrated;
+		float scale;
+		mat4 initTrans;
+		std::vector<mat4> finalTransform;	// Skinning matrices, layout of SkeletonPose::finalTransform
+		vec3 desPosition[numOfEndEffectors];
+		Kore::Quaternion desRotation[numOfEndEffectors];
+		mat4 endEffectorTransform[numOfEndEffectors];	// Bone of the end-effector in world space, see renderAxisForEndEffector
+	};
+	TripleBuffer<RenderPose> poseBuffer;
+	int solvedFrames = 0;
+	
+	// Tracking thread, see Settings.h ikThread
+	std::thread trackingThread;
+	std::atomic<bool> trackingRunning(false);
+	std::atomic<bool> trackingFinished(false);	// All recordings are played
+	
+	// Input of the render thread, applied by the tracking thread before its next frame
+	std::atomic<bool> resetRequested(false);
+	std::atomic<bool> calibrateRequested(false);
+	std::atomic<int> recordRequests(0);
+	bool recording = false;
+	
+	// Latency from the tracker sample to the rendered pose, see Settings.h logFrameTiming
+	int renderedPoses = 0;
+	double latencySum = 0.0;
+	double latencyMax = 0.0;
 	
 	// Audio cues
 	Sound* startRecordingSound;
@@ -129,17 +169,22 @@ namespace {
 	// Variables to mirror the room and the avatar
 	vec3 mirrorOver(6.057f, 0.0f, 0.04f);
 	
-	mat4 initTrans;
-	mat4 initTransInv;
-	Kore::Quaternion initRot;
-	Kore::Quaternion initRotInv;
-	
-	bool calibratedAvatar = false;
-	
 #ifdef KORE_STEAMVR
 	bool controllerButtonsInitialized = false;
 	float currentUserHeight;
 	bool firstPersonMonitor = false;
+	
+	// The VR devices are polled on the render thread, the tracking thread solves the latest sample
+	struct TrackerSample {
+		double time;
+		VrPoseState devices[16];
+		SensorState eyes[2];
+	};
+	TripleBuffer<TrackerSample> trackerBuffer;
+#else
+	// Take of files[currentFile] that is played back and when its frames are due, see Settings.h replaySpeed
+	Recording* take = nullptr;
+	ReplayClock replayClock(replaySpeed, replayFrameStep);
 #endif
 	
 	void renderVRDevice(int index, Kore::mat4 M) {
@@ -175,7 +220,7 @@ namespace {
 		}
 		
 		// Render a local coordinate system only if the avatar is not calibrated
-		if (!calibratedAvatar) {
+		if (!poseBuffer.front().calibrated) {
 			renderVRDevice(2, W);
 			renderVRDevice(2, M);
 		}
@@ -200,9 +245,10 @@ namespace {
 			
 		}
 #else
+		const RenderPose& renderPose = poseBuffer.front();
 		for(int i = 0; i < numOfEndEffectors; ++i) {
-			Kore::vec3 desPosition = endEffector[i]->getDesPosition();
-			Kore::Quaternion desRotation = endEffector[i]->getDesRotation();
+			Kore::vec3 desPosition = renderPose.desPosition[i];
+			Kore::Quaternion desRotation = renderPose.desRotation[i];
 			
 			if (i == hip || (!simpleIK && i == leftForeArm) || (!simpleIK && i == rightForeArm) || i == leftFoot || i == rightFoot) {
 				renderControllerAndTracker(true, desPosition, desRotation);
@@ -216,15 +262,9 @@ namespace {
 	void renderCSForEndEffector() {
 		Graphics4::setPipeline(pipeline);
 		
+		const RenderPose& renderPose = poseBuffer.front();
 		for(int i = 0; i < numOfEndEffectors; ++i) {
-			BoneNode* bone = avatar->getBoneWithIndex(endEffector[i]->getBoneIndex());
-			
-			vec3 endEffectorPos = bone->getPosition();
-			endEffectorPos = initTrans * vec4(endEffectorPos.x(), endEffectorPos.y(), endEffectorPos.z(), 1);
-			Kore::Quaternion endEffectorRot = initRot.rotated(bone->getOrientation());
-			
-			Kore::mat4 M = mat4::Translation(endEffectorPos.x(), endEffectorPos.y(), endEffectorPos.z()) * endEffectorRot.matrix().Transpose();
-			Graphics4::setMatrix(mLocation, M);
+			Graphics4::setMatrix(mLocation, renderPose.endEffectorTransform[i]);
 			viveObjects[2]->render(tex);
 		}
 	}
@@ -243,16 +283,18 @@ namespace {
 	void renderAvatar(mat4 V, mat4 P) {
 		Graphics4::setPipeline(pipeline);
 		
+		const RenderPose& renderPose = poseBuffer.front();
+		
 		Graphics4::setMatrix(vLocation, V);
 		Graphics4::setMatrix(pLocation, P);
-		Graphics4::setMatrix(mLocation, initTrans);
-		avatar->animate(tex);
+		Graphics4::setMatrix(mLocation, renderPose.initTrans);
+		avatar->render(tex);
 		
 		// Mirror the avatar
-		mat4 initTransMirror = getMirrorMatrix() * initTrans;
+		mat4 initTransMirror = getMirrorMatrix() * renderPose.initTrans;
 		
 		Graphics4::setMatrix(mLocation, initTransMirror);
-		avatar->animate(tex);
+		avatar->render(tex);
 	}
 	
 	Kore::mat4 getProjectionMatrix() {
@@ -267,106 +309,84 @@ namespace {
 		return V;
 	}
 	
-	void executeMovement(int endEffectorID) {
-		Kore::vec3 desPosition = endEffector[endEffectorID]->getDesPosition();
-		Kore::Quaternion desRotation = endEffector[endEffectorID]->getDesRotation();
-
-		// Save raw data
-		if (logRawData) logger->saveData(endEffector[endEffectorID]->getName(), desPosition, desRotation, avatar->scale);
-		
-		if (calibratedAvatar) {
-			// Transform desired position/rotation to the character local coordinate system
-			desPosition = initTransInv * vec4(desPosition.x(), desPosition.y(), desPosition.z(), 1);
-			desRotation = initRotInv.rotated(desRotation);
-
-			// Add offset
-			Kore::Quaternion offsetRotation = endEffector[endEffectorID]->getOffsetRotation();
-			vec3 offsetPosition = endEffector[endEffectorID]->getOffsetPosition();
-			Kore::Quaternion finalRot = desRotation.rotated(offsetRotation);
-			vec3 finalPos = mat4::Translation(desPosition.x(), desPosition.y(), desPosition.z()) * finalRot.matrix().Transpose() * mat4::Translation(offsetPosition.x(), offsetPosition.y(), offsetPosition.z()) * vec4(0, 0, 0, 1);
+void record() {
+	recording = !recording;
+	
+	if (recording) {
+		Audio1::play(startRecordingSound);
+	} else {
+		Audio1::play(stopRecordingSound);
+	}
+	
+	// The tracking thread writes the log
+	++recordRequests;
+}
 
-			endEffector[endEffectorID]->setFinalPosition(finalPos);
-			endEffector[endEffectorID]->setFinalRotation(finalRot);
+	void applyRecordRequests() {
+		for (int requests = recordRequests.exchange(0); requests > 0; --requests) {
+			bodyTracker->logRawData = !bodyTracker->logRawData;
 			
-			if (endEffectorID == hip) {
-				avatar->setFixedPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), finalPos, finalRot);
-			} else if (endEffectorID == head) {
-				avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
-			} else if (endEffectorID == leftForeArm || endEffectorID == rightForeArm) {
-				if (!simpleIK)
-					avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
-			} else if (endEffectorID == leftFoot || endEffectorID == rightFoot) {
-				avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
-			} else if (endEffectorID == leftHand || endEffectorID == rightHand) {
-				if (simpleIK) {
-					avatar->setDesiredPositionAndOrientation(endEffector[endEffectorID]->getBoneIndex(), endEffector[endEffectorID]->getIKMode(), finalPos, finalRot);
-				} else {
-					avatar->setFixedOrientation(endEffector[endEffectorID]->getBoneIndex(), finalRot);
-				}
+			if (bodyTracker->logRawData) {
+				logger->startLogger("logData");
+			} else {
+				logger->endLogger();
 			}
-			
-			// Evaluate IK precision
-			if (eval) endEffector[endEffectorID]->getError(avatar->getBoneWithIndex(endEffector[endEffectorID]->getBoneIndex()));
-			
 		}
 	}
 	
-	void initTransAndRot() {
-		initRot = Kore::Quaternion(0, 0, 0, 1);
-		initRot.rotate(Kore::Quaternion(vec3(1, 0, 0), -Kore::pi / 2.0));
-		initRot.rotate(Kore::Quaternion(vec3(0, 0, 1), Kore::pi / 2.0));
-		initRot.normalize();
-		initRotInv = initRot.invert();
+	void publishPose(double trackerTime) {
+		avatar->updateBones();
 		
-		// Move character in the middle of both feet
-		Kore::vec3 initPos = Kore::vec3(0, 0, 0);
-		Kore::vec3 posLeftFoot = endEffector[leftFoot]->getDesPosition();
-		Kore::vec3 posRightFoot = endEffector[rightFoot]->getDesPosition();
-		//initPos = (posRightFoot + posLeftFoot) / 2.0f;
-		initPos.y() = 0.0f;
-
-		initTrans = mat4::Translation(initPos.x(), initPos.y(), initPos.z()) * initRot.matrix().Transpose();
-		initTransInv = initTrans.Invert();
-	}
-	
-	void calibrate() {
-		initTransAndRot();
+		RenderPose& renderPose = poseBuffer.back();
+		renderPose.frame = solvedFrames++;
+		renderPose.trackerTime = trackerTime;
+		renderPose.calibrated = bodyTracker->calibratedAvatar;
+		renderPose.scale = avatar->scale;
+		renderPose.initTrans = bodyTracker->initTrans;
+		std::copy(avatar->pose.finalTransform, avatar->pose.finalTransform + avatar->pose.boneCount + 1, renderPose.finalTransform.begin());
 		
 		for (int i = 0; i < numOfEndEffectors; ++i) {
-			Kore::vec3 desPosition = endEffector[i]->getDesPosition();
-			Kore::Quaternion desRotation = endEffector[i]->getDesRotation();
-			
-			// Transform desired position/rotation to the character local coordinate system
-			desPosition = initTransInv * vec4(desPosition.x(), desPosition.y(), desPosition.z(), 1);
-			desRotation = initRotInv.rotated(desRotation);
-			
-			// Get actual position/rotation of the character skeleton
-			BoneNode* bone = avatar->getBoneWithIndex(endEffector[i]->getBoneIndex());
-			vec3 targetPos = bone->getPosition();
-			Kore::Quaternion targetRot = bone->getOrientation();
+			renderPose.desPosition[i] = endEffector[i]->getDesPosition();
+			renderPose.desRotation[i] = endEffector[i]->getDesRotation();
 			
-			endEffector[i]->setOffsetPosition((mat4::Translation(desPosition.x(), desPosition.y(), desPosition.z()) * targetRot.matrix().Transpose()).Invert() * mat4::Translation(targetPos.x(), targetPos.y(), targetPos.z()) * vec4(0, 0, 0, 1));
-			endEffector[i]->setOffsetRotation((desRotation.invert()).rotated(targetRot));
+			if (renderAxisForEndEffector) {
+				BoneNode* bone = avatar->getBoneWithIndex(endEffector[i]->getBoneIndex());
+				
+				vec3 endEffectorPos = bone->getPosition();
+				endEffectorPos = bodyTracker->initTrans * vec4(endEffectorPos.x(), endEffectorPos.y(), endEffectorPos.z(), 1);
+				Kore::Quaternion endEffectorRot = bodyTracker->initRot.rotated(bone->getOrientation());
+				
+				renderPose.endEffectorTransform[i] = mat4::Translation(endEffectorPos.x(), endEffectorPos.y(), endEffectorPos.z()) * endEffectorRot.matrix().Transpose();
+			}
 		}
+		
+		renderPose.publishTime = System::time();
+		poseBuffer.publish();
 	}
 	
-void record() {
-	logRawData = !logRawData;
-	
-	if (logRawData) {
-		Audio1::play(startRecordingSound);
-		logger->startLogger("logData");
-	} else {
-		Audio1::play(stopRecordingSound);
-		logger->endLogger();
+	// Render thread: takes the latest solved pose, if there is a new one, and skins it for all views of the frame
+	void consumePose() {
+		if (!poseBuffer.consume()) return;
+		
+		avatar->skin(poseBuffer.front().finalTransform.data(), poseBuffer.front().scale);
+		
+		if (logFrameTiming) {
+			const RenderPose& renderPose = poseBuffer.front();
+			double consumeTime = System::time();
+			logger->saveTimingData(renderPose.frame, renderPose.trackerTime - startTime, renderPose.publishTime - startTime, consumeTime - startTime);
+			
+			double latency = consumeTime - renderPose.trackerTime;
+			latencySum += latency;
+			latencyMax = Kore::max(latencyMax, latency);
+			++renderedPoses;
+		}
 	}
-}
 
 #ifdef KORE_STEAMVR
-	void setSize() {
+	void setSize(const TrackerSample& sample) {
 		float currentAvatarHeight = avatar->getHeight();
 		
-		SensorState state = VrInterface::getSensorState(0);
+		const SensorState& state = sample.eyes[0];
 		vec3 hmdPos = state.pose.vrPose.position; // z -> face, y -> up down
 		currentUserHeight = hmdPos.y();
 		
@@ -384,7 +404,7 @@ void record() {
 		Kore::log(Info, "%s, device id: %i", endEffector[efID]->getName(), deviceID);
 	}
 	
-	void assignControllerAndTracker() {
+	void assignControllerAndTracker(const TrackerSample& sample) {
 		VrPoseState vrDevice;
 
 		int trackerCount = 0;
@@ -393,7 +413,7 @@ void record() {
 		
 		// Get indices for VR devices
 		for (int i = 0; i < 16; ++i) {
-			vrDevice = VrInterface::getController(i);
+			vrDevice = sample.devices[i];
 			
 			vec3 devicePos = vrDevice.vrPose.position;
 			Kore::Quaternion deviceRot = vrDevice.vrPose.orientation;
@@ -458,8 +478,8 @@ void record() {
 		}
 		
 		// HMD
-		SensorState stateLeftEye = VrInterface::getSensorState(0);
-		SensorState stateRightEye = VrInterface::getSensorState(1);
+		const SensorState& stateLeftEye = sample.eyes[0];
+		const SensorState& stateRightEye = sample.eyes[1];
 		vec3 leftEyePos = stateLeftEye.pose.vrPose.position;
 		vec3 rightEyePos = stateRightEye.pose.vrPose.position;
 		vec3 hmdPosCenter = (leftEyePos + rightEyePos) / 2;
@@ -471,25 +491,19 @@ void record() {
 
 		// Grip button => set size and reset an avatar to a default T-Pose
 		if (buttonNr == 2 && value == 1) {
-			calibratedAvatar = false;
-			initTransAndRot();
-			avatar->resetPositionAndRotation();
-			setSize();
+			resetRequested = true;
 		}
 		
 		// Menu button => calibrate
 		if (buttonNr == 1 && value == 1) {
-			assignControllerAndTracker();
-			calibrate();
-			calibratedAvatar = true;
-			Kore::log(Info, "Calibrate avatar");
+			calibrateRequested = true;
 		}
 		
 		// Track a movement as long as trigger button is pressed
 		if (buttonNr == 33 && value == 1) {
 			// Trigger button pressed
 			Kore::log(Info, "Trigger button pressed");
-			if (calibratedAvatar) {
+			if (poseBuffer.front().calibrated) {
 				record();
 			}
 		}
@@ -497,7 +511,7 @@ void record() {
 		if (buttonNr == 33 && value == 0) {
 			// Trigger button released
 			Kore::log(Info, "Trigger button released");
-			if (calibratedAvatar) {
+			if (poseBuffer.front().calibrated) {
 				record();
 			}
 		}
@@ -523,48 +537,233 @@ void record() {
 	}
 #endif
 
-	void update() {
-		float t = (float)(System::time() - startTime);
-		double deltaT = t - lastTime;
-		lastTime = t;
+	// Solves the latest tracker sample and publishes the pose, returns false if there was no new sample. Runs on the
+	// tracking thread or, without Settings.h ikThread, in update().
+	bool trackFrame() {
+		applyRecordRequests();
 		
-		// Move position of camera based on WASD keys
-		float cameraMoveSpeed = 4.f;
-		if (S) cameraPos -= camForward * (float)deltaT * cameraMoveSpeed;
-		if (W) cameraPos += camForward * (float)deltaT * cameraMoveSpeed;
-		if (A) cameraPos += camRight * (float)deltaT * cameraMoveSpeed;
-		if (D) cameraPos -= camRight * (float)deltaT * cameraMoveSpeed;
+#ifdef KORE_STEAMVR
+		if (!trackerBuffer.consume()) return false;
+		const TrackerSample& sample = trackerBuffer.front();
 		
-		Graphics4::begin();
-		Graphics4::clear(Graphics4::ClearColorFlag | Graphics4::ClearDepthFlag, Graphics1::Color::Black, 1.0f, 0);
-		Graphics4::setPipeline(pipeline);
+		// Grip button => set size and reset an avatar to a default T-Pose
+		if (resetRequested.exchange(false)) {
+			bodyTracker->calibratedAvatar = false;
+			bodyTracker->initTransAndRot();
+			avatar->resetPositionAndRotation();
+			setSize(sample);
+		}
 		
-#ifdef KORE_STEAMVR
-		VrInterface::begin();
-
-		if (!controllerButtonsInitialized) initButtons();
+		// Menu button => calibrate
+		if (calibrateRequested.exchange(false)) {
+			assignControllerAndTracker(sample);
+			bodyTracker->calibrate();
+			bodyTracker->calibratedAvatar = true;
+			Kore::log(Info, "Calibrate avatar");
+		}
 		
 		VrPoseState vrDevice;
 		for (int i = 0; i < numOfEndEffectors; ++i) {
 			if (endEffector[i]->getDeviceIndex() != -1) {
 
 				if (i == head) {
-					SensorState state = VrInterface::getSensorState(0);
+					const SensorState& state = sample.eyes[0];
 
 					// Get HMD position and rotation
 					endEffector[i]->setDesPosition(state.pose.vrPose.position);
 					endEffector[i]->setDesRotation(state.pose.vrPose.orientation);
+					endEffector[i]->setDesTime(sample.time);
 				} else {
-					vrDevice = VrInterface::getController(endEffector[i]->getDeviceIndex());
+					vrDevice = sample.devices[endEffector[i]->getDeviceIndex()];
 
 					// Get VR device position and rotation
 					endEffector[i]->setDesPosition(vrDevice.vrPose.position);
 					endEffector[i]->setDesRotation(vrDevice.vrPose.orientation);
+					endEffector[i]->setDesTime(sample.time);
 				}
 
-				executeMovement(i);
+				bodyTracker->executeMovement(i);
 			}
 		}
+		bodyTracker->finishMovement();
+		
+		publishPose(sample.time);
+		return true;
+#else
+		if (trackingFinished) return false;
+		
+		// Next frame of the take
+		if (currentFile >= numFiles) {
+			trackingFinished = true;
+			return false;
+		}
+		
+		if (take == nullptr) {
+			take = Recording::load(files[currentFile]);
+			replayClock.start(take, System::time());
+		}
+		int takeFrame = replayClock.nextFrame(System::time());
+		if (takeFrame < 0) return false;
+		bool dataAvailable = take != nullptr && takeFrame < take->getFrameCount();
+		float scaleFactor = avatar->scale;
+		
+		if (dataAvailable) {
+			const RecordedFrame& frame = take->getFrame(takeFrame);
+			for (int i = 0; i < numOfEndEffectors; ++i) {
+				if (!frame.hasDevice(i)) continue;
+				endEffector[i]->setDesPosition(frame.getPosition(i));
+				endEffector[i]->setDesRotation(frame.getRotation(i));
+				endEffector[i]->setDesTime(replayClock.getFrameTime());
+			}
+			scaleFactor = frame.scale;
+		} else {
+			if (take != nullptr && replaySpeed > 0.0 && !replayFrameStep) {
+				Kore::log(Info, "Played %s: %i frames, drift mean %f ms, max %f ms, at the end %f ms", files[currentFile], replayClock.getPlayedFrames(), replayClock.getMeanDrift(), replayClock.getMaxDrift(), replayClock.getLastDrift());
+			}
+			delete take;
+			take = nullptr;
+		}
+
+		if (!bodyTracker->calibratedAvatar) {
+			avatar->resetPositionAndRotation();
+			avatar->setScale(scaleFactor);
+			bodyTracker->calibrate();
+			bodyTracker->calibratedAvatar = true;
+
+			if (eval) {
+				avatar->resetVariables();
+
+				bodyTracker->resetEvalVariables();
+			}
+		}
+
+		for (int i = 0; i < numOfEndEffectors; ++i) {
+			bodyTracker->executeMovement(i);
+		}
+		bodyTracker->finishMovement();
+
+		if (!dataAvailable) {
+
+			if (eval) {
+
+				float* iterations = avatar->getIterations();
+				//float* errorPos = avatar->getErrorPos();
+				//float* errorRot = avatar->getErrorRot();
+				float* timeIteration = avatar->getTimeIteration();
+				float* time = avatar->getTime();
+				float reached = avatar->getReached();
+				float stucked = avatar->getStucked();
+
+				float* errorHead = endEffector[head]->getAvdStdPosRot();
+				float* errorHip = endEffector[hip]->getAvdStdPosRot();
+				float* errorLeftHand = endEffector[leftHand]->getAvdStdPosRot();
+				float* errorRightHand = endEffector[rightHand]->getAvdStdPosRot();
+				float* errorLeftForeArm = endEffector[leftForeArm]->getAvdStdPosRot();
+				float* errorRightForeArm = endEffector[rightForeArm]->getAvdStdPosRot();
+				float* errorLeftFoot = endEffector[leftFoot]->getAvdStdPosRot();
+				float* errorRightFoot = endEffector[rightFoot]->getAvdStdPosRot();
+				float* errorLeftKnee = endEffector[leftKnee]->getAvdStdPosRot();
+				float* errorRightKnee = endEffector[rightKnee]->getAvdStdPosRot();
+
+
+				float overallPosError, standardDeviationPos, overallRotError, standardDeviationRot;
+				bodyTracker->getOverallError(overallPosError, standardDeviationPos, overallRotError, standardDeviationRot);
+
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[head]->getName(), errorHead[0], errorHead[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[hip]->getName(), errorHip[0], errorHip[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftHand]->getName(), errorLeftHand[0], errorLeftHand[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftForeArm]->getName(), errorLeftForeArm[0], errorLeftForeArm[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightHand]->getName(), errorRightHand[0], errorRightHand[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightForeArm]->getName(), errorRightForeArm[0], errorRightForeArm[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftFoot]->getName(), errorLeftFoot[0], errorLeftFoot[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightFoot]->getName(), errorRightFoot[0], errorRightFoot[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftKnee]->getName(), errorLeftKnee[0], errorLeftKnee[2]);
+				Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightKnee]->getName(), errorRightKnee[0], errorRightKnee[2]);
+				Kore::log(LogLevel::Info, "Overall Error Pos = %f +- %f, Rot = %f +- %f", overallPosError, standardDeviationPos, overallRotError, standardDeviationRot);
+
+				logger->saveEvaluationData(files[currentFile], ikMode, lambda[ikMode], errorMaxPos[ikMode], errorMaxRot[ikMode], maxIterations[ikMode], iterations, overallPosError, standardDeviationPos, overallRotError, standardDeviationRot, time, timeIteration, reached, stucked, errorHead, errorHip, errorLeftHand, errorLeftForeArm, errorRightHand, errorRightForeArm, errorLeftFoot, errorRightFoot, errorLeftKnee, errorRightKnee);
+
+				if (FLOAT_EQ(evalValue[ikMode], evalMaxValue[ikMode])) {
+					//if (evalValue[ikMode] >= evalMaxValue[ikMode]) {
+					logger->endEvaluationLogger();
+
+					evalValue[ikMode] = evalInitValue[ikMode];
+
+					ikMode++;
+					if (ikMode > evalMaxIk) {
+						ikMode = evalMinIk;
+						currentFile++;
+					}
+
+					bodyTracker->setIKMode((IKMode)ikMode);
+				}
+				else {
+					evalValue[ikMode] += evalStep[ikMode];
+				}
+
+				bodyTracker->calibratedAvatar = false;
+
+			}
+			else {
+				currentFile++;
+				bodyTracker->calibratedAvatar = false;
+			}
+		}
+		
+		publishPose(bodyTracker->sampleTime);
+		return true;
+#endif
+	}
+	
+	void initIKParameters() {
+		if(!eval) {
+			std::copy(optimalLambda, optimalLambda + 7, lambda);
+			std::copy(optimalErrorMaxPos, optimalErrorMaxPos + 7, errorMaxPos);
+			std::copy(optimalErrorMaxRot, optimalErrorMaxRot + 7, errorMaxRot);
+			std::copy(optimalMaxIterations, optimalMaxIterations + 7, maxIterations);
+		}
+	}
+	
+	void trackingLoop() {
+		// The IK parameters are per thread
+		initIKParameters();
+		
+		while (trackingRunning) {
+			// Sleep only when there was nothing to solve, the tracker rate is set by the VR runtime or replayClock
+			if (!trackFrame()) std::this_thread::sleep_for(std::chrono::microseconds(250));
+		}
+	}
+	
+	void update() {
+		float t = (float)(System::time() - startTime);
+		double deltaT = t - lastTime;
+		lastTime = t;
+		
+		// Move position of camera based on WASD keys
+		float cameraMoveSpeed = 4.f;
+		if (S) cameraPos -= camForward * (float)deltaT * cameraMoveSpeed;
+		if (W) cameraPos += camForward * (float)deltaT * cameraMoveSpeed;
+		if (A) cameraPos += camRight * (float)deltaT * cameraMoveSpeed;
+		if (D) cameraPos -= camRight * (float)deltaT * cameraMoveSpeed;
+		
+		Graphics4::begin();
+		Graphics4::clear(Graphics4::ClearColorFlag | Graphics4::ClearDepthFlag, Graphics1::Color::Black, 1.0f, 0);
+		Graphics4::setPipeline(pipeline);
+		
+#ifdef KORE_STEAMVR
+		VrInterface::begin();
+
+		if (!controllerButtonsInitialized) initButtons();
+		
+		// Hand the tracker sample to the tracking thread
+		TrackerSample& sample = trackerBuffer.back();
+		sample.time = System::time();	// Kore has no hardware time stamp of the poses, the poll time is the closest
+		for (int i = 0; i < 16; ++i) sample.devices[i] = VrInterface::getController(i);
+		for (int j = 0; j < 2; ++j) sample.eyes[j] = VrInterface::getSensorState(j);
+		trackerBuffer.publish();
+		
+		if (!ikThread) trackFrame();
+		consumePose();
 		
 		// Render for both eyes
 		SensorState state;
@@ -607,138 +806,10 @@ void record() {
 			else renderLivingRoom(state.pose.vrPose.eye, state.pose.vrPose.projection);
 		}
 #else
-		// Read line
-		if ((t - lastFrameTime) >= fpsLimit) {
-			float scaleFactor;
-			EndEffectorIndices indices[numOfEndEffectors];
-			Kore::vec3 desPosition[numOfEndEffectors];
-			Kore::Quaternion desRotation[numOfEndEffectors];
-			if (currentFile < numFiles) {
-				bool dataAvailable = logger->readData(numOfEndEffectors, files[currentFile], desPosition, desRotation, indices, scaleFactor);
-
-				if (dataAvailable) {
-					for (int i = 0; i < numOfEndEffectors; ++i) {
-						EndEffectorIndices index = indices[i];
-						endEffector[index]->setDesPosition(desPosition[i]);
-						endEffector[index]->setDesRotation(desRotation[i]);
-					}
-				}
-
-				if (!calibratedAvatar) {
-					avatar->resetPositionAndRotation();
-					avatar->setScale(scaleFactor);
-					calibrate();
-					calibratedAvatar = true;
-
-					if (eval) {
-						avatar->resetVariables();
-
-						endEffector[head]->resetEvalVariables();
-						endEffector[hip]->resetEvalVariables();
-						endEffector[leftHand]->resetEvalVariables();
-						endEffector[leftForeArm]->resetEvalVariables();
-						endEffector[rightHand]->resetEvalVariables();
-						endEffector[rightForeArm]->resetEvalVariables();
-						endEffector[leftFoot]->resetEvalVariables();
-						endEffector[rightFoot]->resetEvalVariables();
-						endEffector[leftKnee]->resetEvalVariables();
-						endEffector[rightKnee]->resetEvalVariables();
-					}
-				}
-
-				for (int i = 0; i < numOfEndEffectors; ++i) {
-					executeMovement(i);
-				}
-
-				if (!dataAvailable) {
-
-					if (eval) {
-
-						float* iterations = avatar->getIterations();
-						//float* errorPos = avatar->getErrorPos();
-						//float* errorRot = avatar->getErrorRot();
-						float* timeIteration = avatar->getTimeIteration();
-						float* time = avatar->getTime();
-						float reached = avatar->getReached();
-						float stucked = avatar->getStucked();
-
-						float* errorHead = endEffector[head]->getAvdStdPosRot();
-						float* errorHip = endEffector[hip]->getAvdStdPosRot();
-						float* errorLeftHand = endEffector[leftHand]->getAvdStdPosRot();
-						float* errorRightHand = endEffector[rightHand]->getAvdStdPosRot();
-						float* errorLeftForeArm = endEffector[leftForeArm]->getAvdStdPosRot();
-						float* errorRightForeArm = endEffector[rightForeArm]->getAvdStdPosRot();
-						float* errorLeftFoot = endEffector[leftFoot]->getAvdStdPosRot();
-						float* errorRightFoot = endEffector[rightFoot]->getAvdStdPosRot();
-						float* errorLeftKnee = endEffector[leftKnee]->getAvdStdPosRot();
-						float* errorRightKnee = endEffector[rightKnee]->getAvdStdPosRot();
-
-
-						float overallPosError = (errorHead[0] + errorHip[0] + errorLeftHand[0] + errorLeftForeArm[0] + errorRightHand[0] + errorRightForeArm[0] + errorLeftFoot[0] + errorRightFoot[0] + errorLeftKnee[0] + errorRightKnee[0]) / numOfEndEffectors;
-						float overallRotError = (errorHead[2] + errorHip[2] + errorLeftHand[2] + errorLeftForeArm[2] + errorRightHand[2] + errorRightForeArm[2] + errorLeftFoot[2] + errorRightFoot[2] + errorLeftKnee[2] + errorRightKnee[2]) / numOfEndEffectors;
-
-						float standardDeviationPos = 0.0f;
-						float standardDeviationRot = 0.0f;
-						for (int i = 0; i < numOfEndEffectors; i++) {
-							standardDeviationPos += Kore::pow(endEffector[i]->getAvdStdPosRot()[0] - overallPosError, 2);
-							standardDeviationRot += Kore::pow(endEffector[i]->getAvdStdPosRot()[3] - overallRotError, 2);
-						}
-						standardDeviationPos = Kore::sqrt(standardDeviationPos / numOfEndEffectors);
-						standardDeviationRot = Kore::sqrt(standardDeviationRot / numOfEndEffectors);
-
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[head]->getName(), errorHead[0], errorHead[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[hip]->getName(), errorHip[0], errorHip[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftHand]->getName(), errorLeftHand[0], errorLeftHand[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftForeArm]->getName(), errorLeftForeArm[0], errorLeftForeArm[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightHand]->getName(), errorRightHand[0], errorRightHand[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightForeArm]->getName(), errorRightForeArm[0], errorRightForeArm[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftFoot]->getName(), errorLeftFoot[0], errorLeftFoot[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightFoot]->getName(), errorRightFoot[0], errorRightFoot[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[leftKnee]->getName(), errorLeftKnee[0], errorLeftKnee[2]);
-						Kore::log(LogLevel::Info, "Error %s = %f, %f", endEffector[rightKnee]->getName(), errorRightKnee[0], errorRightKnee[2]);
-						Kore::log(LogLevel::Info, "Overall Error Pos = %f +- %f, Rot = %f +- %f", overallPosError, standardDeviationPos, overallRotError, standardDeviationRot);
-
-						logger->saveEvaluationData(files[currentFile], iterations, overallPosError, standardDeviationPos, overallRotError, standardDeviationRot, time, timeIteration, reached, stucked, errorHead, errorHip, errorLeftHand, errorLeftForeArm, errorRightHand, errorRightForeArm, errorLeftFoot, errorRightFoot, errorLeftKnee, errorRightKnee);
-
-						if (FLOAT_EQ(evalValue[ikMode], evalMaxValue[ikMode])) {
-							//if (evalValue[ikMode] >= evalMaxValue[ikMode]) {
-							logger->endEvaluationLogger();
-
-							evalValue[ikMode] = evalInitValue[ikMode];
-
-							ikMode++;
-							if (ikMode > evalMaxIk) {
-								ikMode = evalMinIk;
-								currentFile++;
-							}
-
-							endEffector[head]->setIKMode((IKMode)ikMode);
-							endEffector[hip]->setIKMode((IKMode)ikMode);
-							endEffector[leftHand]->setIKMode((IKMode)ikMode);
-							endEffector[leftForeArm]->setIKMode((IKMode)ikMode);
-							endEffector[rightHand]->setIKMode((IKMode)ikMode);
-							endEffector[rightForeArm]->setIKMode((IKMode)ikMode);
-							endEffector[leftFoot]->setIKMode((IKMode)ikMode);
-							endEffector[rightFoot]->setIKMode((IKMode)ikMode);
-						}
-						else {
-							evalValue[ikMode] += evalStep[ikMode];
-						}
-
-						calibratedAvatar = false;
-
-					}
-					else {
-						currentFile++;
-						calibratedAvatar = false;
-					}
-				}
-			}
-			else {
-				System::stop();
-			}
-			lastFrameTime = t;
-		}
+		if (!ikThread) trackFrame();
+		consumePose();
+		if (trackingFinished) System::stop();
+		
 		
 		// Get projection and view matrix
 		mat4 P = getProjectionMatrix();
@@ -784,6 +855,11 @@ void record() {
 				
 				record();
 				break;
+#ifndef KORE_STEAMVR
+			case KeyN:
+				replayClock.step();
+				break;
+#endif
 			case KeyEscape:
 			case KeyQ:
 				System::stop();
@@ -948,25 +1024,17 @@ void record() {
 		
 		logger = new Logger();
 		
-		if(!eval) {
-			std::copy(optimalLambda, optimalLambda + 6, lambda);
-			std::copy(optimalErrorMaxPos, optimalErrorMaxPos + 6, errorMaxPos);
-			std::copy(optimalErrorMaxRot, optimalErrorMaxRot + 6, errorMaxRot);
-			std::copy(optimalMaxIterations, optimalMaxIterations + 6, maxIterations);
-		}
-		
-		endEffector = new EndEffector*[numOfEndEffectors];
-		endEffector[head] = new EndEffector(headBoneIndex, (IKMode)ikMode);
-		endEffector[hip] = new EndEffector(hipBoneIndex, (IKMode)ikMode);
-		endEffector[leftHand] = new EndEffector(leftHandBoneIndex, (IKMode)ikMode);
-		endEffector[leftForeArm] = new EndEffector(leftForeArmBoneIndex, (IKMode)ikMode);
-		endEffector[rightHand] = new EndEffector(rightHandBoneIndex, (IKMode)ikMode);
-		endEffector[rightForeArm] = new EndEffector(rightForeArmBoneIndex, (IKMode)ikMode);
-		endEffector[leftFoot] = new EndEffector(leftFootBoneIndex, (IKMode)ikMode);
-		endEffector[rightFoot] = new EndEffector(rightFootBoneIndex, (IKMode)ikMode);
-		endEffector[leftKnee] = new EndEffector(leftLegBoneIndex, (IKMode)ikMode);
-		endEffector[rightKnee] = new EndEffector(rightLegBoneIndex, (IKMode)ikMode);
-		initTransAndRot();
+		if (!ikThread) initIKParameters();
+		
+		bodyTracker = new BodyTracker(avatar, logger, (IKMode)ikMode);
+		endEffector = bodyTracker->endEffector;
+		
+		// Allocate the poses before the tracking thread starts and show the T-Pose until the first frame is solved
+		for (int i = 0; i < 3; ++i) poseBuffer.slot(i).finalTransform.resize(avatar->pose.boneCount + 1);
+		publishPose(System::time());
+		consumePose();
+		
+		if (logFrameTiming) logger->startTimingLogger("frameTiming");
 		
 #ifdef KORE_STEAMVR
 		VrInterface::init(nullptr, nullptr, nullptr); // TODO: Remove
@@ -995,7 +1063,22 @@ int kickstart(int argc, char** argv) {
 	startRecordingSound = new Sound("sound/start.wav");
 	stopRecordingSound = new Sound("sound/stop.wav");
 	
+	if (ikThread) {
+		trackingRunning = true;
+		trackingThread = std::thread(trackingLoop);
+	}
+	
 	System::start();
 	
+	if (ikThread) {
+		trackingRunning = false;
+		trackingThread.join();
+	}
+	
+	if (logFrameTiming) {
+		logger->endTimingLogger();
+		if (renderedPoses > 0) Kore::log(Info, "Tracker to render latency: mean %f ms, max %f ms over %i poses", latencySum / renderedPoses * 1000.0, latencyMax * 1000.0, renderedPoses);
+	}
+	
 	return 0;
 }
@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	if (mapped == nullptr) return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+#else
+	munmap(mapped, mappedSize);
+#endif
+}
+
+// The handles can be closed right away, the view keeps the file open
+bool MappedFile::map(const char* filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) return false;
+	
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == nullptr) return false;
+	
+	mapped = static_cast<char*>(view);
+	mappedSize = (size_t)fileSize.QuadPart;
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0) return false;
+	
+	struct stat info;
+	void* view = MAP_FAILED;
+	if (fstat(file, &info) == 0 && info.st_size > 0) view = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	close(file);
+	if (view == MAP_FAILED) return false;
+	
+	mapped = static_cast<char*>(view);
+	mappedSize = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+bool MappedFile::getFileInfo(const char* filename, uint64_t& size, int64_t& time) {
+	struct stat info;
+	if (stat(filename, &info) != 0) return false;
+	size = (uint64_t)info.st_size;
+	time = (int64_t)info.st_mtime;
+	return true;
+}
+
+bool MappedFile::replaceFile(const char* filename, const void* data, size_t size, const void* moreData, size_t moreSize) {
+	// One temporary file per thread, writers of the same file do not truncate each other's
+	std::string temporary = std::string(filename) + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::ofstream file(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	file.write(static_cast<const char*>(data), size);
+	if (moreSize > 0) file.write(static_cast<const char*>(moreData), moreSize);
+	file.close();
+	
+#ifdef _WIN32
+	bool replaced = file && MoveFileExA(temporary.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool replaced = file && std::rename(temporary.c_str(), filename) == 0;
+#endif
+	if (!replaced) std::remove(temporary.c_str());
+	return replaced;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A whole file mapped into memory with a private copy-on-write mapping: the pages are shared with the page cache and
+// loaded on first access, so mapping a large file costs nothing up front. Writes through data() stay in this process.
+class MappedFile {
+	
+public:
+	MappedFile() {}
+	~MappedFile();
+	
+	// false if the file does not exist or is empty
+	bool map(const char* filename);
+	
+	char* data() const { return mapped; }
+	size_t size() const { return mappedSize; }
+	
+	// Size and modification time of a file, to tell whether a file derived from it is out of date
+	static bool getFileInfo(const char* filename, uint64_t& size, int64_t& time);
+	
+	// Writes data and then moreData to a temporary file next to filename and renames it over filename, so a reader never
+	// maps a partly written file and a mapping of the old file stays valid. Several threads may write the same file,
+	// the last rename wins. false if the file could not be written or replaced, e.g. on Windows while it is mapped.
+	static bool replaceFile(const char* filename, const void* data, size_t size, const void* moreData = nullptr, size_t moreSize = 0);
+	
+private:
+	char* mapped = nullptr;
+	size_t mappedSize = 0;
+	
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
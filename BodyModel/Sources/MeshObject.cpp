@@ -3,9 +3,14 @@
 
 #include <Kore/IO/FileReader.h>
 #include <Kore/Log.h>
+#include <Kore/System.h>
 
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
 
 using namespace Kore;
 using namespace Kore::Graphics4;
@@ -78,6 +83,81 @@ namespace {
 		}
 	}
 	
+	// Influences below this fraction of the total weight of a vertex are dropped
+	const float minInfluenceWeight = 1.0f / 256.0f;
+	
+	// Converts the variable number of influences per vertex into Mesh::maxInfluences influences with 8 bit indices and
+	// 16 bit weights: keeps the largest influences, drops the tiny ones and renormalises the rest. False if a bone does
+	// not fit into the 8 bit indices.
+	bool setInfluences(Mesh* mesh) {
+		const int maxInfluences = Mesh::maxInfluences;
+		
+		// The skinning matrices count from the dummy parent of the root bone
+		for (int i = 0; i < mesh->boneIndexCount; ++i) {
+			if (mesh->boneIndices[i] + 1 > 255) {
+				log(Error, "Mesh %i is skinned to bone %i, the 8 bit influences hold at most 254 bones", mesh->meshIndex, mesh->boneIndices[i]);
+				return false;
+			}
+		}
+		
+		mesh->influenceBones = new unsigned_int8[mesh->numVertices * maxInfluences];
+		mesh->influenceWeights = new unsigned_int16[mesh->numVertices * maxInfluences];
+		mesh->maxWeightError = 0.0f;
+		
+		std::vector<int> order;
+		int currentBoneIndex = 0;
+		int dropped = 0;
+		for (int i = 0; i < mesh->numVertices; ++i) {
+			int count = mesh->boneCountArray[i];
+			const unsigned_int16* bones = &mesh->boneIndices[currentBoneIndex];
+			const float* weights = &mesh->boneWeight[currentBoneIndex];
+			currentBoneIndex += count;
+			
+			// The largest influences first
+			order.resize(count);
+			float total = 0.0f;
+			for (int b = 0; b < count; ++b) {
+				order[b] = b;
+				total += weights[b];
+			}
+			int candidates = Kore::min(count, maxInfluences);
+			std::partial_sort(order.begin(), order.begin() + candidates, order.end(), [weights](int a, int b) { return weights[a] > weights[b]; });
+			
+			int kept = 0;
+			float keptTotal = 0.0f;
+			while (kept < candidates && (kept == 0 || weights[order[kept]] >= minInfluenceWeight * total)) keptTotal += weights[order[kept++]];
+			dropped += count - kept;
+			if (keptTotal <= 0.0f) kept = 0;
+			
+			// Round to 16 bit, the largest weight takes the rounding error so that the weights sum to 65535 exactly
+			unsigned_int8* influenceBones = &mesh->influenceBones[i * maxInfluences];
+			unsigned_int16* influenceWeights = &mesh->influenceWeights[i * maxInfluences];
+			int sum = 0;
+			for (int k = 0; k < maxInfluences; ++k) {
+				influenceBones[k] = 0;
+				influenceWeights[k] = 0;
+				if (k >= kept) continue;
+				
+				influenceBones[k] = (unsigned_int8)(bones[order[k]] + 1);
+				influenceWeights[k] = (unsigned_int16)(weights[order[k]] / keptTotal * 65535.0f + 0.5f);
+				sum += influenceWeights[k];
+			}
+			if (kept > 0) influenceWeights[0] = (unsigned_int16)(influenceWeights[0] + 65535 - sum);
+			
+			// Against the original weights normalised by their total
+			float error = 0.0f;
+			for (int k = 0; k < count; ++k) {
+				float original = total > 0.0f ? weights[order[k]] / total : 0.0f;
+				float converted = k < kept ? influenceWeights[k] / 65535.0f : 0.0f;
+				error += Kore::abs(converted - original);
+			}
+			mesh->maxWeightError = Kore::max(mesh->maxWeightError, error);
+		}
+		
+		log(Info, "Skin of mesh %i: %i vertices, %i influences dropped, max weight error %f", mesh->meshIndex, mesh->numVertices, dropped, mesh->maxWeightError);
+		return true;
+	}
+	
 	template <typename T>
 	void cloneArray(const T* source, int size, T** dest) {
 		*dest = new T[size];
@@ -99,6 +179,14 @@ namespace {
 		}
 	}
 	
+	// The names of the structures die with the OpenGEX tree at the end of MeshObject::ConvertObj
+	char* cloneString(const char* from) {
+		int length = (int)strlen(from) + 1;
+		char* to = new char[length]();
+		copyString(from, to, length);
+		return to;
+	}
+	
 	mat4 getMatrix4x4(const float* matrix) {
 		mat4 mat = mat4::Identity();
 		for (int i = 0; i < 4; ++i) {
@@ -117,18 +205,57 @@ namespace {
 		return vec;
 	}
 	
+	// Runs task(0) to task(count - 1) on up to one thread per core, the calling thread is one of them
+	template <typename F>
+	void parallelFor(int count, const F& task) {
+		int threadCount = Kore::min(Kore::max((int)std::thread::hardware_concurrency(), 1), count);
+		std::atomic<int> next(0);
+		auto work = [&]() {
+			for (int i = next++; i < count; i = next++) task(i);
+		};
+		
+		std::vector<std::thread> workers;
+		for (int t = 1; t < threadCount; ++t) workers.push_back(std::thread(work));
+		work();
+		for (std::thread& worker : workers) worker.join();
+	}
+	
+	float millisecondsSince(double startTime) {
+		return (float)(System::time() - startTime) * 1000.0f;
+	}
+	
 }
 
-MeshObject::MeshObject(const char* meshFile, const char* textureFile, const VertexStructure& structure, float scale) : textureDir(textureFile), structure(structure), scale(scale), M(mat4::Identity()) {
+MeshObject::MeshObject(const char* meshFile, const char* textureFile, const VertexStructure& structure, float scale) : textureDir(textureFile), structure(&structure), meshesCount(0), scale(scale), M(mat4::Identity()) {
 	
 	LoadObj(meshFile);
 	
-	meshesCount = meshes.size();
-	log(Info, "Meshes length %i, geometry length %i, material length %i", meshesCount, geometries.size(), materials.size());
+	// Every texture file is decoded once, on all cores. Only the uploads need the graphics thread.
+	double startTime = System::time();
+	std::vector<std::string> textureFiles;
+	std::vector<int> meshTexture(meshesCount, -1);
+	for (int j = 0; j < meshesCount; ++j) {
+		Material* material = findMaterialWithIndex(geometries[j]->materialIndex);
+		if (material == nullptr || material->textureName == nullptr) continue;
+		
+		std::string textureFile = std::string(textureDir) + material->textureName;
+		meshTexture[j] = (int)(std::find(textureFiles.begin(), textureFiles.end(), textureFile) - textureFiles.begin());
+		if (meshTexture[j] == (int)textureFiles.size()) textureFiles.push_back(textureFile);
+	}
 	
-	std::sort(meshes.begin(), meshes.end(), CompareMesh());
-	std::sort(geometries.begin(), geometries.end(), CompareGeometry());
-	std::sort(materials.begin(), materials.end(), CompareMaterials());
+	std::vector<Kore::Image*> decoded(textureFiles.size());
+	parallelFor((int)textureFiles.size(), [&](int i) {
+		decoded[i] = new Kore::Image(textureFiles[i].c_str(), true);
+	});
+	float decodeTime = millisecondsSince(startTime);
+	
+	startTime = System::time();
+	std::vector<Texture*> textures(textureFiles.size());
+	for (size_t i = 0; i < textureFiles.size(); ++i) {
+		log(Info, "Load Texture %s", textureFiles[i].c_str());
+		// A readable texture keeps pointing at the pixels of the image, which therefore stays alive like the texture
+		textures[i] = new Texture(decoded[i]->data, decoded[i]->width, decoded[i]->height, decoded[i]->format, true);
+	}
 	
 	vertexBuffers = new VertexBuffer*[meshesCount];
 	indexBuffers = new IndexBuffer*[meshesCount];
@@ -139,15 +266,7 @@ MeshObject::MeshObject(const char* meshFile, const char* textureFile, const Vert
 		Geometry* geometry = geometries[j];
 		unsigned int materialIndex = geometry->materialIndex;
 		Material* material = findMaterialWithIndex(materialIndex);
-		images[j] = nullptr;
-		if (material != nullptr && material->textureName != nullptr) {
-			char temp[200];
-			std::strcpy(temp, textureDir);
-			std::strcat(temp, material->textureName);
-			log(Info, "Load Texture %s", temp);
-			Texture* image = new Texture(temp, true);
-			images[j] = image;
-		}
+		images[j] = meshTexture[j] >= 0 ? textures[meshTexture[j]] : nullptr;
 		
 		// Mesh Vertex Buffer
 		vertexBuffers[j] = new VertexBuffer(mesh->numVertices, structure);
@@ -163,6 +282,13 @@ MeshObject::MeshObject(const char* meshFile, const char* textureFile, const Vert
 		
 	}
 	
+	log(Info, "Textures of %s: %i files decoded in %f ms, textures and %i meshes uploaded in %f ms", meshFile, (int)textureFiles.size(), decodeTime, (int)meshesCount, millisecondsSince(startTime));
+}
+
+MeshObject::MeshObject(const char* meshFile, float scale) : textureDir(nullptr), structure(nullptr), meshesCount(0), scale(scale), M(mat4::Identity()), vertexBuffers(nullptr), indexBuffers(nullptr), images(nullptr) {
+	
+	LoadObj(meshFile);
+	
 }
 
 void MeshObject::render(TextureUnit tex) {
@@ -177,35 +303,69 @@ void MeshObject::render(TextureUnit tex) {
 }
 
 void MeshObject::LoadObj(const char* filename) {
+	double startTime = System::time();
+	cookedFile = CookedFile::load(filename, *this);
+	if (cookedFile == nullptr) {
+		if (!ConvertObj(filename)) return;
+		CookedFile::save(filename, *this);
+	}
+	
+	meshesCount = meshes.size();
+	log(Info, "Meshes length %i, geometry length %i, material length %i, loaded in %f ms", meshesCount, geometries.size(), materials.size(), millisecondsSince(startTime));
+}
+
+bool MeshObject::ConvertObj(const char* filename) {
 	FileReader fileReader(filename, FileReader::Asset);
 	void* data = fileReader.readAll();
 	int size = fileReader.size();
 	char* buffer = new char[size + 1];
-	for (int i = 0; i < size; ++i) buffer[i] = reinterpret_cast<char*>(data)[i];
+	std::memcpy(buffer, data, size);
 	buffer[size] = 0;
 	
+	double startTime = System::time();
 	OGEX::OpenGexDataDescription openGexDataDescription;
 	DataResult result = openGexDataDescription.ProcessText(buffer);
+	float parseTime = millisecondsSince(startTime);
 	if (result == kDataOkay) {
+		startTime = System::time();
 		ConvertObjects(*openGexDataDescription.GetRootStructure());
-		BoneNode* bone = new BoneNode();
-		ConvertNodes(*openGexDataDescription.GetRootStructure(), *bone);
+		float objectTime = millisecondsSince(startTime);
+		
+		// A mesh that could not be converted would be drawn and skinned wrongly, the whole file is rejected
+		if (std::find(meshes.begin(), meshes.end(), nullptr) != meshes.end()) {
+			log(Error, "Could not convert the meshes of %s", filename);
+			delete[] buffer;
+			return false;
+		}
+		
+		startTime = System::time();
+		int boneCount = CountBoneNodes(*openGexDataDescription.GetRootStructure());
+		pose.allocate(boneCount);
+		BoneNode* bone = new BoneNode(pose, boneCount); // Dummy parent of the root bone
+		ConvertNodes(*openGexDataDescription.GetRootStructure(), *bone, -1);
+		
+		std::sort(meshes.begin(), meshes.end(), CompareMesh());
+		std::sort(geometries.begin(), geometries.end(), CompareGeometry());
+		std::sort(materials.begin(), materials.end(), CompareMaterials());
+		log(Info, "Converted %s: parsed in %f ms, objects in %f ms, nodes in %f ms", filename, parseTime, objectTime, millisecondsSince(startTime));
 	} else {
 		log(Info, "Failed to load OpenGEX file");
 	}
 	
 	delete[] buffer;
+	return result == kDataOkay;
 }
 
 void MeshObject::ConvertObjects(const Structure& rootStructure) {
+	// The geometry objects are independent of each other and converted in parallel after the walk
+	std::vector<const OGEX::GeometryObjectStructure*> geometryObjects;
+	
 	const Structure* structure = rootStructure.GetFirstSubnode();
 	while (structure) {
 		switch (structure->GetStructureType()) {
-			case OGEX::kStructureGeometryObject: {
-				Mesh* mesh = ConvertGeometryObject(static_cast<const OGEX::GeometryObjectStructure&>(*structure));
-				meshes.push_back(mesh);
+			case OGEX::kStructureGeometryObject:
+				geometryObjects.push_back(static_cast<const OGEX::GeometryObjectStructure*>(structure));
 				break;
-			}
 				
 			case OGEX::kStructureLightObject:
 				break;
@@ -226,9 +386,33 @@ void MeshObject::ConvertObjects(const Structure& rootStructure) {
 		
 		structure = structure->Next();
 	}
+	
+	size_t first = meshes.size();
+	meshes.resize(first + geometryObjects.size());
+	parallelFor((int)geometryObjects.size(), [&](int i) {
+		meshes[first + i] = ConvertGeometryObject(*geometryObjects[i]);
+	});
+}
+
+int MeshObject::CountBoneNodes(const Structure& rootStructure) {
+	int count = 0;
+	const Structure* structure = rootStructure.GetFirstSubnode();
+	while (structure) {
+		switch (structure->GetStructureType()) {
+			case OGEX::kStructureNode:
+			case OGEX::kStructureBoneNode:
+				count += 1 + CountBoneNodes(*structure);
+				break;
+				
+			default:
+				break;
+		}
+		structure = structure->Next();
+	}
+	return count;
 }
 
-void MeshObject::ConvertNodes(const Structure& rootStructure, BoneNode& parentNode) {
+void MeshObject::ConvertNodes(const Structure& rootStructure, BoneNode& parentNode, int parentIndex) {
 	
 	const Structure* structure = rootStructure.GetFirstSubnode();
 	while (structure) {
@@ -239,11 +423,13 @@ void MeshObject::ConvertNodes(const Structure& rootStructure, BoneNode& parentNo
 				//return ConvertNode(static_cast<const OGEX::NodeStructure&>(structure));
 				
 			case OGEX::kStructureBoneNode: {
+				int index = (int)bones.size();
 				BoneNode* bone = ConvertBoneNode(static_cast<const OGEX::BoneNodeStructure&>(nodeStructure));
 				bone->parent = &parentNode;
+				pose.parent[index] = parentIndex;
 				bones.push_back(bone);
 				
-				ConvertNodes(*structure, *bone);
+				ConvertNodes(*structure, *bone, index);
 				
 				break;
 			}
@@ -374,6 +560,8 @@ Mesh* MeshObject::ConvertMesh(const OGEX::MeshStructure& structure, const char*
 				//setBoneIndices(mesh, boneIndexCount, indices);
 				//log(Info, "Bone Index Count %i", boneIndexCount);
 				
+				if (!setInfluences(mesh)) return nullptr;
+				
 				break;
 			}
 				
@@ -389,7 +577,7 @@ Mesh* MeshObject::ConvertMesh(const OGEX::MeshStructure& structure, const char*
 Geometry* MeshObject::ConvertGeometryNode(const OGEX::GeometryNodeStructure& structure) {
 	Geometry* geometry = new Geometry();
 	
-	geometry->name = structure.GetNodeName();
+	geometry->name = cloneString(structure.GetNodeName());
 	//log(Info, "Geometry name %s", name);
 	
 	const Structure *subStructure = structure.GetFirstSubnode();
@@ -407,7 +595,7 @@ Geometry* MeshObject::ConvertGeometryNode(const OGEX::GeometryNodeStructure& str
 				const OGEX::MaterialRefStructure& materialRefStructure = *static_cast<const OGEX::MaterialRefStructure *>(subStructure);
 				const Structure* subSubStructure = materialRefStructure.GetTargetStructure();
 				
-				geometry->materialRef = subSubStructure->GetStructureName();
+				geometry->materialRef = cloneString(subSubStructure->GetStructureName());
 				geometry->materialIndex = getIndexFromString(geometry->materialRef, 8);
 				break;
 			}
@@ -416,7 +604,7 @@ Geometry* MeshObject::ConvertGeometryNode(const OGEX::GeometryNodeStructure& str
 				const OGEX::ObjectRefStructure& objectRefStructure = *static_cast<const OGEX::ObjectRefStructure *>(subStructure);
 				const Structure* subSubStructure = objectRefStructure.GetTargetStructure();
 				
-				geometry->objectRef = subSubStructure->GetStructureName();
+				geometry->objectRef = cloneString(subSubStructure->GetStructureName());
 				geometry->geometryIndex = getIndexFromString(geometry->objectRef, 8);
 				
 				break;
@@ -527,7 +715,7 @@ Material* MeshObject::findMaterialWithIndex(const int index) {
 }
 
 BoneNode* MeshObject::ConvertBoneNode(const OGEX::BoneNodeStructure& structure) {
-	BoneNode* bone = new BoneNode();
+	BoneNode* bone = new BoneNode(pose, (int)bones.size());
 	
 	const char* name = structure.GetNodeName();
 	int length = (int)strlen(name) + 1;
@@ -582,7 +770,7 @@ Light* MeshObject::ConvertLightNode(const OGEX::LightNodeStructure& structure) {
 	Light* light = new Light();
 	
 	const char* name = structure.GetNodeName();
-	light->name = name;
+	light->name = cloneString(name);
 	
 	std::string lightName(name);
 	if (lightName.compare("Spot") == 0) {
@@ -614,6 +802,33 @@ Light* MeshObject::ConvertLightNode(const OGEX::LightNodeStructure& structure) {
 	return light;
 }
 
+void SkeletonPose::allocate(int count) {
+	boneCount = count;
+	
+	// One extra slot for the dummy parent of the root bone
+	parent = new int[count + 1];
+	initialized = new bool[count + 1];
+	bind = new mat4[count + 1];
+	transform = new mat4[count + 1];
+	local = new mat4[count + 1];
+	combined = new mat4[count + 1];
+	combinedInv = new mat4[count + 1];
+	finalTransform = new mat4[count + 1];
+	rotation = new Kore::Quaternion[count + 1];
+	
+	for (int i = 0; i <= count; ++i) {
+		parent[i] = -1;
+		initialized[i] = false;
+		bind[i] = mat4::Identity();
+		transform[i] = mat4::Identity();
+		local[i] = mat4::Identity();
+		combined[i] = mat4::Identity();
+		combinedInv[i] = mat4::Identity();
+		finalTransform[i] = mat4::Identity();
+		rotation[i] = Kore::Quaternion(0, 0, 0, 1);
+	}
+}
+
 void MeshObject::setScale(float scaleFactor) {
 	// Scale root bone
 	BoneNode* root = bones[0];
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "CookedFile.h"
 #include "OpenGEX/OpenGEX.h"
 #include "RotationUtility.h"
+#include "SimdMath.h"
 
 #include <Kore/Graphics4/Graphics.h>
 #include <Kore/Math/Quaternion.h>
@@ -28,6 +30,14 @@ struct Mesh {
 	float* boneWeight;
 	int weightCount;
 	
+	// Skin converted by the loader into a fixed number of influences per vertex for the skinning: the index of the
+	// skinning matrix (SkeletonPose::finalTransform) and its weight, the weights of a vertex sum to 65535. Unused
+	// influences have weight 0.
+	static const int maxInfluences = 4;
+	unsigned_int8* influenceBones;
+	unsigned_int16* influenceWeights;
+	float maxWeightError;	// Largest sum of the absolute weight changes of a vertex by the conversion
+	
 	unsigned int meshIndex;
 };
 
@@ -77,21 +87,51 @@ struct CompareMaterials {
 	}
 };
 
+// Hot per-bone data of a skeleton in contiguous arrays, sorted parent before child (same order as MeshObject::bones).
+// The last slot belongs to the uninitialized dummy parent of the root bone.
+struct SkeletonPose {
+	int boneCount = 0;
+	int* parent = nullptr;		// Index of the parent bone, -1 for the root
+	bool* initialized = nullptr;
+	
+	Kore::mat4* bind = nullptr;
+	Kore::mat4* transform = nullptr;
+	Kore::mat4* local = nullptr;
+	Kore::mat4* combined = nullptr;
+	Kore::mat4* combinedInv = nullptr;
+	Kore::mat4* finalTransform = nullptr;
+	
+	Kore::Quaternion* rotation = nullptr;	// local rotation
+	
+	void allocate(int count);
+	
+	// Forward kinematics for the bones [begin, end) in a single linear sweep
+	void updateCombined(int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			int p = parent[i];
+			if (p >= 0 && initialized[p])
+				Kore::SimdMath::multiply(combined[p], local[i], combined[i]);
+		}
+	}
+};
+
+// View on one slot of a SkeletonPose plus the cold data of the bone
 struct BoneNode {
 	char* boneName;
 	int nodeIndex;
 	int nodeDepth;
 	BoneNode* parent;
 	
-	Kore::mat4 bind;
-	Kore::mat4 transform;
-	Kore::mat4 local;
-	Kore::mat4 combined, combinedInv;
-	Kore::mat4 finalTransform;
+	Kore::mat4& bind;
+	Kore::mat4& transform;
+	Kore::mat4& local;
+	Kore::mat4& combined;
+	Kore::mat4& combinedInv;
+	Kore::mat4& finalTransform;
 	
-	Kore::Quaternion rotation;	// local rotation
+	Kore::Quaternion& rotation;	// local rotation
 	
-	bool initialized = false;
+	bool& initialized;
 	
 	std::vector<Kore::mat4> aniTransformations;
 	
@@ -99,27 +139,24 @@ struct BoneNode {
 	Kore::vec3 axes;
 	std::map<const char* const, float> constrain;	// <min, max>
 	
-	BoneNode() :
-		transform(Kore::mat4::Identity()),
-		local(Kore::mat4::Identity()),
-		combined(Kore::mat4::Identity()),
-		combinedInv(Kore::mat4::Identity()),
-		finalTransform(Kore::mat4::Identity()),
-		rotation(Kore::Quaternion(0, 0, 0, 1)),
+	BoneNode(SkeletonPose& pose, int poseIndex) :
+		parent(nullptr),
+		bind(pose.bind[poseIndex]),
+		transform(pose.transform[poseIndex]),
+		local(pose.local[poseIndex]),
+		combined(pose.combined[poseIndex]),
+		combinedInv(pose.combinedInv[poseIndex]),
+		finalTransform(pose.finalTransform[poseIndex]),
+		rotation(pose.rotation[poseIndex]),
+		initialized(pose.initialized[poseIndex]),
 		axes(Kore::vec3(0, 0, 0))
 	{}
 	
 	Kore::vec3 getPosition() {
-		Kore::vec3 result;
-		
-		Kore::vec4 pos = combined * Kore::vec4(0, 0, 0, 1);
-		pos *= 1.0 / pos.w();
+		// combined * (0, 0, 0, 1) is the translation column
+		float w = 1.0 / combined.get(3, 3);
 		
-		result.x() = pos.x();
-		result.y() = pos.y();
-		result.z() = pos.z();
-		
-		return result;
+		return Kore::vec3(combined.get(0, 3) * w, combined.get(1, 3) * w, combined.get(2, 3) * w);
 	}
 	
 	Kore::Quaternion getOrientation() {
@@ -139,6 +176,7 @@ struct CompareBones {
 class MeshObject {
 public:
 	MeshObject(const char* meshFile, const char* textureFile, const Kore::Graphics4::VertexStructure& structure, float scale = 1.0f);
+	MeshObject(const char* meshFile, float scale = 1.0f); // Headless: loads meshes and skeleton without creating GPU resources
 	void render(Kore::Graphics4::TextureUnit tex);
 	
 	void setScale(float scaleFactor);
@@ -147,7 +185,7 @@ public:
 	
 	long meshesCount;
 	float scale;
-	const Kore::Graphics4::VertexStructure& structure;
+	const Kore::Graphics4::VertexStructure* structure;
 	Kore::Graphics4::VertexBuffer** vertexBuffers;
 	Kore::Graphics4::IndexBuffer** indexBuffers;
 	
@@ -161,10 +199,18 @@ public:
 	std::vector<BoneNode*> children;
 	std::vector<Light*> lights;
 	
+	SkeletonPose pose;
+	
 	Material* findMaterialWithIndex(const int index);
 	
 private:
+	CookedFile* cookedFile = nullptr;	// Mapped cache the meshes point into, nullptr if they were converted from the .ogex
+	
+	// Loads the cooked cache of the file if it is up to date, otherwise converts the file and writes the cache
 	void LoadObj(const char* filename);
+	bool ConvertObj(const char* filename);
+	
+	int CountBoneNodes(const Structure& structure);
 	
 	void ConvertObjects(const Structure& structure);
 	Mesh* ConvertGeometryObject(const OGEX::GeometryObjectStructure& structure);
@@ -172,7 +218,7 @@ private:
 	
 	Material* ConvertMaterial(const OGEX::MaterialStructure& structure);
 	
-	void ConvertNodes(const Structure& structure, BoneNode& parentNode);
+	void ConvertNodes(const Structure& structure, BoneNode& parentNode, int parentIndex);
 	Geometry* ConvertGeometryNode(const OGEX::GeometryNodeStructure& structure);
 	BoneNode* ConvertBoneNode(const OGEX::BoneNodeStructure& structure);
 	
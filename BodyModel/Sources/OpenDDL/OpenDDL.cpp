@@ -43,8 +43,18 @@
 	POSSIBILITY OF SUCH DAMAGE.
 */
 
+/*
+	Modified for BodyTracking: decimal float and double literals are parsed into an exact decimal significand and
+	converted with a correctly rounded fast path (Data::ReadDecimalFloat), and the common cases of
+	Data::GetWhitespaceLength are inline (OpenDDL.h).
+*/
+
 
 #include "OpenDDL.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 using namespace ODDL;
@@ -83,11 +93,41 @@ namespace ODDL
 		DataResult ReadOctalLiteral(const char *text, int32 *textLength, unsigned_int64 *value);
 		DataResult ReadBinaryLiteral(const char *text, int32 *textLength, unsigned_int64 *value);
 		bool ParseSign(const char *& text);
+
+		enum
+		{
+			kMaxDecimalFloatDigits = 768		// Longer literals are rounded with a final nonzero digit
+		};
+
+		// Decimal floating-point literal as read by ReadDecimalFloat, value = significand * 10^exponent
+		struct DecimalFloat
+		{
+			unsigned_int64		significand;		// The first 19 significant digits
+			int32				exponent;
+			bool				truncated;			// Nonzero digits beyond the first 19 were dropped
+
+			const char			*text;				// The digits of the literal without the exponent part
+			int32				digitTextLength;
+			int32				literalExponent;	// Value of the exponent part of the literal
+		};
+
+		const double powerOfTen[23] =
+		{
+			1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9, 1.0e10, 1.0e11,
+			1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18, 1.0e19, 1.0e20, 1.0e21, 1.0e22
+		};
+
+		const unsigned_int8 *ReadDigits(const unsigned_int8 *byte, unsigned_int64 *value);
+		DataResult ReadDecimalFloat(const char *text, int32 *textLength, DecimalFloat *value);
+		bool GetFastDouble(const DecimalFloat& value, double *result);
+		int32 GetExactDigits(const DecimalFloat& value, char *digits, int32 maxLength);
+		float GetFloat(const DecimalFloat& value);
+		double GetDouble(const DecimalFloat& value);
 	}
 }
 
 
-int32 Data::GetWhitespaceLength(const char *text)
+int32 Data::GetWhitespaceLengthGeneral(const char *text)
 {
 	const unsigned_int8 *byte = reinterpret_cast<const unsigned_int8 *>(text);
 	for (;;)
@@ -1211,134 +1251,15 @@ DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, float *
 		}
 	}
 
-	float v = 0.0F;
-	bool separator = false;
-	for (;;)
-	{
-		unsigned_int32 x = byte[0] - '0';
-		if (x < 10U)
-		{
-			v = v * 10.0F + (float) x;
-			separator = true;
-		}
-		else
-		{
-			if ((x != 47) || (!separator))
-			{
-				break;
-			}
-
-			separator = false;
-		}
-
-		byte++;
-	}
-
-	if (!separator)
-	{
-		return (kDataSyntaxError);
-	}
-
-	c = byte[0];
-	if (c == '.')
-	{
-		byte++;
-
-		float decimal = 10.0F;
-		separator = false;
-		for (;;)
-		{
-			unsigned_int32 x = byte[0] - '0';
-			if (x < 10U)
-			{
-				v += (float) x / decimal;
-				decimal *= 10.0F;
-				separator = true;
-			}
-			else
-			{
-				if ((x != 47) || (!separator))
-				{
-					break;
-				}
-
-				separator = false;
-			}
+	DecimalFloat	decimal;
 
-			byte++;
-		}
-
-		if (!separator)
-		{
-			return (kDataSyntaxError);
-		}
-
-		c = byte[0];
-	}
-
-	if ((c == 'e') || (c == 'E'))
+	DataResult result = ReadDecimalFloat(text, textLength, &decimal);
+	if (result == kDataOkay)
 	{
-		bool negative = false;
-
-		c = (++byte)[0];
-		if (c == '-')
-		{
-			negative = true;
-			byte++;
-		}
-		else if (c == '+')
-		{
-			byte++;
-		}
-		else if (c - '0' >= 10U)
-		{
-			return (kDataFloatInvalid);
-		}
-
-		int32 exponent = 0;
-		bool digit = false;
-		separator = false;
-		for (;;)
-		{
-			unsigned_int32 x = byte[0] - '0';
-			if (x < 10U)
-			{
-				exponent = Min(exponent * 10 + x, 65535);
-				digit = true;
-				separator = true;
-			}
-			else
-			{
-				if ((x != 47) || (!separator))
-				{
-					break;
-				}
-
-				separator = false;
-			}
-
-			byte++;
-		}
-
-		if ((!digit) || (!separator))
-		{
-			return (kDataSyntaxError);
-		}
-
-		if (exponent != 0)
-		{
-			if (negative)
-			{
-				exponent = -exponent;
-			}
-
-			v *= (float) exp((float) exponent * 2.3025850929940456840179914546844F);
-		}
+		*value = GetFloat(decimal);
 	}
 
-	*value = v;
-	*textLength = (int32) (reinterpret_cast<const char *>(byte) - text);
-	return (kDataOkay);
+	return (result);
 }
 
 DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, double *value)
@@ -1393,46 +1314,111 @@ DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, double
 		}
 	}
 
-	double v = 0.0;
-	bool separator = false;
+	DecimalFloat	decimal;
+
+	DataResult result = ReadDecimalFloat(text, textLength, &decimal);
+	if (result == kDataOkay)
+	{
+		*value = GetDouble(decimal);
+	}
+
+	return (result);
+}
+
+inline const unsigned_int8 *Data::ReadDigits(const unsigned_int8 *byte, unsigned_int64 *value)
+{
+	// Two digits per step halve the chain of dependent multiplications. Overflows beyond 19 digits.
+
+	unsigned_int64 v = *value;
 	for (;;)
 	{
 		unsigned_int32 x = byte[0] - '0';
-		if (x < 10U)
+		if (x >= 10U)
 		{
-			v = v * 10.0 + (double) x;
-			separator = true;
+			break;
 		}
-		else
-		{
-			if ((x != 47) || (!separator))
-			{
-				break;
-			}
 
-			separator = false;
+		unsigned_int32 y = byte[1] - '0';
+		if (y >= 10U)
+		{
+			v = v * 10 + x;
+			byte++;
+			break;
 		}
 
+		v = v * 100 + x * 10 + y;
+		byte += 2;
+	}
+
+	*value = v;
+	return (byte);
+}
+
+DataResult Data::ReadDecimalFloat(const char *text, int32 *textLength, DecimalFloat *value)
+{
+	const unsigned_int8 *byte = reinterpret_cast<const unsigned_int8 *>(text);
+
+	unsigned_int64 significand = 0;
+	int32 exponent = 0;
+	bool truncated = false;
+
+	// Fast path for literals without digit separators and with at most 19 significant digits,
+	// which is every literal the OpenGEX exporters write.
+
+	while (byte[0] == '0')
+	{
 		byte++;
 	}
 
-	if (!separator)
+	const unsigned_int8 *digits = byte;
+	byte = ReadDigits(byte, &significand);
+	int32 significantDigits = (int32) (byte - digits);
+	bool general = (byte == reinterpret_cast<const unsigned_int8 *>(text));
+
+	if (byte[0] == '.')
 	{
-		return (kDataSyntaxError);
+		const unsigned_int8 *fraction = ++byte;
+		if (significantDigits == 0)
+		{
+			while (byte[0] == '0')
+			{
+				byte++;
+			}
+		}
+
+		digits = byte;
+		byte = ReadDigits(byte, &significand);
+		significantDigits += (int32) (byte - digits);
+		exponent = (int32) (fraction - byte);
+		general |= (byte == fraction);
 	}
 
-	c = byte[0];
-	if (c == '.')
+	if ((general) || (significantDigits > 19) || (byte[0] == '_'))
 	{
-		double decimal = 10.0;
-		separator = false;
+		// General path: digit separators, more than 19 significant digits and syntax errors
+
+		byte = reinterpret_cast<const unsigned_int8 *>(text);
+		significand = 0;
+		significantDigits = 0;
+		exponent = 0;
+
+		bool separator = false;
 		for (;;)
 		{
 			unsigned_int32 x = byte[0] - '0';
 			if (x < 10U)
 			{
-				v += (double) x / decimal;
-				decimal *= 10.0;
+				if (significantDigits < 19)
+				{
+					significand = significand * 10 + x;
+					significantDigits += (significand != 0);
+				}
+				else
+				{
+					exponent++;
+					truncated |= (x != 0);
+				}
+
 				separator = true;
 			}
 			else
@@ -1453,9 +1439,55 @@ DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, double
 			return (kDataSyntaxError);
 		}
 
-		c = byte[0];
+		if (byte[0] == '.')
+		{
+			byte++;
+
+			separator = false;
+			for (;;)
+			{
+				unsigned_int32 x = byte[0] - '0';
+				if (x < 10U)
+				{
+					if (significantDigits < 19)
+					{
+						significand = significand * 10 + x;
+						significantDigits += (significand != 0);
+						exponent--;
+					}
+					else
+					{
+						truncated |= (x != 0);
+					}
+
+					separator = true;
+				}
+				else
+				{
+					if ((x != 47) || (!separator))
+					{
+						break;
+					}
+
+					separator = false;
+				}
+
+				byte++;
+			}
+
+			if (!separator)
+			{
+				return (kDataSyntaxError);
+			}
+		}
 	}
 
+	unsigned_int32 c = byte[0];
+
+	value->text = text;
+	value->digitTextLength = (int32) (reinterpret_cast<const char *>(byte) - text);
+	value->literalExponent = 0;
+
 	if ((c == 'e') || (c == 'E'))
 	{
 		bool negative = false;
@@ -1475,15 +1507,15 @@ DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, double
 			return (kDataFloatInvalid);
 		}
 
-		int32 exponent = 0;
+		int32 literalExponent = 0;
 		bool digit = false;
-		separator = false;
+		bool separator = false;
 		for (;;)
 		{
 			unsigned_int32 x = byte[0] - '0';
 			if (x < 10U)
 			{
-				exponent = Min(exponent * 10 + x, 65535);
+				literalExponent = Min(literalExponent * 10 + x, 65535);
 				digit = true;
 				separator = true;
 			}
@@ -1505,20 +1537,133 @@ DataResult Data::ReadFloatMagnitude(const char *text, int32 *textLength, double
 			return (kDataSyntaxError);
 		}
 
-		if (exponent != 0)
+		if (negative)
 		{
-			if (negative)
+			literalExponent = -literalExponent;
+		}
+
+		value->literalExponent = literalExponent;
+		exponent += literalExponent;
+	}
+
+	value->significand = significand;
+	value->exponent = exponent;
+	value->truncated = truncated;
+
+	*textLength = (int32) (reinterpret_cast<const char *>(byte) - text);
+	return (kDataOkay);
+}
+
+bool Data::GetFastDouble(const DecimalFloat& value, double *result)
+{
+	// Clinger's fast path: the significand and the power of ten are both exact doubles,
+	// so a single multiplication or division gives the correctly rounded result.
+
+	if (value.significand == 0)
+	{
+		*result = 0.0;
+		return (true);
+	}
+
+	if ((value.truncated) || (value.significand > 0x0020000000000000ULL) || (value.exponent < -22) || (value.exponent > 22))
+	{
+		return (false);
+	}
+
+	double v = (double) value.significand;
+	*result = (value.exponent < 0) ? v / powerOfTen[-value.exponent] : v * powerOfTen[value.exponent];
+	return (true);
+}
+
+int32 Data::GetExactDigits(const DecimalFloat& value, char *digits, int32 maxLength)
+{
+	// Writes the literal as "<digits>e<exponent>" without separators and decimal point, which strtod and strtof read
+	// the same way in every locale. Digits beyond maxLength only count as a final nonzero digit.
+
+	int32 length = 0;
+	int32 exponent = value.literalExponent;
+	bool fraction = false;
+	bool sticky = false;
+
+	const char *text = value.text;
+	for (machine a = 0; a < value.digitTextLength; a++)
+	{
+		char c = text[a];
+		if (c == '.')
+		{
+			fraction = true;
+		}
+		else if (c != '_')
+		{
+			if (length < maxLength - 16)
 			{
-				exponent = -exponent;
+				digits[length++] = c;
+				exponent -= fraction;
+			}
+			else
+			{
+				exponent += !fraction;
+				sticky |= (c != '0');
 			}
+		}
+	}
+
+	if (sticky)
+	{
+		digits[length++] = '1';
+		exponent--;
+	}
+
+	length += snprintf(&digits[length], 16, "e%d", exponent);
+	return (length);
+}
+
+float Data::GetFloat(const DecimalFloat& value)
+{
+	// The significand converts to double with an error of at most half an ulp and the power of ten is exact, so the
+	// product or quotient lies within two ulps of the exact value, also for more than 19 digits. Rounding it to float
+	// gives the correctly rounded result unless it lies that close to the halfway point between two floats, which the
+	// 29 bits below the float precision show for normal floats. Literals with up to 19 significant digits written by
+	// the exporters with 9 or 17 digits take this path, only the rest goes through strtof.
 
-			v *= exp((double) exponent * 2.3025850929940456840179914546844);
+	if (value.significand == 0)
+	{
+		return (0.0F);
+	}
+
+	if ((value.exponent >= -22) && (value.exponent <= 22))
+	{
+		double v = (double) value.significand;
+		v = (value.exponent < 0) ? v / powerOfTen[-value.exponent] : v * powerOfTen[value.exponent];
+		if ((v >= FLT_MIN) && (v <= FLT_MAX))
+		{
+			unsigned_int64 bits;
+			memcpy(&bits, &v, 8);
+
+			int32 halfway = (int32) (bits & 0x1FFFFFFF) - 0x10000000;
+			if ((halfway > 4) || (halfway < -4))
+			{
+				return ((float) v);
+			}
 		}
 	}
 
-	*value = v;
-	*textLength = (int32) (reinterpret_cast<const char *>(byte) - text);
-	return (kDataOkay);
+	char digits[kMaxDecimalFloatDigits + 16];
+	GetExactDigits(value, digits, kMaxDecimalFloatDigits + 16);
+	return (strtof(digits, nullptr));
+}
+
+double Data::GetDouble(const DecimalFloat& value)
+{
+	double v;
+	if (GetFastDouble(value, &v))
+	{
+		return (v);
+	}
+
+	char digits[kMaxDecimalFloatDigits + 16];
+	GetExactDigits(value, digits, kMaxDecimalFloatDigits + 16);
+	return (strtod(digits, nullptr));
 }
 
 bool Data::ParseSign(const char *& text)
@@ -143,7 +143,30 @@ namespace ODDL
 	{
 		extern const int8 identifierCharState[256];
 
-		int32 GetWhitespaceLength(const char *text);
+		int32 GetWhitespaceLengthGeneral(const char *text);
+
+		inline int32 GetWhitespaceLength(const char *text)
+		{
+			// Inline for no whitespace and a single space, which separate almost all values of large data arrays
+
+			const unsigned_int8 *byte = reinterpret_cast<const unsigned_int8 *>(text);
+			unsigned_int32 c = byte[0];
+			if ((c >= 33U) && (c != '/'))
+			{
+				return (0);
+			}
+
+			if (c == ' ')
+			{
+				c = byte[1];
+				if ((c >= 33U) && (c != '/'))
+				{
+					return (1);
+				}
+			}
+
+			return (GetWhitespaceLengthGeneral(text));
+		}
 		DataResult ReadDataType(const char *text, int32 *textLength, DataType *value);
 		DataResult ReadIdentifier(const char *text, int32 *textLength, char *restrict identifier = nullptr);
 		DataResult ReadStringLiteral(const char *text, int32 *textLength, int32 *stringLength, char *restrict string = nullptr);
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "Recording.h"
+#include "TakeReader.h"
+
+#include <Kore/Log.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace Kore;
+
+namespace {
+	
+	const char magic[4] = { 'B', 'T', 'R', 'C' };
+	
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t size;			// Of the whole file
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint32_t frameCount;
+		uint32_t frameSize;		// sizeof(RecordedFrame) of the writer
+		uint64_t frames;		// Offset of the frames from the start of the file
+	};
+	
+	bool endsWith(const char* string, const char* suffix) {
+		size_t length = std::strlen(string);
+		size_t suffixLength = std::strlen(suffix);
+		return length >= suffixLength && std::strcmp(string + length - suffixLength, suffix) == 0;
+	}
+	
+}
+
+Recording* Recording::load(const char* take) {
+	bool converted = false;
+	std::string filename = endsWith(take, ".rec") ? std::string(take) : getFileName(take);
+	while (true) {
+		Recording* recording = new Recording();
+		const char* problem = nullptr;
+		if (!recording->mapping.map(filename.c_str())) {
+			problem = "missing";
+		} else {
+			const Header* header = reinterpret_cast<const Header*>(recording->mapping.data());
+			size_t size = recording->mapping.size();
+			uint64_t sourceSize;
+			int64_t sourceTime;
+			if (size < sizeof(Header) || std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version || header->frameSize != sizeof(RecordedFrame)) {
+				problem = "in an old format";
+			} else if (header->size != size || header->frames < sizeof(Header) || header->frames > size || header->frameCount > (size - header->frames) / sizeof(RecordedFrame)) {
+				problem = "damaged";
+			} else if (filename != take && MappedFile::getFileInfo(take, sourceSize, sourceTime) && (sourceSize != header->sourceSize || sourceTime != header->sourceTime)) {
+				problem = "out of date";
+			} else {
+				recording->frames = reinterpret_cast<const RecordedFrame*>(recording->mapping.data() + header->frames);
+				recording->frameCount = (int)header->frameCount;
+			}
+		}
+		
+		if (problem == nullptr) {
+			log(Info, "Loaded recording %s, %i frames", filename.c_str(), recording->frameCount);
+			return recording;
+		}
+		
+		delete recording;
+		if (converted || filename == take) {
+			log(Error, "Recording %s is %s", filename.c_str(), problem);
+			return nullptr;
+		}
+		
+		// Only once, a recording that is still not valid after the conversion stays invalid. The recording is mapped again
+		// even if this conversion failed, another thread may have written it in the meantime.
+		log(Info, "Recording %s is %s, converting %s", filename.c_str(), problem, take);
+		convert(take);
+		converted = true;
+	}
+}
+
+bool Recording::convert(const char* take) {
+	TakeReader* reader = TakeReader::open(take);
+	if (reader == nullptr) {
+		log(Error, "Could not find file %s", take);
+		return false;
+	}
+	
+	std::vector<RecordedFrame> frames;
+	RecordedFrame frame;
+	while (reader->readFrame(frame)) frames.push_back(frame);
+	if (reader->getUnknownTags() > 0) log(Warning, "Skipped %i samples with unknown tags in %s", reader->getUnknownTags(), take);
+	if (reader->getSkippedLines() > 0) log(Warning, "Skipped %i lines that are not samples in %s", reader->getSkippedLines(), take);
+	if (reader->getIncompleteFrames() > 0) log(Warning, "%i of %i frames of %s are incomplete", reader->getIncompleteFrames(), reader->getFrames(), take);
+	delete reader;
+	
+	Header header = {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	MappedFile::getFileInfo(take, header.sourceSize, header.sourceTime);
+	header.frameCount = (uint32_t)frames.size();
+	header.frameSize = sizeof(RecordedFrame);
+	header.frames = sizeof(Header);
+	header.size = sizeof(Header) + frames.size() * sizeof(RecordedFrame);
+	
+	std::string filename = getFileName(take);
+	if (!MappedFile::replaceFile(filename.c_str(), &header, sizeof(Header), frames.data(), frames.size() * sizeof(RecordedFrame))) {
+		log(Warning, "Could not write recording %s", filename.c_str());
+		return false;
+	}
+	
+	log(Info, "Wrote recording %s, %i frames, %i KB", filename.c_str(), (int)frames.size(), (int)(header.size / 1024));
+	return true;
+}
+
+std::string Recording::getFileName(const char* take) {
+	return std::string(take) + ".rec";
+}
+
+int Recording::findFrame(double time) const {
+	// The frames are sorted by time
+	int first = 0;
+	int last = frameCount - 1;
+	while (first < last) {
+		int middle = (first + last + 1) / 2;
+		if (frames[middle].time <= time) first = middle;
+		else last = middle - 1;
+	}
+	return first;
+}
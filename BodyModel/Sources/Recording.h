@@ -0,0 +1,70 @@
+#pragma once
+
+#include "EndEffector.h"
+#include "MappedFile.h"
+
+#include <Kore/Math/Quaternion.h>
+#include <Kore/Math/Vector.h>
+
+#include <cstdint>
+#include <string>
+
+// One frame of a recorded take: the sample of every tracked end-effector at one point in time
+struct RecordedFrame {
+	static const int deviceCount = unknown;	// One slot per EndEffectorIndices
+	
+	double time;			// [s] since the first sample
+	float scale;
+	uint32_t devices;		// Bit i is set if the frame has a sample of end-effector i
+	float position[deviceCount][3];
+	float rotation[deviceCount][4];	// x, y, z, w
+	
+	bool hasDevice(int device) const {
+		return (devices & (1u << device)) != 0;
+	}
+	
+	Kore::vec3 getPosition(int device) const {
+		return Kore::vec3(position[device][0], position[device][1], position[device][2]);
+	}
+	
+	Kore::Quaternion getRotation(int device) const {
+		return Kore::Quaternion(rotation[device][0], rotation[device][1], rotation[device][2], rotation[device][3]);
+	}
+};
+
+// Binary version of a .csv take, written next to it as <take>.csv.rec. The frames are fixed size records in one array,
+// so the file is mapped instead of read: opening costs the same for every length, frame i is at a fixed offset and
+// the frames of a take can be handed out to several threads in chunks. The header holds a format version and the size
+// and modification time of the .csv, a recording that does not match its take or has an older format is converted
+// again.
+class Recording {
+	
+public:
+	static const unsigned int version = 1;
+	static const int csvFrameRate = 90;	// Older .csv takes have no sample times, they were recorded at the 90 Hz of the HMD
+	
+	// Maps the recording of take, converting the .csv first if there is no up to date recording. A .rec file is mapped
+	// as it is. nullptr if there is neither.
+	static Recording* load(const char* take);
+	
+	// Reads the .csv take and writes its recording. The lines of a frame are the samples up to the next repeated tag, the
+	// time of a frame is that of its newest sample or, in takes without a time column, frame / csvFrameRate.
+	static bool convert(const char* take);
+	
+	// <take>.rec
+	static std::string getFileName(const char* take);
+	
+	int getFrameCount() const { return frameCount; }
+	const RecordedFrame& getFrame(int frame) const { return frames[frame]; }
+	double getDuration() const { return frameCount > 0 ? frames[frameCount - 1].time : 0.0; }
+	
+	// Index of the last frame at or before time [s], 0 before the first frame
+	int findFrame(double time) const;
+	
+private:
+	MappedFile mapping;
+	const RecordedFrame* frames = nullptr;
+	int frameCount = 0;
+	
+	Recording() {}
+};
@@ -0,0 +1,45 @@
+#include "pch.h"
+#include "ReplayClock.h"
+
+#include "Recording.h"
+
+#include <Kore/Math/Core.h>
+
+ReplayClock::ReplayClock(double speed, bool frameStep) : speed(speed), frameStep(frameStep) {}
+
+void ReplayClock::start(const Recording* take, double now) {
+	this->take = take;
+	next = 0;
+	frameTime = now;
+	
+	// Frame times count from the first sample, the first frame is due right away
+	startTime = take != nullptr && take->getFrameCount() > 0 && speed > 0.0 ? now - take->getFrame(0).time / speed : now;
+	
+	playedFrames = 0;
+	driftSum = 0.0;
+	maxDrift = 0.0;
+	lastDrift = 0.0;
+}
+
+int ReplayClock::nextFrame(double now) {
+	if (take == nullptr || next >= take->getFrameCount()) return take != nullptr ? take->getFrameCount() : 0;
+	
+	if (frameStep) {
+		if (pendingSteps <= 0) return -1;
+		--pendingSteps;
+		frameTime = now;
+	} else if (speed > 0.0) {
+		double dueTime = startTime + take->getFrame(next).time / speed;
+		if (now < dueTime) return -1;
+		frameTime = dueTime;
+		
+		lastDrift = (now - dueTime) * 1000.0;
+		driftSum += lastDrift;
+		maxDrift = Kore::max(maxDrift, lastDrift);
+	} else {
+		frameTime = now;
+	}
+	
+	++playedFrames;
+	return next++;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+
+class Recording;
+
+// Decides when the frames of a recorded take are played. The frames are scheduled at their recorded times (see
+// RecordedFrame::time) divided by speed, so the playback no longer depends on how often the caller asks for a frame. A
+// frame that is solved late is not skipped, the following frames are played as soon as possible until the schedule
+// is met again; how late they are is the drift. Every frame of a take is played in every mode, so the IK sees the
+// same sequence on every machine.
+//   speed > 0		N times real time, 1 is real time
+//   speed <= 0		unthrottled, every call plays the next frame
+//   frameStep		a frame is only played after step(), regardless of speed
+class ReplayClock {
+	
+public:
+	ReplayClock(double speed = 1.0, bool frameStep = false);
+	
+	// Starts playing take from its first frame at now [s, System::time()], resets the drift
+	void start(const Recording* take, double now);
+	
+	// Index of the frame to play at now and advances past it. -1 if the next frame is not due yet, the frame count of
+	// the take once all frames are played.
+	int nextFrame(double now);
+	
+	// When the frame returned by the last nextFrame was due [s, System::time()], the time of its samples. Unthrottled
+	// and stepped frames are due when they are played.
+	double getFrameTime() const { return frameTime; }
+	
+	// Any thread: lets one more frame play in frame step mode
+	void step() { ++pendingSteps; }
+	
+	// How late the frames since start were played after they were due [ms], 0 unless paced by speed
+	int getPlayedFrames() const { return playedFrames; }
+	double getMeanDrift() const { return playedFrames > 0 ? driftSum / playedFrames : 0.0; }
+	double getMaxDrift() const { return maxDrift; }
+	double getLastDrift() const { return lastDrift; }
+	
+private:
+	const Recording* take = nullptr;
+	double speed;
+	bool frameStep;
+	std::atomic<int> pendingSteps{ 0 };
+	
+	double startTime = 0.0;		// When the first frame of the take is due
+	int next = 0;
+	double frameTime = 0.0;
+	
+	int playedFrames = 0;
+	double driftSum = 0.0;
+	double maxDrift = 0.0;
+	double lastDrift = 0.0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free ring buffer for one producer and one consumer thread. Unlike TripleBuffer every value reaches the consumer
+// in order: push() fails instead of overwriting when the consumer falls behind by capacity values. Neither side ever
+// waits for the other. capacity has to be a power of two.
+template<class T, int capacity> class RingBuffer {
+	
+public:
+	// Producer: false if the buffer is full, the value is then not queued
+	bool push(const T& value) {
+		unsigned int tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - headIndex.load(std::memory_order_acquire) == (unsigned int)capacity) return false;
+		slots[tail & indexMask] = value;
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	
+	// Consumer: false if the buffer is empty
+	bool pop(T& value) {
+		unsigned int head = headIndex.load(std::memory_order_relaxed);
+		if (head == tailIndex.load(std::memory_order_acquire)) return false;
+		value = slots[head & indexMask];
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	
+	// Values queued at the time of the call, the other thread may have changed it already
+	int size() const {
+		return (int)(tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire));
+	}
+	
+private:
+	static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity has to be a power of two");
+	static const unsigned int indexMask = capacity - 1;
+	
+	// The indices are padded apart instead of aligned, new ignores over-alignment before C++17 and the buffer is
+	// usually a member of a heap object
+	T slots[capacity];
+	char headPadding[64];
+	std::atomic<unsigned int> headIndex{ 0 };	// Next value to pop, written by the consumer
+	char tailPadding[64];
+	std::atomic<unsigned int> tailIndex{ 0 };	// Next slot to push into, written by the producer
+};
@@ -2,8 +2,12 @@
 
 #include <Kore/Math/Core.h>
 
+// Collect the IK statistics of every solve (see InverseKinematics::getErrorPos), defined next to the IK parameters. Off
+// unless a parameter sweep is running, the statistics cost time in every solve.
+extern bool eval;
+
 enum IKMode {
-	JT = 0, JPI = 1, DLS = 2, SVD = 3, SVD_DLS = 4, SDLS = 5
+	JT = 0, JPI = 1, DLS = 2, SVD = 3, SVD_DLS = 4, SDLS = 5, ANALYTIC = 6 // ANALYTIC: closed-form two-bone IK for hands and feet, refined with DLS
 };
 
 namespace {
@@ -19,16 +23,24 @@ namespace {
 
 	const int numTrackers = 3;
 	const bool simpleIK = true; // Simple IK uses only 6 sensors (ignoring forearms)
+	const bool wholeBodyIK = false; // Solve all end-effectors together in one stacked Jacobian instead of one after another
+	const bool warmStartIK = false; // Start every solve from the last two solutions extrapolated and cap the iterations by the target displacement
+	const int warmStartMinIterations = 2; // Iterations for a target that did not move since the last frame
+	const float warmStartStepPerIteration = 0.005f; // One more iteration for every 5 mm the target moved [m]
+	
+	const bool ikThread = true; // Solve the IK on its own thread and hand the poses to the renderer through a triple buffer
+	const bool logFrameTiming = false; // Log tracker sample -> pose published -> pose rendered for every frame
+	const double replaySpeed = 1.0; // Play the takes at N times real time by their recorded sample times, 0 plays every frame as soon as it is solved
+	const bool replayFrameStep = false; // Play the next frame of a take only on the N key
 
 	// Optimized IK Parameter
-	//										JT = 0		JPI = 1		DLS = 2		SVD = 3		SVD_DLS = 4		SDLS = 5
-	const float optimalLambda[6]		= { 0.35f,		0.05f,		0.25f,		0.03f,		0.25f,			1.0f / 12.0f * Kore::pi };
-	const float optimalErrorMaxPos[6]	= { 0.01f,		0.1f,		0.001f,		0.01f,		0.001f,			0.01f	};
-	const float optimalErrorMaxRot[6] 	= { 0.01f,		0.1f,		0.01f,		0.01f,		0.01f,			0.01f	};
-	const float optimalMaxIterations[6] = { 30.0f,		4000.0f,	20.0f,		10.0f,		20.0f,			20.0f	};
+	//										JT = 0		JPI = 1		DLS = 2		SVD = 3		SVD_DLS = 4		SDLS = 5					ANALYTIC = 6
+	const float optimalLambda[7]		= { 0.35f,		0.05f,		0.25f,		0.03f,		0.25f,			1.0f / 12.0f * Kore::pi,	0.25f };
+	const float optimalErrorMaxPos[7]	= { 0.01f,		0.1f,		0.001f,		0.01f,		0.001f,			0.01f,						0.001f	};
+	const float optimalErrorMaxRot[7] 	= { 0.01f,		0.1f,		0.01f,		0.01f,		0.01f,			0.01f,						0.01f	};
+	const float optimalMaxIterations[7] = { 30.0f,		4000.0f,	20.0f,		10.0f,		20.0f,			20.0f,						5.0f	};
     
     // Evaluation values
-    const bool eval = false;
 	const int evalMinIk = 0;
-	const int evalMaxIk = 5;
+	const int evalMaxIk = 6;
 }
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <Kore/Math/Matrix.h>
+#include <Kore/Math/Quaternion.h>
+
+#include <math.h>
+
+// Vectorised kernels for the forward kinematics and the Jacobian of the IK and for the skinning. The backend is selected
+// at compile time: AVX (4 x 4 matrix multiply only, the other kernels use SSE), SSE, NEON or the scalar code if
+// IK_NO_SIMD is defined or the target has none of them. The results match the Kore operations they replace to a few
+// ulp, the replay tool checks them with --bench --simd and --bench --skin.
+#if !defined(IK_NO_SIMD)
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define IK_SSE
+#include <xmmintrin.h>
+#if defined(__AVX__)
+#define IK_AVX
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IK_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace Kore {
+	
+	namespace SimdMath {
+		// result = a * b, result may be a or b. Kore matrices are stored column by column.
+		inline void multiply(const Kore::mat4& a, const Kore::mat4& b, Kore::mat4& result) {
+#if defined(IK_AVX)
+			__m256 a0 = _mm256_broadcast_ps((const __m128*)a.matrix[0]);
+			__m256 a1 = _mm256_broadcast_ps((const __m128*)a.matrix[1]);
+			__m256 a2 = _mm256_broadcast_ps((const __m128*)a.matrix[2]);
+			__m256 a3 = _mm256_broadcast_ps((const __m128*)a.matrix[3]);
+			// Two columns of b per register, each lane of a column broadcast within its half
+			for (int j = 0; j < 4; j += 2) {
+				__m256 bj = _mm256_loadu_ps(b.matrix[j]);
+				__m256 c = _mm256_mul_ps(a0, _mm256_permute_ps(bj, 0x00));
+				c = _mm256_add_ps(c, _mm256_mul_ps(a1, _mm256_permute_ps(bj, 0x55)));
+				c = _mm256_add_ps(c, _mm256_mul_ps(a2, _mm256_permute_ps(bj, 0xaa)));
+				c = _mm256_add_ps(c, _mm256_mul_ps(a3, _mm256_permute_ps(bj, 0xff)));
+				_mm256_storeu_ps(result.matrix[j], c);
+			}
+#elif defined(IK_SSE)
+			__m128 a0 = _mm_loadu_ps(a.matrix[0]);
+			__m128 a1 = _mm_loadu_ps(a.matrix[1]);
+			__m128 a2 = _mm_loadu_ps(a.matrix[2]);
+			__m128 a3 = _mm_loadu_ps(a.matrix[3]);
+			for (int j = 0; j < 4; ++j) {
+				__m128 bj = _mm_loadu_ps(b.matrix[j]);
+				__m128 c = _mm_mul_ps(a0, _mm_shuffle_ps(bj, bj, 0x00));
+				c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_shuffle_ps(bj, bj, 0x55)));
+				c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_shuffle_ps(bj, bj, 0xaa)));
+				c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_shuffle_ps(bj, bj, 0xff)));
+				_mm_storeu_ps(result.matrix[j], c);
+			}
+#elif defined(IK_NEON)
+			float32x4_t a0 = vld1q_f32(a.matrix[0]);
+			float32x4_t a1 = vld1q_f32(a.matrix[1]);
+			float32x4_t a2 = vld1q_f32(a.matrix[2]);
+			float32x4_t a3 = vld1q_f32(a.matrix[3]);
+			for (int j = 0; j < 4; ++j) {
+				float32x4_t bj = vld1q_f32(b.matrix[j]);
+				float32x4_t c = vmulq_n_f32(a0, vgetq_lane_f32(bj, 0));
+				c = vmlaq_n_f32(c, a1, vgetq_lane_f32(bj, 1));
+				c = vmlaq_n_f32(c, a2, vgetq_lane_f32(bj, 2));
+				c = vmlaq_n_f32(c, a3, vgetq_lane_f32(bj, 3));
+				vst1q_f32(result.matrix[j], c);
+			}
+#else
+			Kore::mat4 c;
+			for (int j = 0; j < 4; ++j)
+				for (int i = 0; i < 4; ++i)
+					c.matrix[j][i] = a.matrix[0][i] * b.matrix[j][0] + a.matrix[1][i] * b.matrix[j][1] + a.matrix[2][i] * b.matrix[j][2] + a.matrix[3][i] * b.matrix[j][3];
+			result = c;
+#endif
+		}
+		
+		// a.rotated(b)
+		inline Kore::Quaternion multiply(const Kore::Quaternion& a, const Kore::Quaternion& b) {
+#if defined(IK_SSE)
+			// Lanes x, y, z, w: a.w * b + a.x * (b.w, -b.z, b.y, -b.x) + a.y * (b.z, b.w, -b.x, -b.y) + a.z * (-b.y, b.x, b.w, -b.z)
+			__m128 vb = _mm_set_ps(b.w, b.z, b.y, b.x);
+			__m128 c = _mm_mul_ps(_mm_set1_ps(a.w), vb);
+			c = _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(a.x), _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(0, 1, 2, 3)), _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f))));
+			c = _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(a.y), _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(1, 0, 3, 2)), _mm_set_ps(-0.0f, -0.0f, 0.0f, 0.0f))));
+			c = _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(a.z), _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f))));
+			alignas(16) float q[4];
+			_mm_store_ps(q, c);
+			return Kore::Quaternion(q[0], q[1], q[2], q[3]);
+#elif defined(IK_NEON)
+			const float termW[4] = { b.x, b.y, b.z, b.w };
+			const float termX[4] = { b.w, -b.z, b.y, -b.x };
+			const float termY[4] = { b.z, b.w, -b.x, -b.y };
+			const float termZ[4] = { -b.y, b.x, b.w, -b.z };
+			float32x4_t c = vmulq_n_f32(vld1q_f32(termW), a.w);
+			c = vmlaq_n_f32(c, vld1q_f32(termX), a.x);
+			c = vmlaq_n_f32(c, vld1q_f32(termY), a.y);
+			c = vmlaq_n_f32(c, vld1q_f32(termZ), a.z);
+			float q[4];
+			vst1q_f32(q, c);
+			return Kore::Quaternion(q[0], q[1], q[2], q[3]);
+#else
+			return a.rotated(b);
+#endif
+		}
+		
+		// q.normalize()
+		inline void normalize(Kore::Quaternion& q) {
+#if defined(IK_SSE)
+			__m128 v = _mm_set_ps(q.w, q.z, q.y, q.x);
+			__m128 sum = _mm_mul_ps(v, v);
+			sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+			sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+			// Exact square root and division, the reciprocal square root estimate is too coarse for the rotations
+			__m128 length = _mm_sqrt_ss(sum);
+			v = _mm_div_ps(v, _mm_shuffle_ps(length, length, 0));
+			alignas(16) float n[4];
+			_mm_store_ps(n, v);
+			q = Kore::Quaternion(n[0], n[1], n[2], n[3]);
+#else
+			q.normalize();
+#endif
+		}
+		
+		// local = transform * rotation.matrix().Transpose(), the local transformation of a bone from its rotation. Only the
+		// upper 3 x 3 block of the rotation matrix is multiplied, the translation column of transform is copied.
+		inline void localMatrix(const Kore::mat4& transform, const Kore::Quaternion& rotation, Kore::mat4& local) {
+			float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+			const float r[3][3] = {	// Columns
+				{ 1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y) },
+				{ 2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x) },
+				{ 2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y) }
+			};
+#if defined(IK_SSE)
+			__m128 t0 = _mm_loadu_ps(transform.matrix[0]);
+			__m128 t1 = _mm_loadu_ps(transform.matrix[1]);
+			__m128 t2 = _mm_loadu_ps(transform.matrix[2]);
+			__m128 t3 = _mm_loadu_ps(transform.matrix[3]);
+			for (int j = 0; j < 3; ++j) {
+				__m128 c = _mm_mul_ps(t0, _mm_set1_ps(r[j][0]));
+				c = _mm_add_ps(c, _mm_mul_ps(t1, _mm_set1_ps(r[j][1])));
+				c = _mm_add_ps(c, _mm_mul_ps(t2, _mm_set1_ps(r[j][2])));
+				_mm_storeu_ps(local.matrix[j], c);
+			}
+			_mm_storeu_ps(local.matrix[3], t3);
+#elif defined(IK_NEON)
+			float32x4_t t0 = vld1q_f32(transform.matrix[0]);
+			float32x4_t t1 = vld1q_f32(transform.matrix[1]);
+			float32x4_t t2 = vld1q_f32(transform.matrix[2]);
+			float32x4_t t3 = vld1q_f32(transform.matrix[3]);
+			for (int j = 0; j < 3; ++j) {
+				float32x4_t c = vmulq_n_f32(t0, r[j][0]);
+				c = vmlaq_n_f32(c, t1, r[j][1]);
+				c = vmlaq_n_f32(c, t2, r[j][2]);
+				vst1q_f32(local.matrix[j], c);
+			}
+			vst1q_f32(local.matrix[3], t3);
+#else
+			Kore::mat4 c;
+			for (int i = 0; i < 4; ++i) {
+				for (int j = 0; j < 3; ++j)
+					c.matrix[j][i] = transform.matrix[0][i] * r[j][0] + transform.matrix[1][i] * r[j][1] + transform.matrix[2][i] * r[j][2];
+				c.matrix[3][i] = transform.matrix[3][i];
+			}
+			local = c;
+#endif
+		}
+		
+		// Column of the 6 x N Jacobian for the rotation of a bone around its local axis (0 = x, 1 = y, 2 = z): the world
+		// axis v of the bone and v x lever, lever is the end-effector position minus the bone position
+		inline void jacobianColumn(const Kore::mat4& combined, int axis, const Kore::vec3& lever, float* column) {
+			const float* v = combined.matrix[axis];	// combined * (axis, 0)
+#if defined(IK_SSE)
+			__m128 a = _mm_set_ps(0.0f, v[2], v[1], v[0]);
+			__m128 b = _mm_set_ps(0.0f, lever.z(), lever.y(), lever.x());
+			// a x b = a.yzx * b.zxy - a.zxy * b.yzx
+			__m128 cross = _mm_sub_ps(
+				_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2))),
+				_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))));
+			alignas(16) float c[4];
+			_mm_store_ps(c, cross);
+			column[0] = c[0];
+			column[1] = c[1];
+			column[2] = c[2];
+#else
+			column[0] = v[1] * lever.z() - v[2] * lever.y();
+			column[1] = v[2] * lever.x() - v[0] * lever.z();
+			column[2] = v[0] * lever.y() - v[1] * lever.x();
+#endif
+			column[3] = v[0];
+			column[4] = v[1];
+			column[5] = v[2];
+		}
+		
+		// Linear blend skinning of one vertex with the fixed influences of Mesh: position = scale * sum(weight * matrix *
+		// (position, 1)), normal = sum(weight * matrix * (normal, 0)), the weights sum to 65535. Unused influences have
+		// weight 0 and are blended like the others, without a branch.
+		inline void skinVertex(const Kore::mat4* matrices, const unsigned char* bones, const unsigned short* weights, const float* position, const float* normal, float scale, float* skinnedPosition, float* skinnedNormal) {
+			const float weightScale = 1.0f / 65535.0f;
+#if defined(IK_SSE)
+			// Blend the matrices first, then transform once
+			__m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+			for (int k = 0; k < 4; ++k) {
+				const Kore::mat4& m = matrices[bones[k]];
+				__m128 w = _mm_set1_ps(weights[k] * weightScale);
+				c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m.matrix[0])));
+				c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m.matrix[1])));
+				c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m.matrix[2])));
+				c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m.matrix[3])));
+			}
+			__m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(position[0])), _mm_mul_ps(c1, _mm_set1_ps(position[1]))), _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(position[2])), c3));
+			__m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(normal[0])), _mm_mul_ps(c1, _mm_set1_ps(normal[1]))), _mm_mul_ps(c2, _mm_set1_ps(normal[2])));
+			alignas(16) float result[8];
+			_mm_store_ps(result, _mm_mul_ps(p, _mm_set1_ps(scale)));
+			_mm_store_ps(result + 4, n);
+#elif defined(IK_NEON)
+			float32x4_t c0 = vdupq_n_f32(0.0f), c1 = vdupq_n_f32(0.0f), c2 = vdupq_n_f32(0.0f), c3 = vdupq_n_f32(0.0f);
+			for (int k = 0; k < 4; ++k) {
+				const Kore::mat4& m = matrices[bones[k]];
+				float w = weights[k] * weightScale;
+				c0 = vmlaq_n_f32(c0, vld1q_f32(m.matrix[0]), w);
+				c1 = vmlaq_n_f32(c1, vld1q_f32(m.matrix[1]), w);
+				c2 = vmlaq_n_f32(c2, vld1q_f32(m.matrix[2]), w);
+				c3 = vmlaq_n_f32(c3, vld1q_f32(m.matrix[3]), w);
+			}
+			float32x4_t p = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(c3, c0, position[0]), c1, position[1]), c2, position[2]);
+			float32x4_t n = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(c0, normal[0]), c1, normal[1]), c2, normal[2]);
+			float result[8];
+			vst1q_f32(result, vmulq_n_f32(p, scale));
+			vst1q_f32(result + 4, n);
+#else
+			float result[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int k = 0; k < 4; ++k) {
+				const Kore::mat4& m = matrices[bones[k]];
+				float w = weights[k] * weightScale;
+				for (int i = 0; i < 3; ++i) {
+					result[i] += w * (m.matrix[0][i] * position[0] + m.matrix[1][i] * position[1] + m.matrix[2][i] * position[2] + m.matrix[3][i]);
+					result[4 + i] += w * (m.matrix[0][i] * normal[0] + m.matrix[1][i] * normal[1] + m.matrix[2][i] * normal[2]);
+				}
+			}
+			for (int i = 0; i < 3; ++i) result[i] *= scale;
+#endif
+			for (int i = 0; i < 3; ++i) {
+				skinnedPosition[i] = result[i];
+				skinnedNormal[i] = result[4 + i];
+			}
+		}
+	}
+}
@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "Skinning.h"
+
+Skinning::Skinning(const std::vector<Mesh*>& meshes, int threadCount) : nextBatch(0) {
+	for (int j = 0; j < (int)meshes.size(); ++j) {
+		const Mesh* mesh = meshes[j];
+		this->meshes.push_back(mesh);
+		
+		for (int begin = 0; begin < mesh->numVertices; begin += batchSize) {
+			Batch batch = { j, begin, Kore::min(begin + batchSize, mesh->numVertices) };
+			batches.push_back(batch);
+		}
+	}
+	
+	if (threadCount <= 0) threadCount = Kore::max((int)std::thread::hardware_concurrency(), 1);
+	threadCount = Kore::min(threadCount, (int)batches.size());
+	for (int t = 1; t < threadCount; ++t) workers.push_back(std::thread(&Skinning::workerLoop, this));
+}
+
+Skinning::~Skinning() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	startCondition.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+void Skinning::skin(const Kore::mat4* finalTransform, float scale, float* const* vertices) {
+	this->finalTransform = finalTransform;
+	this->scale = scale;
+	this->vertices = vertices;
+	nextBatch = 0;
+	
+	if (!workers.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++generation;
+			busyWorkers = (int)workers.size();
+		}
+		startCondition.notify_all();
+	}
+	
+	work();
+	
+	if (!workers.empty()) {
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this]() { return busyWorkers == 0; });
+	}
+}
+
+void Skinning::workerLoop() {
+	int skinned = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock, [&]() { return quit || generation != skinned; });
+			if (quit) return;
+			skinned = generation;
+		}
+		
+		work();
+		
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) doneCondition.notify_one();
+	}
+}
+
+void Skinning::work() {
+	int count = (int)batches.size();
+	for (int batch = nextBatch.fetch_add(1); batch < count; batch = nextBatch.fetch_add(1)) skinBatch(batches[batch]);
+}
+
+void Skinning::skinBatch(const Batch& batch) {
+	const Mesh* mesh = meshes[batch.mesh];
+	float* meshVertices = vertices[batch.mesh];
+	const int maxInfluences = Mesh::maxInfluences;
+	
+	for (int i = batch.begin; i < batch.end; ++i) {
+		float* vertex = &meshVertices[i * 8];
+		Kore::SimdMath::skinVertex(finalTransform, &mesh->influenceBones[i * maxInfluences], &mesh->influenceWeights[i * maxInfluences], &mesh->vertices[i * 3], &mesh->normals[i * 3], scale, &vertex[0], &vertex[5]);
+		
+		// texCoord
+		vertex[3] = mesh->texcoord[i * 2 + 0];
+		vertex[4] = 1.0f - mesh->texcoord[i * 2 + 1];
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "MeshObject.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Linear blend skinning of the avatar meshes on the CPU. The skinning matrices of a pose (SkeletonPose::finalTransform)
+// are the bone palette, every vertex blends the matrices of its Mesh::maxInfluences influences and transforms its
+// position and normal once with the blend (SimdMath::skinVertex). The vertices are cut into batches once, skin() hands
+// them out to a pool of threads. Skin once per pose and draw the result as often as needed: both eyes, the monitor and the mirror.
+class Skinning {
+	
+public:
+	Skinning(const std::vector<Mesh*>& meshes, int threadCount = 0); // 0: one thread per core, the thread calling skin() is one of them
+	~Skinning();
+	
+	// Skins all meshes into interleaved vertex arrays (position, texture coordinate, normal), vertices[j] belongs to
+	// meshes[j]. The positions are scaled by scale like MeshObject::setScale expects.
+	void skin(const Kore::mat4* finalTransform, float scale, float* const* vertices);
+	
+private:
+	static const int batchSize = 1024; // Vertices
+	
+	std::vector<const Mesh*> meshes;
+	
+	struct Batch {
+		int mesh;
+		int begin;
+		int end;
+	};
+	std::vector<Batch> batches;
+	
+	// Input of the current skin()
+	const Kore::mat4* finalTransform = nullptr;
+	float scale = 1.0f;
+	float* const* vertices = nullptr;
+	
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable startCondition;
+	std::condition_variable doneCondition;
+	int generation = 0;		// Incremented by every skin()
+	int busyWorkers = 0;
+	bool quit = false;
+	
+	std::atomic<int> nextBatch;
+	
+	void workerLoop();
+	void work();
+	void skinBatch(const Batch& batch);
+};
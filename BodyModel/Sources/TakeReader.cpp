@@ -0,0 +1,262 @@
+#include "pch.h"
+#include "TakeReader.h"
+
+#include <Kore/Log.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace Kore;
+
+namespace {
+	
+	// The powers of ten that are exact in float and in double
+	const float floatPowers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+	const double doublePowers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	
+	bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+	
+	bool isDigit(char c) {
+		return c >= '0' && c <= '9';
+	}
+	
+	const char* skipSpaces(const char* text, const char* end) {
+		while (text < end && isSpace(*text)) ++text;
+		return text;
+	}
+	
+	// Sign, the first 19 significant digits and the decimal exponent of the number at text, truncated if a digit after
+	// those is not 0. Returns the end of the number, text if it has no digits.
+	const char* readDecimal(const char* text, const char* end, bool& negative, uint64_t& mantissa, int& exponent, bool& truncated) {
+		const char* p = text;
+		negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+		
+		mantissa = 0;
+		exponent = 0;
+		truncated = false;
+		int digits = 0;
+		bool any = false;
+		for (; p < end && isDigit(*p); ++p) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0) ++digits;
+			} else {
+				++exponent;
+				truncated = truncated || *p != '0';
+			}
+		}
+		if (p < end && *p == '.') {
+			for (++p; p < end && isDigit(*p); ++p) {
+				any = true;
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa != 0) ++digits;
+					--exponent;
+				} else {
+					truncated = truncated || *p != '0';
+				}
+			}
+		}
+		if (!any) return text;
+		
+		// An e without digits is not part of the number
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool negativeExponent = false;
+			if (q < end && (*q == '-' || *q == '+')) negativeExponent = *q++ == '-';
+			if (q < end && isDigit(*q)) {
+				int value = 0;
+				for (; q < end && isDigit(*q); ++q) value = Kore::min(value * 10 + (*q - '0'), 100000);
+				exponent += negativeExponent ? -value : value;
+				p = q;
+			}
+		}
+		return p;
+	}
+	
+}
+
+TakeReader* TakeReader::open(const char* filename) {
+	TakeReader* reader = new TakeReader();
+	if (!reader->mapping.map(filename)) {
+		delete reader;
+		return nullptr;
+	}
+	reader->next = reader->mapping.data();
+	reader->end = reader->next + reader->mapping.size();
+	
+	// tag [time] rawPosX rawPosY rawPosZ rawRotX rawRotY rawRotZ rawRotW scale
+	const char* lineEnd = static_cast<const char*>(std::memchr(reader->next, '\n', reader->end - reader->next));
+	if (lineEnd == nullptr) lineEnd = reader->end;
+	std::string header(reader->next, lineEnd);
+	if (header.compare(0, 4, "tag ") != 0) {
+		log(Error, "%s is not a take, it has no header", filename);
+		delete reader;
+		return nullptr;
+	}
+	reader->timeColumn = header.find(" time ") != std::string::npos;
+	reader->next = lineEnd < reader->end ? lineEnd + 1 : reader->end;
+	return reader;
+}
+
+bool TakeReader::parseLine(TakeSample& sample) {
+	const char* lineEnd = static_cast<const char*>(std::memchr(next, '\n', end - next));
+	if (lineEnd == nullptr) lineEnd = end;
+	const char* p = skipSpaces(next, lineEnd);
+	next = lineEnd < end ? lineEnd + 1 : end;
+	
+	// Blank lines are not counted
+	const char* tag = p;
+	while (p < lineEnd && !isSpace(*p)) ++p;
+	if (p == tag) return false;
+	sample.index = getEndEffectorIndex(tag, p - tag);
+	
+	sample.time = 0.0;
+	if (timeColumn) {
+		p = skipSpaces(p, lineEnd);
+		const char* number = p;
+		p = parseDouble(p, lineEnd, sample.time);
+		if (p == number) {
+			++skippedLines;
+			return false;
+		}
+	}
+	
+	float* values[8] = { &sample.position[0], &sample.position[1], &sample.position[2], &sample.rotation[0], &sample.rotation[1], &sample.rotation[2], &sample.rotation[3], &sample.scale };
+	for (int i = 0; i < 8; ++i) {
+		p = skipSpaces(p, lineEnd);
+		const char* number = p;
+		p = parseFloat(p, lineEnd, *values[i]);
+		if (p == number) {
+			++skippedLines;
+			return false;
+		}
+	}
+	
+	if (skipSpaces(p, lineEnd) != lineEnd) {
+		++skippedLines;
+		return false;
+	}
+	return true;
+}
+
+bool TakeReader::readSample(TakeSample& sample) {
+	while (next < end) {
+		if (!parseLine(sample)) continue;
+		if (sample.index == unknown) {
+			++unknownTags;
+			continue;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool TakeReader::readFrame(RecordedFrame& frame) {
+	frame = RecordedFrame();
+	TakeSample sample;
+	while (true) {
+		if (hasPending) {
+			sample = pending;
+			hasPending = false;
+		} else if (!readSample(sample)) {
+			break;
+		}
+		
+		// A tag that is already in the frame starts the next one
+		if (frame.hasDevice(sample.index)) {
+			pending = sample;
+			hasPending = true;
+			break;
+		}
+		
+		if (frames == 0 && frame.devices == 0) startTime = sample.time;
+		frame.time = frame.devices == 0 ? sample.time - startTime : Kore::max(frame.time, sample.time - startTime);
+		frame.devices |= 1u << sample.index;
+		frame.scale = sample.scale;
+		std::memcpy(frame.position[sample.index], sample.position, sizeof(sample.position));
+		std::memcpy(frame.rotation[sample.index], sample.rotation, sizeof(sample.rotation));
+	}
+	if (frame.devices == 0) return false;
+	
+	if (!timeColumn) frame.time = (double)frames / Recording::csvFrameRate;
+	if (frames == 0) takeDevices = frame.devices;
+	else if ((frame.devices & takeDevices) != takeDevices) ++incompleteFrames;
+	++frames;
+	return true;
+}
+
+EndEffectorIndices TakeReader::getEndEffectorIndex(const char* tag, size_t length) {
+	// The first two characters and the length leave one candidate, which is compared once
+	EndEffectorIndices index = unknown;
+	bool left = tag[0] == 'l';
+	switch (length > 2 ? tag[0] : '\0') {
+		case 'h':
+			index = length == 4 ? head : hip;
+			break;
+		case 'l':
+		case 'r':
+			switch (tag[1]) {
+				case 'H':
+					index = left ? leftHand : rightHand;
+					break;
+				case 'F':
+					if (length == 8) index = left ? leftForeArm : rightForeArm;
+					else index = left ? leftFoot : rightFoot;
+					break;
+				case 'K':
+					index = left ? leftKnee : rightKnee;
+					break;
+				default:
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+	if (index == unknown || std::strlen(endEffectorTags[index]) != length || std::memcmp(tag, endEffectorTags[index], length) != 0) return unknown;
+	return index;
+}
+
+const char* TakeReader::parseFloat(const char* text, const char* end, float& value) {
+	bool negative, truncated;
+	uint64_t mantissa;
+	int exponent;
+	const char* numberEnd = readDecimal(text, end, negative, mantissa, exponent, truncated);
+	if (numberEnd == text) return text;
+	
+	// Both operands are exact in float, so the one rounding of the product or quotient is the correct one. The numbers
+	// the Logger writes have 6 significant digits, all but the tiniest take this path.
+	if (!truncated && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+		float magnitude = exponent < 0 ? (float)mantissa / floatPowers[-exponent] : (float)mantissa * floatPowers[exponent];
+		value = negative ? -magnitude : magnitude;
+		return numberEnd;
+	}
+	
+	// strtof needs a terminated string, the mapping has none
+	value = std::strtof(std::string(text, numberEnd).c_str(), nullptr);
+	return numberEnd;
+}
+
+const char* TakeReader::parseDouble(const char* text, const char* end, double& value) {
+	bool negative, truncated;
+	uint64_t mantissa;
+	int exponent;
+	const char* numberEnd = readDecimal(text, end, negative, mantissa, exponent, truncated);
+	if (numberEnd == text) return text;
+	
+	if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+		double magnitude = exponent < 0 ? (double)mantissa / doublePowers[-exponent] : (double)mantissa * doublePowers[exponent];
+		value = negative ? -magnitude : magnitude;
+		return numberEnd;
+	}
+	
+	value = std::strtod(std::string(text, numberEnd).c_str(), nullptr);
+	return numberEnd;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Recording.h"
+
+#include <cstddef>
+
+// One line of a .csv take
+struct TakeSample {
+	EndEffectorIndices index;	// unknown if the tag is none of endEffectorTags
+	double time;				// [s] since Logger::startLogger, 0 in takes without a time column
+	float position[3];
+	float rotation[4];			// x, y, z, w
+	float scale;
+};
+
+// Streaming reader of the .csv takes Logger::saveData writes, with or without the time column. The take is mapped (see
+// MappedFile.h) and tokenised in place: a tag is looked up by its first characters without copying it, the numbers are
+// parsed straight from the mapping. Lines that are not a sample are skipped and counted instead of ending the take.
+class TakeReader {
+	
+public:
+	// nullptr if the file is missing or does not start with the header of a take
+	static TakeReader* open(const char* filename);
+	
+	bool hasTime() const { return timeColumn; }
+	
+	// Next line with a known tag, false at the end of the take
+	bool readSample(TakeSample& sample);
+	
+	// Next frame: the samples up to the next repeated tag, false at the end of the take. The time of a frame is that of
+	// its newest sample [s] since the first sample or, without a time column, frame / Recording::csvFrameRate. The
+	// end-effectors of the first frame are those of the take, a later frame without one of them is incomplete.
+	bool readFrame(RecordedFrame& frame);
+	
+	int getFrames() const { return frames; }
+	int getSkippedLines() const { return skippedLines; }		// Not a sample
+	int getUnknownTags() const { return unknownTags; }
+	int getIncompleteFrames() const { return incompleteFrames; }
+	
+	// EndEffectorIndices of a tag of length characters, unknown if it is none of endEffectorTags
+	static EndEffectorIndices getEndEffectorIndex(const char* tag, size_t length);
+	
+	// Parses the decimal number in [text, end) like std::from_chars and rounds it correctly. Returns the end of the
+	// number, text if there is none.
+	static const char* parseFloat(const char* text, const char* end, float& value);
+	static const char* parseDouble(const char* text, const char* end, double& value);
+	
+private:
+	MappedFile mapping;
+	const char* next = nullptr;		// Start of the next line
+	const char* end = nullptr;
+	bool timeColumn = false;
+	
+	TakeSample pending;				// Read by readFrame but part of the next frame
+	bool hasPending = false;
+	uint32_t takeDevices = 0;
+	double startTime = 0.0;
+	
+	int frames = 0;
+	int skippedLines = 0;
+	int unknownTags = 0;
+	int incompleteFrames = 0;
+	
+	TakeReader() {}
+	
+	// Parses the line at next and moves next past it, false if it is not a sample
+	bool parseLine(TakeSample& sample);
+};
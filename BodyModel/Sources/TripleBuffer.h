@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free triple buffer for one producer and one consumer thread. The producer always has a slot to write into and
+// the consumer always has a slot to read from, the third slot holds the latest published value. Neither side ever
+// waits for the other: values published while the consumer is busy are overwritten, the consumer only sees the latest.
+template<class T> class TripleBuffer {
+	
+public:
+	// Producer: fill back() and publish() it
+	T& back() {
+		return slots[backIndex];
+	}
+	
+	void publish() {
+		// Swap the back slot with the middle slot and mark it as new
+		backIndex = middle.exchange(backIndex | fresh, std::memory_order_acq_rel) & indexMask;
+	}
+	
+	// Consumer: true if a value was published since the last call, front() is then the latest value
+	bool consume() {
+		if ((middle.load(std::memory_order_relaxed) & fresh) == 0) return false;
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+	
+	const T& front() const {
+		return slots[frontIndex];
+	}
+	
+	// All three slots, e.g. to allocate them before the threads start
+	T& slot(int index) {
+		return slots[index];
+	}
+	
+private:
+	static const int indexMask = 3;
+	static const int fresh = 4;
+	
+	T slots[3];
+	alignas(64) int backIndex = 0;		// Producer only
+	alignas(64) int frontIndex = 1;		// Consumer only
+	alignas(64) std::atomic<int> middle{ 2 };
+};
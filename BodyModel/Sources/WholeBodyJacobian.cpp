@@ -0,0 +1,267 @@
+#include "pch.h"
+#include "WholeBodyJacobian.h"
+#include "RotationUtility.h"
+
+// IK parameters are per thread so that independent skeletons can be solved in parallel
+extern thread_local float lambda[];
+
+WholeBodyJacobian::WholeBodyJacobian(const std::vector<int>& subtreeEnd) : subtreeEnd(subtreeEnd) {}
+
+void WholeBodyJacobian::setEndEffectors(BoneNode** bones, const int* chainDOFs, const float* endEffectorWeights, int endEffectorCount) {
+	assert(endEffectorCount <= maxEndEffectors);
+	count = endEffectorCount;
+	targetBones = bones;
+	weights = endEffectorWeights;
+	
+	// clear() keeps the capacity, the columns are only allocated on the first solve
+	columnBone.clear();
+	columnAxis.clear();
+	for (int k = 0; k < count; ++k) {
+		BoneNode* bone = targetBones[k];
+		int joint = 0;
+		while (bone->initialized && joint < chainDOFs[k]) {
+			bool known = false;
+			for (size_t column = 0; column < columnBone.size() && !known; ++column) known = columnBone[column] == bone;
+			
+			float axes[3] = { bone->axes.x(), bone->axes.y(), bone->axes.z() };
+			for (int axis = 0; axis < 3; ++axis) {
+				if (axes[axis] != 1.0f || joint >= chainDOFs[k]) continue;
+				if (!known) {
+					columnBone.push_back(bone);
+					columnAxis.push_back(axis);
+				}
+				joint += 1;
+			}
+			
+			bone = bone->parent;
+		}
+	}
+}
+
+void WholeBodyJacobian::calcDeltaTheta(const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, int ikMode) {
+	deltaTheta.SetLength(getColumnCount());
+	deltaTheta.SetZero();
+	if (getColumnCount() == 0) return;
+	
+	calcDeltaP(desPositions, desRotations);
+	calcJacobian();
+	
+	switch (ikMode) {
+		case JPI:
+			calcDeltaThetaByDLS(0.0f, lambda[1]);
+			break;
+		case DLS:
+		case ANALYTIC: // No two-bone solve for the whole body, only the DLS refinement
+			calcDeltaThetaByDLS(lambda[ikMode], 1.0f);
+			break;
+		case SVD:
+		case SVD_DLS:
+			calcDeltaThetaBySVD(ikMode);
+			break;
+		case SDLS:
+			calcDeltaThetaBySDLS();
+			break;
+		
+		default:
+			calcDeltaThetaByTranspose();
+			break;
+	}
+}
+
+int WholeBodyJacobian::getColumnCount() const {
+	return (int)columnBone.size();
+}
+
+BoneNode* WholeBodyJacobian::getColumnBone(int column) const {
+	return columnBone[column];
+}
+
+int WholeBodyJacobian::getColumnAxis(int column) const {
+	return columnAxis[column];
+}
+
+float WholeBodyJacobian::getDeltaTheta(int column) const {
+	return (float)deltaTheta[column];
+}
+
+float WholeBodyJacobian::getPositionError() const {
+	return errorPos;
+}
+
+float WholeBodyJacobian::getRotationError() const {
+	return errorRot;
+}
+
+bool WholeBodyJacobian::affects(int column, BoneNode* targetBone) const {
+	// A joint moves the end-effector if the end-effector is in the subtree of the joint
+	int joint = columnBone[column]->nodeIndex - 1;
+	int target = targetBone->nodeIndex - 1;
+	return joint <= target && target < subtreeEnd[joint];
+}
+
+void WholeBodyJacobian::calcDeltaP(const Kore::vec3* desPositions, const Kore::Quaternion* desRotations) {
+	deltaP.SetLength(6 * count);
+	errorPos = 0.0f;
+	errorRot = 0.0f;
+	
+	for (int k = 0; k < count; ++k) {
+		BoneNode* bone = targetBones[k];
+		
+		// Same error as Jacobian::calcDeltaP
+		Kore::vec3 deltaPos = desPositions[k] - bone->getPosition();
+		
+		Kore::Quaternion rot_current = bone->getOrientation();
+		Kore::Quaternion rot_desired = desRotations[k];
+		rot_desired.normalize();
+		
+		Kore::Quaternion deltaRot_quat = rot_desired.rotated(rot_current.invert());
+		if (deltaRot_quat.w < 0) deltaRot_quat = deltaRot_quat.scaled(-1);
+		
+		Kore::vec3 deltaRot = Kore::vec3(0, 0, 0);
+		Kore::RotationUtility::quatToEuler(&deltaRot_quat, &deltaRot.x(), &deltaRot.y(), &deltaRot.z());
+		
+		errorPos = Kore::max(errorPos, deltaPos.getLength());
+		errorRot = Kore::max(errorRot, deltaRot.getLength());
+		
+		for (int i = 0; i < 3; ++i) {
+			deltaP[6 * k + i] = weights[k] * deltaPos[i];
+			deltaP[6 * k + 3 + i] = weights[k] * deltaRot[i];
+		}
+	}
+}
+
+void WholeBodyJacobian::calcJacobian() {
+	J.SetSize(6 * count, getColumnCount());
+	J.SetZero();
+	
+	for (int column = 0; column < getColumnCount(); ++column) {
+		BoneNode* bone = columnBone[column];
+		
+		Kore::vec3 p_j = bone->getPosition();
+		
+		for (int k = 0; k < count; ++k) {
+			if (!affects(column, targetBones[k])) continue;
+			
+			float jacobianColumn[6];
+			Kore::SimdMath::jacobianColumn(bone->combined, columnAxis[column], targetBones[k]->getPosition() - p_j, jacobianColumn);
+			for (int i = 0; i < 6; ++i) J.Set(6 * k + i, column, weights[k] * jacobianColumn[i]);
+		}
+	}
+}
+
+void WholeBodyJacobian::calcDeltaThetaByTranspose() {
+	// deltaTheta = alpha * J^T * e with the step size alpha of Jacobian::calcDeltaThetaByTranspose
+	t.SetLength(J.GetNumColumns());
+	b.SetLength(J.GetNumRows());
+	J.MultiplyTranspose(deltaP, t);
+	J.Multiply(t, b);
+	
+	double bb = Dot(b, b);
+	double alpha = bb > nearNull ? Dot(deltaP, b) / bb : 0.0;
+	for (int n = 0; n < deltaTheta.GetLength(); ++n) deltaTheta[n] = alpha * t[n];
+}
+
+void WholeBodyJacobian::calcDeltaThetaByDLS(float l, float scale) {
+	long rows = J.GetNumRows();
+	long cols = J.GetNumColumns();
+	
+	if (rows <= cols) {
+		// deltaTheta = J^T * (J * J^T + l^2 * I)^-1 * e
+		A.SetSize(rows, rows);
+		MatrixRmn::MultiplyTranspose(J, J, A);
+		A.AddToDiagonal(Square(l));
+		
+		b.SetLength(rows);
+		A.Solve(deltaP, &b);
+		J.MultiplyTranspose(b, deltaTheta);
+	} else {
+		// deltaTheta = (J^T * J + l^2 * I)^-1 * J^T * e
+		A.SetSize(cols, cols);
+		MatrixRmn::TransposeMultiply(J, J, A);
+		A.AddToDiagonal(Square(l));
+		
+		t.SetLength(cols);
+		J.MultiplyTranspose(deltaP, t);
+		A.Solve(t, &deltaTheta);
+	}
+	
+	deltaTheta *= scale;
+}
+
+void WholeBodyJacobian::calcDeltaThetaBySVD(int ikMode) {
+	long rows = J.GetNumRows();
+	long cols = J.GetNumColumns();
+	U.SetSize(rows, rows);
+	V.SetSize(cols, cols);
+	d.SetLength(Min(rows, cols));
+	J.ComputeSVD(U, d, V);
+	
+	double maxAbs = d.MaxAbs();
+	for (int i = 0; i < d.GetLength(); ++i) {
+		double alpha_i = U.DotProductColumn(deltaP, i);
+		double factor;
+		if (ikMode == SVD) {
+			if (fabs(d[i]) <= lambda[3] * maxAbs) continue; // modification to stabilize SVD
+			factor = alpha_i / d[i];
+		} else {
+			factor = alpha_i * d[i] / (Square(d[i]) + Square(lambda[4]));
+		}
+		
+		for (int n = 0; n < cols; ++n) deltaTheta[n] += factor * V.Get(n, i);
+	}
+}
+
+void WholeBodyJacobian::calcDeltaThetaBySDLS() {
+	// Selectively damped least squares (Buss and Kim 2005) with the error and column norms taken per end-effector
+	long rows = J.GetNumRows();
+	long cols = J.GetNumColumns();
+	U.SetSize(rows, rows);
+	V.SetSize(cols, cols);
+	d.SetLength(Min(rows, cols));
+	J.ComputeSVD(U, d, V);
+	
+	// Norm of the 6 rows of every end-effector in every column
+	A.SetSize(count, cols);
+	for (int n = 0; n < cols; ++n) {
+		for (int k = 0; k < count; ++k) {
+			double norm = 0.0;
+			for (int m = 6 * k; m < 6 * k + 6; ++m) norm += Square(J.Get(m, n));
+			A.Set(k, n, sqrt(norm));
+		}
+	}
+	
+	t.SetLength(cols);
+	for (int i = 0; i < d.GetLength(); ++i) {
+		double alpha_i = U.DotProductColumn(deltaP, i);
+		
+		double N_i = 0.0;
+		for (int k = 0; k < count; ++k) {
+			double norm = 0.0;
+			for (int m = 6 * k; m < 6 * k + 6; ++m) norm += Square(U.Get(m, i));
+			N_i += sqrt(norm);
+		}
+		
+		if (fabs(d[i]) <= nearNull || N_i <= nearNull || fabs(alpha_i) <= nearNull || lambda[5] <= nearNull) continue;
+		
+		double omegaInverse_i = 1.0 / d[i];
+		double M_i = 0.0;
+		for (int n = 0; n < cols; ++n)
+			for (int k = 0; k < count; ++k)
+				M_i += fabs(V.Get(n, i)) * A.Get(k, n);
+		M_i *= fabs(omegaInverse_i);
+		
+		double gamma_i = M_i > N_i ? N_i / M_i : 1.0;
+		gamma_i *= lambda[5];
+		
+		for (int n = 0; n < cols; ++n) t[n] = omegaInverse_i * alpha_i * V.Get(n, i);
+		clampMaxAbs(t, (float)gamma_i);
+		deltaTheta += t;
+	}
+	
+	clampMaxAbs(deltaTheta, lambda[5]);
+}
+
+void WholeBodyJacobian::clampMaxAbs(VectorRn& vec, float gamma) {
+	double max = vec.MaxAbs();
+	if (max > gamma) vec *= gamma / max;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MeshObject.h"
+#include "Settings.h"
+#include "BussIK/MatrixRmn.h"
+
+#include <vector>
+
+// Stacked Jacobian of several end-effectors over the union of their joint chains. Every end-effector adds 6 weighted rows
+// (position and rotation error), every joint DOF of any chain one column, so shared joints are solved once for all
+// end-effectors instead of being pulled by one end-effector after the other.
+class WholeBodyJacobian {
+	
+public:
+	static const int maxEndEffectors = 10;
+	
+	// subtreeEnd as in InverseKinematics: the subtree of bones[i] is the range [i, subtreeEnd[i])
+	WholeBodyJacobian(const std::vector<int>& subtreeEnd);
+	
+	// Chain of an end-effector: the first chainDOFs joint DOFs from the target bone up to the root
+	void setEndEffectors(BoneNode** targetBones, const int* chainDOFs, const float* weights, int count);
+	void calcDeltaTheta(const Kore::vec3* desPositions, const Kore::Quaternion* desRotations, int ikMode);
+	
+	int getColumnCount() const;
+	BoneNode* getColumnBone(int column) const;
+	int getColumnAxis(int column) const;	// 0 = x, 1 = y, 2 = z
+	float getDeltaTheta(int column) const;
+	
+	// Largest unweighted error over all end-effectors
+	float getPositionError() const;
+	float getRotationError() const;
+	
+private:
+	const std::vector<int>& subtreeEnd;
+	
+	int count = 0;
+	BoneNode** targetBones = nullptr;
+	const float* weights = nullptr;
+	
+	// Columns are grouped per bone in x, y, z order
+	std::vector<BoneNode*> columnBone;
+	std::vector<int> columnAxis;
+	
+	float errorPos = -1.0f;
+	float errorRot = -1.0f;
+	
+	// Work space, only grows
+	MatrixRmn J;
+	MatrixRmn A;
+	MatrixRmn U;
+	MatrixRmn V;
+	VectorRn d;
+	VectorRn deltaP;
+	VectorRn deltaTheta;
+	VectorRn t;
+	VectorRn b;
+	
+	bool affects(int column, BoneNode* targetBone) const;
+	void calcJacobian();
+	void calcDeltaP(const Kore::vec3* desPositions, const Kore::Quaternion* desRotations);
+	
+	void calcDeltaThetaByTranspose();
+	void calcDeltaThetaByDLS(float l, float scale);
+	void calcDeltaThetaBySVD(int ikMode);
+	void calcDeltaThetaBySDLS();
+	void clampMaxAbs(VectorRn& vec, float gamma);
+};